@@ -0,0 +1,349 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/context.h"
+#include "cpp_obj-preview/rasterizer.h"
+#include "cpp_obj-preview/optimize.h"
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/normals.h"
+#include "cpp_obj-preview/report.h"
+#include "cpp_obj-preview/gif.h"
+#include "synthetic.h"
+
+namespace fs = std::filesystem;
+
+struct BenchOptions {
+    std::string dir;
+    std::string output;
+    std::string filter;
+    size_t maxTriangles = 1000000;
+    int frames = 36;
+    int repeat = 1;
+    int threads = defaultThreadCount();
+    ObjParser parser = ObjParser::Native;
+    ContextBackend backend = defaultContextBackend();
+    GifDither dither = GifDither::Sierra2_4a;
+};
+
+// Stage timings in milliseconds in output order, negative when the stage did not run
+using StageTimes = std::vector<std::pair<std::string, double>>;
+
+static const SyntheticMesh SUITE[] = {
+    {"sphere-1k", 1000, 1, 1, true},
+    {"sphere-10k", 10000, 1, 1, true},
+    {"sphere-100k", 100000, 1, 1, true},
+    {"sphere-1m", 1000000, 1, 1, true},
+    {"sphere-10m", 10000000, 1, 1, true},
+    {"sphere-100m", 100000000, 1, 1, true},
+    {"shapes-1000", 100000, 1000, 1, true},
+    {"materials-256", 100000, 1, 256, true},
+    {"no-normals-100k", 100000, 1, 1, false}
+};
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double timeStage(const std::function<void()>& stage) {
+    auto start = std::chrono::steady_clock::now();
+    stage();
+    return millisecondsSince(start);
+}
+
+// GL context and program shared by every asset, CPU rasterizer when there is none
+struct BenchRenderer {
+    ContextBackend backend;
+    RenderContext context;
+    std::unique_ptr<Shader> shader;
+};
+
+static int parseModel(const std::string& filename, const BenchOptions& options, ObjModel& model) {
+    model = ObjModel();
+    model.filename = filename;
+    std::string warn, err;
+    bool ret;
+    if (options.parser == ObjParser::Native) {
+        ret = loadObjNative(&model.attrib, &model.shapes, &model.materials, &model.comments, &warn, &err, filename, options.threads);
+    } else {
+        ret = tinyobj::LoadObj(&model.attrib, &model.shapes, &model.materials, &warn, &err, filename.c_str());
+    }
+    if (!ret) {
+        std::cerr << "Error: Failed to load/parse OBJ file: " << filename << ": " << err << std::endl;
+        return 1;
+    }
+    model.vertexCount = model.attrib.vertices.size() / 3;
+    model.normalCount = model.attrib.normals.size() / 3;
+    model.texcoordCount = model.attrib.texcoords.size() / 2;
+    for (const auto& shape : model.shapes) {
+        model.shapeFaces.push_back({shape.name, shape.mesh.num_face_vertices.size()});
+    }
+    return 0;
+}
+
+// Runs every stage of one preview in isolation; per-frame stages are averaged over options.frames
+static int measureAsset(const std::string& filename, const BenchOptions& options, BenchRenderer& renderer, StageTimes& times) {
+    ObjModel model;
+    int ret = 0;
+    times.push_back({"parse", timeStage([&] { ret = parseModel(filename, options, model); })});
+    if (ret != 0) {
+        return 1;
+    }
+    times.push_back({"comment_scan", timeStage([&] { readObjComments(filename); })});
+
+    PackedMeshes packed;
+    times.push_back({"dedup", timeStage([&] { packed = packShapes(model.attrib, model.shapes, options.threads); })});
+    times.push_back({"normals", timeStage([&] { generateNormals(packed, DEFAULT_CREASE_ANGLE, options.threads); })});
+    MeshArena arena = packed.arena();
+    model.renderedTriangles = arena.indexCount / 3;
+
+    GeometryStats stats;
+    times.push_back({"analyze", timeStage([&] { stats = analyzeGeometry(arena, options.threads); })});
+    times.push_back({"optimize", timeStage([&] { optimizeMeshes(arena, false, options.threads); })});
+    Camera camera = frameCamera(stats.bboxMin, stats.bboxMax, WIDTH / (float)HEIGHT);
+
+    int frames = options.frames;
+    std::vector<std::vector<unsigned char>> captured(frames, std::vector<unsigned char>((size_t)WIDTH * HEIGHT * 3));
+    if (renderer.backend == ContextBackend::Cpu) {
+        std::unique_ptr<CpuRasterizer> rasterizer;
+        times.push_back({"upload", timeStage([&] {
+            rasterizer.reset(new CpuRasterizer(arena, model.materials, {}, WIDTH, HEIGHT, options.threads));
+        })});
+        double render_time = 0.0;
+        double readback_time = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            render_time += timeStage([&] { rasterizer->draw(modelMatrix(frameAngle(frame, FRAMES), camera.center), camera); });
+            readback_time += timeStage([&] { std::memcpy(captured[frame].data(), rasterizer->pixels(), captured[frame].size()); });
+        }
+        times.push_back({"render_frame", render_time / frames});
+        times.push_back({"readback_frame", readback_time / frames});
+        times.push_back({"loop_frame", -1.0});
+        times.push_back({"atlas_frame", -1.0});
+    } else {
+        std::vector<MeshGL> meshes;
+        times.push_back({"upload", timeStage([&] {
+            meshes = uploadArena(arena, false, options.threads);
+            glFinish();
+        })});
+        MaterialBuffer materials = beginRender(*renderer.shader, camera, model.materials, {});
+        // first draw pays for shader and buffer residency, keep it out of the average
+        drawFrame(*renderer.shader, meshes, materials, camera, 0.0f);
+        glFinish();
+        double render_time = 0.0;
+        double readback_time = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            render_time += timeStage([&] {
+                drawFrame(*renderer.shader, meshes, materials, camera, frameAngle(frame, FRAMES));
+                glFinish();
+            });
+            // synchronous transfer cost, the preview hides most of it behind the readback ring
+            readback_time += timeStage([&] { glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, captured[frame].data()); });
+        }
+        times.push_back({"render_frame", render_time / frames});
+        times.push_back({"readback_frame", readback_time / frames});
+        glDeleteBuffers(1, &materials.ubo);
+
+        // the preview's own loop with its readback ring, one frame per pass and a full atlas per pass;
+        // its progress line goes to stderr with the rest of the bench's
+        FrameSink discard = [](int frame, const unsigned char* pixels) { return 0; };
+        std::streambuf* stdout_buffer = std::cout.rdbuf(std::cerr.rdbuf());
+        for (int tiles : {1, MAX_ATLAS_TILES}) {
+            RenderFormat format = {WIDTH, HEIGHT, frames, FPS, tiles};
+            double loop_time = timeStage([&] { ret = render(*renderer.shader, meshes, camera, model.materials, {}, format, discard); });
+            times.push_back({tiles == 1 ? "loop_frame" : "atlas_frame", loop_time / frames});
+        }
+        std::cout.rdbuf(stdout_buffer);
+        if (ret != 0) {
+            deleteMeshes(meshes);
+            return ret;
+        }
+        deleteMeshes(meshes);
+    }
+
+    GifEncoder gif;
+    std::string gif_path = options.dir + "/obj-overview.gif";
+    if (!gif.open(gif_path, WIDTH, HEIGHT, FPS, options.dither, true)) {
+        return 1;
+    }
+    times.push_back({"palette", timeStage([&] { gif.buildPalette(captured[0].data()); })});
+    std::vector<uint8_t> indices;
+    std::vector<uint8_t> lzw;
+    GifScratch scratch;
+    bool written = true;
+    double encode_time = timeStage([&] {
+        for (const auto& pixels : captured) {
+            gif.quantize(pixels.data(), indices, scratch);
+            gif.compress(indices, lzw, scratch);
+            written = gif.writeFrame(lzw) && written;
+        }
+    });
+    if (!gif.close() || !written) {
+        return 1;
+    }
+    times.push_back({"encode_frame", encode_time / frames});
+
+    times.push_back({"report", timeStage([&] { ret = generateReport(model, stats, options.dir + "/", {true, false, DEFAULT_FORMAT, "", false, ""}); })});
+    return ret;
+}
+
+static void writeJson(std::ostream& out, const BenchOptions& options, ContextBackend backend,
+                      const std::vector<std::pair<SyntheticMesh, StageTimes>>& results) {
+    const char* context_names[] = {"glfw", "egl", "cpu"};
+    out << "{\n";
+    out << "  \"threads\": " << options.threads << ",\n";
+    out << "  \"context\": \"" << context_names[(int)backend] << "\",\n";
+    out << "  \"parser\": \"" << (options.parser == ObjParser::Native ? "native" : "tinyobj") << "\",\n";
+    out << "  \"frames\": " << options.frames << ",\n";
+    out << "  \"repeat\": " << options.repeat << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const SyntheticMesh& mesh = results[i].first;
+        std::error_code ec;
+        uintmax_t file_bytes = fs::file_size(options.dir + "/" + mesh.name + ".obj", ec);
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"name\": \"" << mesh.name << "\", \"triangles\": " << syntheticTriangles(mesh.triangles)
+            << ", \"shapes\": " << mesh.shapes << ", \"materials\": " << mesh.materials
+            << ", \"normals\": " << (mesh.normals ? "true" : "false") << ", \"file_bytes\": " << (ec ? 0 : file_bytes) << ",\n";
+        out << "     \"stages_ms\": {";
+        const StageTimes& times = results[i].second;
+        for (size_t s = 0; s < times.size(); s++) {
+            out << (s == 0 ? "" : ", ") << "\"" << times[s].first << "\": ";
+            if (times[s].second < 0.0) {
+                out << "null";
+            } else {
+                out << times[s].second;
+            }
+        }
+        out << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+static int parseOptions(int argc, char** argv, BenchOptions& options) {
+    options.dir = (fs::temp_directory_path() / "cpp_obj-preview-bench").string();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--dir") {
+            options.dir = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--max-triangles") {
+            options.maxTriangles = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--frames") {
+            options.frames = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--repeat") {
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--threads") {
+            options.threads = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--parser") {
+            options.parser = parseObjParser(value);
+        } else if (arg == "--context") {
+            options.backend = parseContextBackend(value);
+        } else if (arg == "--dither") {
+            options.dither = parseGifDither(value);
+        } else {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (parseOptions(argc, argv, options) != 0) {
+        std::cerr << "Usage: cpp_obj-preview-bench [--dir path] [--output file.json] [--filter name] [--max-triangles n]"
+                     " [--frames n] [--repeat n] [--threads n] [--parser native|tinyobj] [--context egl|glfw|cpu] [--dither mode]\n";
+        return 1;
+    }
+    std::error_code ec;
+    fs::create_directories(options.dir, ec);
+    if (ec) {
+        std::cerr << "Error: Failed to create " << options.dir << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    BenchRenderer renderer;
+    renderer.backend = options.backend;
+    if (renderer.backend != ContextBackend::Cpu && renderer.context.create(renderer.backend, WIDTH, HEIGHT) != 0) {
+        std::cerr << "Error: Failed to create GL context, falling back to the CPU rasterizer\n";
+        renderer.backend = ContextBackend::Cpu;
+    }
+    if (renderer.backend != ContextBackend::Cpu) {
+        renderer.shader.reset(new Shader());
+    }
+
+    std::vector<std::pair<SyntheticMesh, StageTimes>> results;
+    int failed = 0;
+    for (const SyntheticMesh& mesh : SUITE) {
+        if (mesh.triangles > options.maxTriangles || mesh.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        // generated assets are deterministic, so they are kept and reused between runs
+        std::string filename = options.dir + "/" + mesh.name + ".obj";
+        double generate_time = -1.0;
+        if (!fs::exists(filename)) {
+            std::cerr << "Generating " << filename << "\n";
+            int ret = 0;
+            generate_time = timeStage([&] { ret = writeSyntheticMesh(mesh, options.dir); });
+            if (ret != 0) {
+                failed++;
+                continue;
+            }
+        }
+
+        std::cerr << "Measuring " << mesh.name << "\n";
+        StageTimes best;
+        for (int run = 0; run < options.repeat; run++) {
+            StageTimes times;
+            if (measureAsset(filename, options, renderer, times) != 0) {
+                std::cerr << "Error: Failed to measure " << mesh.name << std::endl;
+                best.clear();
+                break;
+            }
+            if (best.empty()) {
+                best = times;
+            }
+            for (size_t s = 0; s < times.size(); s++) {
+                best[s].second = std::min(best[s].second, times[s].second);
+            }
+        }
+        if (best.empty()) {
+            failed++;
+            continue;
+        }
+        best.insert(best.begin(), {"generate", generate_time});
+        results.push_back({mesh, best});
+    }
+
+    if (options.output.empty()) {
+        writeJson(std::cout, options, renderer.backend, results);
+    } else {
+        std::ofstream out(options.output);
+        if (!out.is_open()) {
+            std::cerr << "Error: Failed to create " << options.output << std::endl;
+            return 1;
+        }
+        writeJson(out, options, renderer.backend, results);
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "synthetic.h"
+
+// cube face frames, axisU x axisV is the outward normal so quads wind counter-clockwise
+static const float FACE_FRAMES[6][3][3] = {
+    {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
+    {{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+    {{0, 1, 0}, {0, 0, 1}, {1, 0, 0}},
+    {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}},
+    {{0, 0, 1}, {1, 0, 0}, {0, 1, 0}},
+    {{0, 0, -1}, {0, 1, 0}, {1, 0, 0}}
+};
+
+// Appends formatted lines to a large buffer, multi-gigabyte files would
+// spend most of their time in stdio otherwise
+class LineWriter {
+public:
+    explicit LineWriter(FILE* file) : file(file), failed(false) {
+        buffer.reserve(BUFFER_SIZE + 256);
+    }
+
+    void text(const char* value) {
+        buffer.insert(buffer.end(), value, value + std::strlen(value));
+    }
+
+    void integer(size_t value) {
+        char digits[24];
+        int count = 0;
+        do {
+            digits[count++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        while (count > 0) buffer.push_back(digits[--count]);
+    }
+
+    // fixed six decimals, enough to round-trip the unit sphere coordinates
+    void fixed(float value) {
+        if (value < 0.0f) {
+            buffer.push_back('-');
+            value = -value;
+        }
+        long long scaled = std::llround((double)value * 1e6);
+        integer((size_t)(scaled / 1000000));
+        buffer.push_back('.');
+        long long fraction = scaled % 1000000;
+        for (long long divisor = 100000; divisor > 0; divisor /= 10) {
+            buffer.push_back((char)('0' + fraction / divisor % 10));
+        }
+    }
+
+    void endLine() {
+        buffer.push_back('\n');
+        if (buffer.size() >= BUFFER_SIZE) flush();
+    }
+
+    bool flush() {
+        if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+            failed = true;
+        }
+        buffer.clear();
+        return !failed;
+    }
+
+private:
+    static const size_t BUFFER_SIZE = 1 << 22;
+
+    FILE* file;
+    bool failed;
+    std::vector<char> buffer;
+};
+
+static size_t gridSize(size_t requested) {
+    return std::max<size_t>(1, (size_t)std::llround(std::sqrt((double)requested / 12.0)));
+}
+
+size_t syntheticTriangles(size_t requested) {
+    size_t n = gridSize(requested);
+    return 12 * n * n;
+}
+
+static int writeMaterials(const SyntheticMesh& mesh, const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error: Failed to create " << path << std::endl;
+        return 1;
+    }
+    LineWriter out(file);
+    for (int m = 0; m < mesh.materials; m++) {
+        // spread the diffuse colors around the hue circle
+        float hue = (float)m / (float)mesh.materials * 6.0f;
+        float color[3];
+        for (int c = 0; c < 3; c++) {
+            float distance = std::fabs(std::fmod(hue + 4.0f - 2.0f * c, 6.0f) - 3.0f);
+            color[c] = std::min(1.0f, std::max(0.0f, distance - 1.0f)) * 0.8f + 0.1f;
+        }
+        out.text("newmtl mat_");
+        out.integer((size_t)m);
+        out.endLine();
+        out.text("Ka 0.100000 0.100000 0.100000");
+        out.endLine();
+        out.text("Kd");
+        for (float value : color) {
+            out.text(" ");
+            out.fixed(value);
+        }
+        out.endLine();
+        out.text("Ks 0.500000 0.500000 0.500000");
+        out.endLine();
+        out.text("Ns 32.000000");
+        out.endLine();
+        out.endLine();
+    }
+    bool ok = out.flush();
+    if (std::fclose(file) != 0 || !ok) {
+        std::cerr << "Error: Failed to write " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int writeSyntheticMesh(const SyntheticMesh& mesh, const std::string& dir) {
+    std::string base = dir + "/" + mesh.name;
+    if (mesh.materials > 0 && writeMaterials(mesh, base + ".mtl") != 0) {
+        return 1;
+    }
+
+    // written under a temporary name so an interrupted run never leaves a truncated asset behind
+    std::string path = base + ".obj";
+    std::string temp_path = path + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error: Failed to create " << temp_path << std::endl;
+        return 1;
+    }
+
+    size_t n = gridSize(mesh.triangles);
+    size_t triangles = 12 * n * n;
+    size_t side = n + 1;
+    LineWriter out(file);
+    out.text("# cpp_obj-preview synthetic cube sphere");
+    out.endLine();
+    out.text("# ");
+    out.integer(triangles);
+    out.text(" triangles, ");
+    out.integer((size_t)mesh.shapes);
+    out.text(" shapes, ");
+    out.integer((size_t)mesh.materials);
+    out.text(" materials");
+    out.endLine();
+    if (mesh.materials > 0) {
+        out.text("mtllib ");
+        out.text((mesh.name + ".mtl").c_str());
+        out.endLine();
+    }
+
+    // every cube face gets its own grid, seams duplicate positions like exported models do
+    for (int pass = 0; pass < (mesh.normals ? 2 : 1); pass++) {
+        for (const auto& frame : FACE_FRAMES) {
+            for (size_t j = 0; j < side; j++) {
+                for (size_t i = 0; i < side; i++) {
+                    float u = 2.0f * i / n - 1.0f;
+                    float v = 2.0f * j / n - 1.0f;
+                    float p[3];
+                    float length = 0.0f;
+                    for (int c = 0; c < 3; c++) {
+                        p[c] = frame[0][c] + u * frame[1][c] + v * frame[2][c];
+                        length += p[c] * p[c];
+                    }
+                    length = std::sqrt(length);
+                    out.text(pass == 0 ? "v" : "vn");
+                    for (float value : p) {
+                        out.text(" ");
+                        out.fixed(value / length);
+                    }
+                    out.endLine();
+                }
+            }
+        }
+    }
+
+    int shapes = std::max(1, mesh.shapes);
+    int materials = mesh.materials;
+    int shape = -1;
+    int material = -1;
+    size_t triangle = 0;
+    for (size_t face = 0; face < 6; face++) {
+        size_t face_base = face * side * side + 1;
+        for (size_t j = 0; j < n; j++) {
+            for (size_t i = 0; i < n; i++) {
+                size_t corners[4] = {
+                    face_base + j * side + i,
+                    face_base + j * side + i + 1,
+                    face_base + (j + 1) * side + i + 1,
+                    face_base + (j + 1) * side + i
+                };
+                const int quad_triangles[2][3] = {{0, 1, 2}, {0, 2, 3}};
+                for (const auto& corner : quad_triangles) {
+                    int next_shape = (int)(triangle * shapes / triangles);
+                    if (next_shape != shape) {
+                        shape = next_shape;
+                        out.text("o shape_");
+                        out.integer((size_t)shape);
+                        out.endLine();
+                        material = -1;
+                    }
+                    int next_material = materials > 0 ? (int)(triangle * materials / triangles) : -1;
+                    if (next_material != material) {
+                        material = next_material;
+                        out.text("usemtl mat_");
+                        out.integer((size_t)material);
+                        out.endLine();
+                    }
+                    out.text("f");
+                    for (int k = 0; k < 3; k++) {
+                        size_t index = corners[corner[k]];
+                        out.text(" ");
+                        out.integer(index);
+                        if (mesh.normals) {
+                            out.text("//");
+                            out.integer(index);
+                        }
+                    }
+                    out.endLine();
+                    triangle++;
+                }
+            }
+        }
+    }
+
+    bool ok = out.flush();
+    if (std::fclose(file) != 0 || !ok) {
+        std::cerr << "Error: Failed to write " << temp_path << std::endl;
+        std::remove(temp_path.c_str());
+        return 1;
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Error: Failed to rename " << temp_path << " to " << path << std::endl;
+        std::remove(temp_path.c_str());
+        return 1;
+    }
+    return 0;
+}
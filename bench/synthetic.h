@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// One generated benchmark asset: a cube sphere (every cube face an n x n grid
+// of quads split in two and pushed out onto the unit sphere) whose faces are
+// cut into `shapes` objects and `materials` usemtl runs of equal length
+struct SyntheticMesh {
+    std::string name;
+    size_t triangles;
+    int shapes;
+    int materials;
+    bool normals;
+};
+
+// Triangle count the generator really produces for a requested one (12 n^2)
+size_t syntheticTriangles(size_t requested);
+
+// Writes dir/name.obj and, with materials, dir/name.mtl
+int writeSyntheticMesh(const SyntheticMesh& mesh, const std::string& dir);
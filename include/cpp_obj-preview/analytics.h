@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpp_obj-preview/processing.h"
+
+// Results of the fused geometry pass. Topology is measured on vertices
+// welded by exact position, so normal/texcoord seams do not count as edges.
+struct GeometryStats {
+    glm::vec3 bboxMin;
+    glm::vec3 bboxMax;
+    // area weighted centroid of the surface
+    glm::vec3 centroid;
+    double surfaceArea;
+    double signedVolume;
+    size_t triangles;
+    size_t weldedVertices;
+    size_t degenerateEdges;
+    size_t degenerateFaces;
+    size_t duplicateFaces;
+    size_t boundaryEdges;
+    size_t nonManifoldEdges;
+    size_t nonManifoldFaces;
+    // false after a streaming load, which only sums the surface and leaves the counts above at 0
+    bool topology;
+};
+
+// One multi-threaded pass over the arena: SSE bounding box, area, volume and
+// centroid sums per chunk, then hash-partitioned parallel sorts of welded
+// vertices, edges and faces for the topology counts
+GeometryStats analyzeGeometry(const MeshArena& arena, int threads);
+
+// Maps every arena vertex to an id shared by all vertices at the same exact
+// position, returns the number of ids
+size_t weldPositions(const MeshArena& arena, int threads, std::vector<uint32_t>& weld);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Expands a batch source into OBJ paths: a directory is searched recursively
+// for .obj files, a pattern with * ? or [ is globbed and any other file is
+// read as a manifest with one path per line (relative to the manifest).
+int collectBatchFiles(const std::string& source, std::vector<std::string>& files);
+
+// save-dir subdirectory for one asset, named after the file stem with a
+// numeric suffix when two assets share a stem
+std::string batchSaveDir(const std::string& save_dir, const std::string& filename, std::unordered_map<std::string, int>& used);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/gif.h"
+
+// Per-frame cost of the overview, fitted from a few calibration frames
+struct FrameCost {
+    // seconds per frame whatever its size: vertex work, draw calls, readback latency
+    double fixed;
+    double perPixel;
+    // builtin gif downscaling, quantization and compression per rendered pixel, 0 when it is not measured
+    double encodePerPixel;
+};
+
+const int CALIBRATION_FRAMES = 3;
+// the fewest frames a budget may reduce the turntable to
+const int MIN_BUDGET_FRAMES = 12;
+// share of the budget the estimate may fill, the rest covers handing frames to
+// the encoder, draining it and writing the report
+const double BUDGET_HEADROOM = 0.85;
+
+// Renders format's frames with the model's geometry and a sink of the caller's choice
+using FormatRenderer = std::function<int(const RenderFormat& format, const FrameSink& sink)>;
+
+// Renders calibration frames at full and quarter size and fits their time to
+// fixed + perPixel * pixels, encode times one frame, scaled down by gif_scale, with a scratch encoder
+int calibrateFrameCost(const RenderFormat& format, const FormatRenderer& render_format, bool encode, GifDither dither, int gif_scale,
+                       FrameCost& cost);
+// Seconds the overview of format takes with workers encoding next to the renderer, sheet_frames quarter sized frames included
+double estimateSeconds(const RenderFormat& format, const FrameCost& cost, int workers, int sheet_frames);
+// Best format of the quality ladder (fewer frames first, then smaller frames) fitting into seconds,
+// the lowest rung when none does. fps shrinks with the frame count so one turn keeps its duration.
+RenderFormat budgetFormat(const RenderFormat& wanted, const FrameCost& cost, double seconds, int workers, int sheet_frames, double& estimate);
+// "800x600, 360 frames at 20 fps (1° step)"
+std::string describeFormat(const RenderFormat& format);
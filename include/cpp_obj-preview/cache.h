@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Content-addressed store of finished previews. An entry is a directory named
+// after the XXH64 of the OBJ bytes, the MTL files it references, their diffuse
+// textures and the render settings, holding obj-preview.md and the overview
+// gif and/or contact sheet the settings asked for. Entry mtimes are
+// bumped on every hit so pruneCache() can evict least recently used first.
+// Mesh sidecars (<hash>.mesh files) share the directory and the size limit.
+
+// XXH64 of the OBJ bytes, the MTL files its mtllib lines name and the map_Kd
+// images those name, false when the OBJ cannot be read
+bool hashSource(const std::string& filename, uint64_t& hash);
+std::string previewCacheKey(uint64_t source_hash, const std::string& settings);
+bool cacheContains(const std::string& cache_dir, const std::string& key);
+// Hardlinks (or copies) a cached preview into save_dir, rewriting the report's File line
+int restoreFromCache(const std::string& cache_dir, const std::string& key, const std::string& filename, const std::string& save_dir, bool overwrite);
+// Stores the named files of save_dir, the report among them
+int storeInCache(const std::string& cache_dir, const std::string& key, const std::string& save_dir, const std::vector<std::string>& files);
+// Removes the oldest entries until the cache is at most max_bytes. Entries
+// still being stored are skipped, except that max_bytes 0 clears them too.
+void pruneCache(const std::string& cache_dir, uint64_t max_bytes);
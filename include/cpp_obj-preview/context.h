@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <string>
+
+enum class ContextBackend {
+    Glfw,
+    Egl,
+    Cpu
+};
+
+ContextBackend parseContextBackend(const std::string& name);
+ContextBackend defaultContextBackend();
+
+// GL context plus the offscreen framebuffer every frame is rendered into.
+// The EGL backend runs surfaceless (or on a 1x1 pbuffer) and never touches a
+// window system, the GLFW backend keeps a hidden window only to own the context.
+class RenderContext {
+public:
+    RenderContext();
+    ~RenderContext();
+
+    int create(ContextBackend backend, int width, int height);
+    // Reallocates the framebuffer when the frame size changes, the context stays as it is
+    int resize(int width, int height);
+    void destroy();
+
+private:
+    int createGlfw(int width, int height);
+    int createEgl();
+    int createFramebuffer(int width, int height);
+
+    GLFWwindow* window;
+    void* eglDisplay;
+    void* eglContext;
+    void* eglSurface;
+    GLuint fbo;
+    GLuint colorBuffer;
+    GLuint depthBuffer;
+    int width;
+    int height;
+};
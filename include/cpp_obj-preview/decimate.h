@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include "cpp_obj-preview/processing.h"
+
+// Vertex clustering simplification. Every material batch of the arena with
+// more than `budget` triangles is snapped to the finest uniform grid that
+// keeps it within budget: vertices sharing a cell merge into their average
+// and triangles that collapse are dropped. Batches never share clusters, so
+// material boundaries stay intact. Returns false (leaving out untouched)
+// when no batch is over budget.
+bool decimateMeshes(const MeshArena& arena, size_t budget, int threads, PackedMeshes& out);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum class GifDither {
+    None,
+    Bayer,
+    Sierra2_4a
+};
+
+GifDither parseGifDither(const std::string& name);
+
+// Working buffers of quantize() and compress(), kept by their caller (one per
+// thread) so that frames after the first allocate nothing
+struct GifScratch {
+    std::vector<int> errors;
+    std::vector<int32_t> keys;
+    std::vector<uint16_t> codes;
+};
+
+// Streaming animated GIF writer with a single global palette.
+// The palette is built from the first frame (median cut), every following
+// frame is mapped onto it with the selected dithering and LZW compressed
+// straight into the output file, so no intermediate frames touch the disk.
+class GifEncoder {
+public:
+    GifEncoder();
+    ~GifEncoder();
+
+    bool open(const std::string& path, int width, int height, int fps, GifDither dither, bool overwrite);
+    // pixels are tightly packed RGB rows, bottom-up as returned by glReadPixels
+    bool addFrame(const unsigned char* pixels);
+    bool close();
+
+    // Stateless steps of addFrame, usable from several threads once the palette is built
+    void buildPalette(const unsigned char* pixels);
+    bool hasPalette() const;
+    void quantize(const unsigned char* pixels, std::vector<uint8_t>& indices, GifScratch& scratch) const;
+    void compress(const std::vector<uint8_t>& indices, std::vector<uint8_t>& out, GifScratch& scratch) const;
+    bool writeFrame(const std::vector<uint8_t>& lzw);
+
+private:
+    uint8_t nearest(int r, int g, int b) const;
+    bool writeHeader();
+
+    FILE* file;
+    int width;
+    int height;
+    int delay;
+    GifDither dither;
+    int frameCount;
+    bool headerWritten;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> lookup;
+    std::vector<uint8_t> indexBuffer;
+    std::vector<uint8_t> lzwBuffer;
+    GifScratch scratch;
+};
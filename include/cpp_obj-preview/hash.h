@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Streaming XXH64, bit-compatible with the reference implementation
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void update(const void* data, size_t size);
+    void update(const std::string& text);
+    uint64_t digest() const;
+
+private:
+    uint64_t acc[4];
+    unsigned char buffer[32];
+    size_t buffered;
+    uint64_t total;
+    uint64_t seed;
+};
+
+std::string hashToHex(uint64_t hash);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include "cpp_obj-preview/processing.h"
+
+const float DEFAULT_CREASE_ANGLE = 45.0f;
+
+// Fills in the normals the OBJ file left out, (0, 0, 0) in the interleaved
+// stream. The faces around a position are averaged weighted by area and corner
+// angle, but only with faces less than crease_angle degrees apart, and vertices
+// on a crease are split so every side keeps its own normal. Runs in parallel
+// over faces and welded positions, returns the number of normals written.
+size_t generateNormals(PackedMeshes& packed, float crease_angle, int threads);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <tiny_obj_loader.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class ObjParser {
+    Native,
+    TinyObj
+};
+
+ObjParser parseObjParser(const std::string& name);
+
+// Memory-maps the OBJ file, parses line-aligned chunks on `threads` threads and
+// merges them into the same structures tinyobj::LoadObj fills (faces are
+// fan-triangulated). '#' lines are collected into comments in the same pass.
+bool loadObjNative(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+                   std::vector<std::string>* comments, std::string* warn, std::string* err, const std::string& filename, int threads);
+
+class MeshSidecar;
+
+// Everything the renderer and the report need from one OBJ file
+struct ObjModel {
+    std::string filename;
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::vector<std::string> comments;
+
+    // report counts, the only trace of attrib/shapes when loaded from a sidecar
+    size_t vertexCount = 0;
+    size_t normalCount = 0;
+    size_t texcoordCount = 0;
+    std::vector<std::pair<std::string, size_t>> shapeFaces;
+    // triangles actually drawn after deduplication and decimation
+    size_t renderedTriangles = 0;
+
+    // XXH64 of the OBJ and MTL files, 0 when it was not computed
+    uint64_t sourceHash = 0;
+    // set when the geometry comes from a mapped mesh sidecar instead of attrib
+    std::shared_ptr<MeshSidecar> sidecar;
+    // set when the geometry is streamed to the GPU at render time, attrib and shapes stay empty until then
+    bool streamed = false;
+};
+
+// Receives the triangles of one shape and material, indexing the positions
+// and normals read so far, returns 0 to continue
+using ObjChunkSink = std::function<int(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& chunk)>;
+
+// Reads the OBJ file front to back in fixed windows instead of mapping it.
+// Positions and normals accumulate in model.attrib (texcoords are only counted,
+// the shader never reads them), faces are handed to sink in chunks of at most
+// chunk_triangles, split at every shape and material change, and dropped
+// afterwards. Fails once the tables, window and chunk would take more than
+// memory_limit bytes (0 for no limit).
+int streamObjNative(const std::string& filename, size_t chunk_triangles, size_t memory_limit, ObjModel& model, const ObjChunkSink& sink);
+
+std::vector<std::string> readObjComments(const std::string& filename);
+int loadModel(const std::string& filename, ObjParser parser, int threads, ObjModel& model);
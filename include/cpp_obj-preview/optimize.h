@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "cpp_obj-preview/processing.h"
+
+// What the shader reads per vertex: position and a GL_INT_2_10_10_10_REV
+// normal, 16 bytes instead of the 32 of the interleaved arena stream
+struct GpuVertex {
+    float position[3];
+    uint32_t normal;
+};
+
+// Fixed width, mesh sidecars store it as is
+struct GpuBatch {
+    int32_t materialId;
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    uint32_t indexType;
+    uint64_t indexOffset;
+    uint64_t indexCount;
+    int32_t baseVertex;
+    uint32_t reserved;
+};
+
+// Points at a GpuMeshes stream or at the one stored in a mesh sidecar
+struct GpuArena {
+    const GpuVertex* vertices;
+    size_t vertexCount;
+    // two per vertex, null when the stream has none
+    const float* texcoords;
+    const uint8_t* indices;
+    size_t indexBytes;
+    const GpuBatch* batches;
+    size_t batchCount;
+};
+
+// Arena geometry reordered for the GPU. Batches are cut into pieces of at most
+// 65536 triangles, optimized in parallel. Every piece gets Tipsify triangle order
+// (post-transform cache), vertices renumbered in first-use order (fetch
+// locality) and 16-bit indices relative to its base vertex when it has fewer
+// than 65536 vertices. indexOffset is in bytes into the mixed-width index bytes.
+// Texcoords only matter to textured materials, they are kept apart and only
+// filled when asked for so untextured models stay at 16 bytes per vertex.
+struct GpuMeshes {
+    std::vector<GpuVertex> vertices;
+    // two per vertex
+    std::vector<float> texcoords;
+    std::vector<uint8_t> indices;
+    std::vector<GpuBatch> batches;
+
+    GpuArena arena() const;
+};
+
+GpuMeshes optimizeMeshes(const MeshArena& arena, bool texcoords, int threads);
+uint32_t packNormal(float x, float y, float z);
+// Tipsify (Sander et al. 2007) triangle order for a vertex cache of cache_size entries
+std::vector<uint32_t> tipsify(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size);
+// Average cache miss ratio of a FIFO vertex cache, misses per triangle
+double averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/gif.h"
+#include "cpp_obj-preview/pipeline.h"
+
+// Encoder settings of an overview gif
+struct GifOutputOptions {
+    // integer downscale factor of the frames
+    int scale;
+    // PPM frames for ffmpeg instead of the builtin encoder
+    bool ffmpeg;
+    GifDither dither;
+    int workers;
+    int queueDepth;
+};
+
+// A gif being encoded by worker threads: written by the builtin encoder, or
+// as PPM frames for ffmpeg
+struct GifOutput {
+    GifEncoder gif;
+    std::unique_ptr<FramePipeline> pipeline;
+    std::vector<unsigned char> paletteFrame;
+    bool ffmpeg = false;
+};
+
+// Opens output for format's frames, scaled down by options.scale, and returns the sink feeding them to it
+int openGifOutput(GifOutput& output, const std::string& path, const RenderFormat& format, const GifOutputOptions& options, FrameSink& sink);
+// Waits for the encoder workers and finishes the builtin encoder's file
+int closeGifOutput(GifOutput& output);
+
+// Passes every frame on to next after handing the first one to publish,
+// halved into buffer when halve is set and the frame is at least 2x2
+FrameSink firstFrameSink(const FrameSink& next, int width, int height, bool halve, std::vector<unsigned char>& buffer,
+                         const std::function<int(const unsigned char* pixels, int width, int height)>& publish);
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+inline int defaultThreadCount() {
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// Runs fn(i) for every i in [0, count) on up to `threads` threads,
+// items are claimed one by one so uneven items balance out
+template <typename F>
+void parallelFor(size_t count, int threads, F&& fn) {
+    size_t thread_count = std::min((size_t)std::max(threads, 1), count);
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+        for (size_t i = next++; i < count; i = next++) fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < thread_count; t++) {
+        pool.emplace_back(run);
+    }
+    run();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+// Items a partitionSort bucket function returns this for are dropped
+const size_t PARTITION_SKIP = SIZE_MAX;
+const size_t PARTITION_CHUNK_SIZE = 1 << 16;
+
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Buckets are picked by the top bits of a hash, a few per thread for balance
+inline int bucketBits(int threads) {
+    int bucket_bits = 4;
+    while ((1 << bucket_bits) < std::max(threads, 1) * 16 && bucket_bits < 12) bucket_bits++;
+    return bucket_bits;
+}
+
+// Scatters items into hash buckets (items whose bucket is PARTITION_SKIP are
+// dropped) and sorts every bucket on its own thread; equal items share a bucket.
+// items is replaced by the sorted copy, the unsorted one is freed on return.
+// Returns the bucket boundaries in items.
+template <typename T, typename Bucket, typename Less>
+std::vector<size_t> partitionSort(std::vector<T>& items, size_t bucket_count, int threads, Bucket bucket, Less less) {
+    size_t chunks = (items.size() + PARTITION_CHUNK_SIZE - 1) / PARTITION_CHUNK_SIZE;
+    std::vector<size_t> counts(chunks * bucket_count, 0);
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(items.size(), (chunk + 1) * PARTITION_CHUNK_SIZE);
+        for (size_t i = chunk * PARTITION_CHUNK_SIZE; i < end; i++) {
+            size_t b = bucket(items[i]);
+            if (b != PARTITION_SKIP) counts[chunk * bucket_count + b]++;
+        }
+    });
+
+    // bucket-major prefix sums give every chunk its own write cursor per bucket
+    std::vector<size_t> offsets(bucket_count + 1, 0);
+    std::vector<size_t> cursors(chunks * bucket_count);
+    size_t total = 0;
+    for (size_t b = 0; b < bucket_count; b++) {
+        offsets[b] = total;
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            cursors[chunk * bucket_count + b] = total;
+            total += counts[chunk * bucket_count + b];
+        }
+    }
+    offsets[bucket_count] = total;
+
+    std::vector<T> sorted(total);
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(items.size(), (chunk + 1) * PARTITION_CHUNK_SIZE);
+        for (size_t i = chunk * PARTITION_CHUNK_SIZE; i < end; i++) {
+            size_t b = bucket(items[i]);
+            if (b != PARTITION_SKIP) sorted[cursors[chunk * bucket_count + b]++] = items[i];
+        }
+    });
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        std::sort(sorted.begin() + offsets[b], sorted.begin() + offsets[b + 1], less);
+    });
+    items.swap(sorted);
+    return offsets;
+}
+
+// parallelFor on threads kept alive between calls, for loops run every frame
+// where starting and joining the threads would cost more than the work (and
+// allocate). run() is called from one thread at a time, which works too.
+class WorkerPool {
+public:
+    explicit WorkerPool(int threads) {
+        for (int t = 1; t < threads; t++) {
+            workers.emplace_back(&WorkerPool::work, this);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    template <typename F>
+    void run(size_t count, F&& fn) {
+        if (workers.empty() || count <= 1) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+        // fn stays on this stack until every worker is done with it
+        using Fn = std::remove_reference_t<F>;
+        dispatch(count, [](void* context, size_t i) { (*static_cast<Fn*>(context))(i); }, (void*)&fn);
+    }
+
+private:
+    void dispatch(size_t count, void (*call)(void*, size_t), void* context) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->call = call;
+            this->context = context;
+            this->count = count;
+            next.store(0, std::memory_order_relaxed);
+            busy = (int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+
+    void drain() {
+        for (size_t i = next++; i < count; i = next++) call(context, i);
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            lock.unlock();
+            drain();
+            lock.lock();
+            if (--busy == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    void (*call)(void*, size_t) = nullptr;
+    void* context = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next{0};
+    uint64_t generation = 0;
+    int busy = 0;
+    bool stopping = false;
+};
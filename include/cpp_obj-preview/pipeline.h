@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include "cpp_obj-preview/gif.h"
+
+// Bounded multi-producer/multi-consumer queue (Vyukov), capacity is rounded up to a power of two
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells = std::vector<Cell>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    bool tryPush(const T& value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+        Cell() : sequence(0), value() {}
+        Cell(const Cell& other) : sequence(other.sequence.load()), value(other.value) {}
+    };
+
+    std::vector<Cell> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+// A frame and the buffers of its stage, recycled with the job: once every job
+// has been used, frames flow through the pipeline without allocating
+struct FrameJob {
+    int frame;
+    std::vector<unsigned char> pixels;
+    std::vector<unsigned char> scaled;
+    std::vector<uint8_t> indices;
+    std::vector<uint8_t> output;
+    GifScratch scratch;
+};
+
+// Render thread pushes frames, a worker pool runs the stage on them in
+// parallel and the writer receives the stage output strictly in frame order
+class FramePipeline {
+public:
+    using Stage = std::function<int(FrameJob& job)>;
+    using Writer = std::function<int(int frame, const std::vector<uint8_t>& output)>;
+
+    FramePipeline(size_t frameSize, int workers, int depth, Stage stage, Writer writer);
+    ~FramePipeline();
+
+    // Copies the frame into a recycled buffer, blocks while the queue is full.
+    // Frames are numbered from 0 and pushed in order.
+    int push(int frame, const unsigned char* pixels);
+    // Waits until every pushed frame has been written
+    int finish();
+
+private:
+    void work();
+    void complete(FrameJob* job);
+
+    size_t frameSize;
+    Stage stage;
+    Writer writer;
+    std::vector<FrameJob> jobs;
+    BoundedQueue<FrameJob*> freeJobs;
+    BoundedQueue<FrameJob*> pendingJobs;
+    std::vector<std::thread> threads;
+    std::atomic<bool> done;
+    std::atomic<bool> failed;
+    std::mutex orderMutex;
+    // finished jobs waiting for their turn, frame % jobs.size() is their slot:
+    // every job holds a frame, so the frames in flight never share one
+    std::vector<FrameJob*> reorder;
+    int nextFrame;
+};
+
+void downscaleFrame(const unsigned char* pixels, int width, int height, int factor, std::vector<unsigned char>& out);
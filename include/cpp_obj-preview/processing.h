@@ -1,3 +1,5 @@
+#pragma once
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -10,13 +12,79 @@
 #include <sstream>
 #include <iomanip>
 #include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include "cpp_obj-preview/texture.h"
+
+struct GpuArena;
 
+// One draw of the shared geometry arena: all shapes using materialId are
+// stored back to back in the index buffer starting at indexOffset (in bytes),
+// indexed relative to baseVertex with 16 or 32 bit indices
 struct MeshGL {
     GLuint vao;
     GLuint vbo;
     GLuint ebo;
     int indexCount;
     int materialId;
+    size_t indexOffset;
+    GLenum indexType;
+    GLint baseVertex;
+};
+
+// std140 Material blocks (default material last), bound per draw with glBindBufferRange
+// together with the block's diffuse texture
+struct MaterialBuffer {
+    GLuint ubo;
+    GLsizeiptr stride;
+    int count;
+    // one per block, 0 for untextured ones
+    std::vector<GLuint> textures;
+};
+
+// Deduplicated interleaved vertex stream (position, normal, texcoord) of one shape
+struct MeshData {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    int materialId;
+};
+
+// Batch of the packed geometry drawn with one material, fixed layout so it
+// can be stored in mesh sidecars as is
+struct MeshBatch {
+    int32_t materialId;
+    uint32_t reserved;
+    uint64_t indexOffset;
+    uint64_t indexCount;
+};
+
+// Whole-model geometry laid out as the GL arena stores it: shapes sorted by
+// material, indices rebased onto one interleaved vertex stream. Only points at
+// the data, which lives in PackedMeshes or in a mapped mesh sidecar.
+struct MeshArena {
+    const float* vertices;
+    size_t vertexCount;
+    const unsigned int* indices;
+    size_t indexCount;
+    const MeshBatch* batches;
+    size_t batchCount;
+};
+
+struct PackedMeshes {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<MeshBatch> batches;
+
+    MeshArena arena() const;
+};
+
+struct Camera {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos;
+    // bounding box center, the point the model rotates about
+    glm::vec3 center;
 };
 
 class Shader {
@@ -29,44 +97,119 @@ public:
     void setFloat(const std::string& name, float value) const;
     void setVec3(const std::string& name, const glm::vec3& value) const;
     void setMat4(const std::string &name, const glm::mat4 &mat) const;
+    void setMat4Array(const std::string& name, const glm::mat4* mats, int count) const;
+private:
+    GLint uniformLocation(const std::string& name) const;
+
+    mutable std::unordered_map<std::string, GLint> uniformLocations;
+};
+
+// Receives every rendered frame as bottom-up RGB rows, returns 0 on success
+using FrameSink = std::function<int(int frame, const unsigned char* pixels)>;
+
+// Ring of pixel pack buffers with fences: the oldest frame is mapped and handed
+// to the sink while the following ones are still being rasterized
+class ReadbackRing {
+public:
+    ReadbackRing(int width, int height, int count);
+    ~ReadbackRing();
+    int submit(int frame, const FrameSink& sink);
+    int flush(const FrameSink& sink);
+    double waitSeconds() const;
+private:
+    int consume(const FrameSink& sink);
+
+    std::vector<GLuint> buffers;
+    std::vector<GLsync> fences;
+    std::vector<int> frames;
+    int width;
+    int height;
+    int head;
+    int pending;
+    double waitTime;
 };
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
 const int FRAMES = 360;
+const int FPS = 20;
+const int READBACK_BUFFERS = 4;
+const int MAX_FRAME_SIZE = 8192;
+
+// Size of the models uniform array in VERTEX_CODE
+const int MAX_ATLAS_TILES = 16;
+
+// Size and length of the turntable, its frames are spread evenly over one turn.
+// tiles frames are drawn per pass into one atlas framebuffer and read back together.
+struct RenderFormat {
+    int width;
+    int height;
+    int frames;
+    int fps;
+    int tiles;
+};
+const RenderFormat DEFAULT_FORMAT = {WIDTH, HEIGHT, FRAMES, FPS, 1};
+
+const GLuint MATERIAL_BINDING = 0;
+const glm::vec3 LIGHT_POSITION(1.2f, 1.0f, 2.0f);
+const glm::vec3 LIGHT_AMBIENT(0.2f, 0.2f, 0.2f);
+const glm::vec3 LIGHT_DIFFUSE(0.5f, 0.5f, 0.5f);
+const glm::vec3 LIGHT_SPECULAR(1.0f, 1.0f, 1.0f);
+const glm::vec3 DEFAULT_MATERIAL_COLOR(0.5f);
+const float DEFAULT_MATERIAL_SHININESS = 0.5f;
 constexpr const char* VERTEX_CODE = R"(
 #version 330 core
 
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
 
 out vec3 FragPos;
 out vec3 Normal;
+out vec2 TexCoord;
 
-uniform mat4 model;
+// instance i is drawn with models[i] into tile i of a columns x rows atlas, in reading order
+uniform mat4 models[16];
+uniform int columns;
+uniform int rows;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
+    mat4 model = models[gl_InstanceID];
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    TexCoord = aTexCoord;
+    vec4 position = projection * view * vec4(FragPos, 1.0);
+    if (columns * rows > 1) {
+        // clip against the frame's own frustum, then squeeze it into its tile
+        gl_ClipDistance[0] = position.w + position.x;
+        gl_ClipDistance[1] = position.w - position.x;
+        gl_ClipDistance[2] = position.w + position.y;
+        gl_ClipDistance[3] = position.w - position.y;
+        vec2 scale = 1.0 / vec2(columns, rows);
+        vec2 tile = vec2(gl_InstanceID % columns, rows - 1 - gl_InstanceID / columns);
+        position.xy = (position.xy + position.w) * scale + (2.0 * tile * scale - 1.0) * position.w;
+    }
+    gl_Position = position;
 }
 )";
 constexpr const char* FRAGMENT_CODE = R"(
 #version 330 core
 in vec3 FragPos;
 in vec3 Normal;
+in vec2 TexCoord;
 
 out vec4 FragColor;
 
-struct Material {
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
-};
+layout(std140) uniform Material {
+    vec4 ambient;
+    vec4 diffuse; // w is 1 when diffuseMap holds the material's map_Kd
+    vec4 specular; // w holds the shininess
+} material;
+
+uniform sampler2D diffuseMap;
 
 struct Light {
     vec3 position;
@@ -76,27 +219,57 @@ struct Light {
     vec3 specular;
 };
 
-uniform Material material;
 uniform Light light;
 uniform vec3 viewPos;
 
 void main()
 {
+    // the texture tints ambient light too, textured exports mostly leave Ka white
+    vec3 texel = material.diffuse.w > 0.5 ? texture(diffuseMap, TexCoord).rgb : vec3(1.0);
     vec3 norm = normalize(Normal);
     vec3 lightDir = normalize(light.position - FragPos);
-    vec3 ambient = light.ambient * material.ambient;
+    vec3 ambient = light.ambient * material.ambient.rgb * texel;
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * (diff * material.diffuse);
+    vec3 diffuse = light.diffuse * (diff * material.diffuse.rgb * texel);
     vec3 viewDir = normalize(viewPos - FragPos);
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(norm, halfwayDir), 0.0), material.shininess);
-    vec3 specular = light.specular * (spec * material.specular);
+    float spec = pow(max(dot(norm, halfwayDir), 0.0), material.specular.w);
+    vec3 specular = light.specular * (spec * material.specular.rgb);
     vec3 result = ambient + diffuse + specular;
 
     FragColor = vec4(result, 1.0);
 }
 )";
 
+// Two hex digits per channel, channels are clamped to [0, 1]
 std::string rgbToHex(float red, float green, float blue);
-int render(std::vector<MeshGL>& meshes, tinyobj::attrib_t& attrib, const std::vector<tinyobj::material_t>& materials, GLFWwindow* window);
-std::vector<MeshGL> setupMeshes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes);
+// Frames the bounding box for a width / height viewport, the model matrix moves its center to the origin
+Camera frameCamera(const glm::vec3& bbox_min, const glm::vec3& bbox_max, float aspect);
+float frameAngle(int frame, int frames);
+glm::mat4 modelMatrix(float degrees, const glm::vec3& center);
+// textures holds one GL texture per material, 0 where there is none
+MaterialBuffer createMaterialBuffer(const std::vector<tinyobj::material_t>& materials, const std::vector<GLuint>& textures);
+// Draws every batch instances times, instance i with models[i]
+void drawModel(const std::vector<MeshGL>& meshes, const MaterialBuffer& materials, int instances);
+int saveFrameAsPPM(int frame, const unsigned char* pixels, int width, int height);
+// Sets the GL state, light and camera uniforms every frame shares and uploads the material blocks
+MaterialBuffer beginRender(const Shader& shader, const Camera& camera, const std::vector<tinyobj::material_t>& materials, const std::vector<GLuint>& textures);
+void drawFrame(const Shader& shader, const std::vector<MeshGL>& meshes, const MaterialBuffer& materials, const Camera& camera, float degrees);
+// Renders format.frames frames, format.tiles of them per pass when the atlas fits the framebuffer limits
+int render(const Shader& shader, std::vector<MeshGL>& meshes, const Camera& camera, const std::vector<tinyobj::material_t>& materials,
+           const std::vector<GLuint>& textures, const RenderFormat& format, const FrameSink& sink);
+MeshData buildMesh(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape);
+// Deduplicates every shape straight into the packed arena, sorted by material.
+// The staging is a few whole-model arrays, not buffers per shape.
+PackedMeshes packShapes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, int threads);
+// texcoords uploads the arena's texcoords after the vertices, only textured models need them
+std::vector<MeshGL> uploadArena(const MeshArena& arena, bool texcoords, int threads);
+// Uploads an already optimized stream, a mapped sidecar's goes straight to glBufferData
+std::vector<MeshGL> uploadGpuArena(const GpuArena& gpu, bool texcoords);
+// Attribute pointers of the GpuVertex stream for the bound VAO and GL_ARRAY_BUFFER
+void setVertexLayout();
+// Mipmapped GL textures of the images, one per distinct image, indexed like images (0 where it is null)
+std::vector<GLuint> uploadTextures(const MaterialImages& images);
+void deleteTextures(std::vector<GLuint>& textures);
+std::vector<MeshGL> setupMeshes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, int threads);
+void deleteMeshes(std::vector<MeshGL>& meshes);
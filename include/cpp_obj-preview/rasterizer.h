@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <tiny_obj_loader.h>
+#include <cstdint>
+#include <vector>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/texture.h"
+#include "cpp_obj-preview/parallel.h"
+
+// Pure CPU replacement for the GL path: binned tile rasterization with a SIMD
+// (AVX2 when compiled with it, SSE2 otherwise) edge-function inner loop,
+// tiles spread over threads, deferred Blinn-Phong shading matching FRAGMENT_CODE
+// (textures are sampled bilinearly, without mipmaps). pixels() has the same
+// bottom-up RGB layout glReadPixels produces. Buffers and threads are kept
+// between draws, frames allocate nothing once the bins have room for a turn.
+class CpuRasterizer {
+public:
+    CpuRasterizer(const MeshArena& arena, const std::vector<tinyobj::material_t>& materials, const MaterialImages& images, int width, int height,
+                  int threads);
+
+    void draw(const glm::mat4& model, const Camera& camera);
+    const unsigned char* pixels() const;
+
+private:
+    struct ShadingMaterial {
+        glm::vec3 ambient;
+        glm::vec3 diffuse;
+        glm::vec3 specular;
+        float shininess;
+        // null for untextured materials
+        const TextureImage* texture;
+    };
+
+    struct Triangle {
+        float edge[3][3];
+        float depth[3];
+        float invW[3];
+        uint32_t vertex[3];
+        int material;
+        int minX, minY, maxX, maxY;
+    };
+
+    void transformVertices(const glm::mat4& model, const Camera& camera);
+    void setupTriangles();
+    void rasterizeTile(int tile);
+    void shadeTile(int tile, const Camera& camera);
+
+    int width;
+    int height;
+    int threads;
+    WorkerPool pool;
+    int tilesX;
+    int tilesY;
+
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<int> triangleMaterials;
+    std::vector<ShadingMaterial> materials;
+
+    std::vector<glm::vec4> clip;
+    std::vector<glm::vec3> worldPositions;
+    std::vector<glm::vec3> worldNormals;
+    std::vector<Triangle> triangles;
+    // The triangles of setup chunk c touching tile t are binTriangles[c][i] for
+    // i from binOffsets[c * (tile count + 1) + t] up to the next tile's offset
+    std::vector<std::vector<uint64_t>> binEntries;
+    std::vector<std::vector<uint32_t>> binTriangles;
+    std::vector<uint32_t> binOffsets;
+    size_t chunkCount;
+
+    std::vector<float> depthBuffer;
+    std::vector<float> lambda1;
+    std::vector<float> lambda2;
+    std::vector<int32_t> triangleIds;
+    std::vector<unsigned char> color;
+};
+
+int renderCpu(const MeshArena& arena, const Camera& camera, const std::vector<tinyobj::material_t>& materials, const MaterialImages& images,
+              int threads, const RenderFormat& format, const FrameSink& sink);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/processing.h"
+
+// Outputs of the overview and the settings they were rendered with
+struct OverviewSummary {
+    bool gif;
+    bool sheet;
+    RenderFormat format;
+    // calibration and estimate of a time budget, empty without one
+    std::string budget;
+    // the front view thumbnail stands in for the overview while it renders
+    bool thumbnail;
+    // progress of a provisional report, empty once the overview is complete
+    std::string status;
+};
+
+// Writes obj-preview.md into save_dir (which ends with a separator). It is
+// written next to the published report and renamed over it, so readers never
+// see a partial report.
+int generateReport(const ObjModel& model, const GeometryStats& stats, std::string save_dir, const OverviewSummary& overview);
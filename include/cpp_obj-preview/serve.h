@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+// One preview request of the daemon, a JSON object on a single line:
+// {"obj": "/models/chair.obj", "frames": 120, "size": [400, 300], "output": "/tmp/chair"}
+// Everything but obj is optional, 0 and "" keep the configured values.
+struct ServeRequest {
+    std::string obj;
+    int frames;
+    int width;
+    int height;
+    std::string output;
+};
+
+// Answer to one request, written back as one JSON line. The handler fills in
+// status through triangles, the server measures the timings (milliseconds).
+struct ServeResult {
+    int status;
+    std::string error;
+    // empty when the overview setting skips it
+    std::string gif;
+    std::string sheet;
+    std::string report;
+    bool cached;
+    size_t triangles;
+    double queueMs;
+    double loadMs;
+    double renderWaitMs;
+    double renderMs;
+    double totalMs;
+};
+
+// Runs on a worker thread with everything that does not need the GL context
+// (hashing, cache lookups, parsing) and returns the part that does, or an
+// empty function when the result is already final
+using ServeHandler = std::function<std::function<void()>(const ServeRequest& request, ServeResult& result)>;
+
+struct ServeOptions {
+    // requests loaded or rendered at the same time, each holds its parsed model
+    int concurrency;
+    // requests waiting for a worker, more are answered with an error
+    int queueLimit;
+};
+
+// Listens on a Unix domain socket until SIGINT or SIGTERM. Every client line
+// is queued as a request, `concurrency` workers run handler on them and the
+// calling thread, which owns the GL context, runs the returned render steps
+// one at a time. At most 256 clients are connected at once, later ones get an
+// error line. Returns non-zero when the socket cannot be set up.
+int runServer(const std::string& socket_path, const ServeOptions& options, const ServeHandler& handler);
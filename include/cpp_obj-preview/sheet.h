@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Writes an RGB PNG from bottom-up rows as returned by glReadPixels. Deflated
+// with zlib when it was found at build time, in stored blocks otherwise.
+bool writePng(const std::string& path, const unsigned char* pixels, int width, int height);
+
+// Most tiles of a contact sheet, every one is a rendered frame
+const int MAX_SHEET_FRAMES = 256;
+
+// Parses a "<columns>x<rows>" grid of at most MAX_SHEET_FRAMES tiles
+bool parseSheetGrid(const std::string& text, int& columns, int& rows);
+
+// Static turntable overview: frame i of columns * rows evenly spaced angles
+// lands in tile i in reading order, the sheet is written as one PNG
+class ContactSheet {
+public:
+    ContactSheet(int columns, int rows, int tile_width, int tile_height);
+
+    int frames() const;
+    // pixels are tile sized bottom-up RGB rows
+    int add(int frame, const unsigned char* pixels);
+    bool save(const std::string& path) const;
+
+private:
+    int columns;
+    int rows;
+    int tileWidth;
+    int tileHeight;
+    std::vector<unsigned char> pixels;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/optimize.h"
+
+// Binary mesh sidecar written to the preview cache after the first parse. It
+// holds the packed geometry arena, its optimized GPU stream, bounding box,
+// comments, materials and the counts the report needs, every section 64-byte
+// aligned, so later runs map it and hand the GPU stream straight to
+// glBufferData without parsing, deduplicating or reordering.
+//
+// Layout: SidecarHeader, then the arena's vertex, index and batch sections, the
+// GPU stream's vertex, texcoord, index and batch sections and the metadata
+// section at the offsets the header lists. The file is written in native byte order and
+// rejected (and rewritten) on a host with a different endianness.
+class MeshSidecar {
+public:
+    MeshSidecar();
+    ~MeshSidecar();
+    MeshSidecar(const MeshSidecar&) = delete;
+    MeshSidecar& operator=(const MeshSidecar&) = delete;
+
+    // Maps the file and validates it against the hash of the OBJ/MTL sources
+    // and the crease angle of generated normals, filling the non-geometry parts of model
+    int open(const std::string& path, uint64_t source_hash, float crease_angle, ObjModel& model);
+
+    MeshArena arena() const;
+    GpuArena gpuArena() const;
+
+private:
+    void* data;
+    size_t size;
+    MeshArena view;
+    GpuArena gpuView;
+};
+
+// <cache_dir>/<source hash>.mesh, pruned with the cached previews so asset
+// directories are never written to
+std::string sidecarPath(const std::string& cache_dir, uint64_t source_hash);
+// Sidecars estimated larger than 1/SIDECAR_CACHE_SHARE of cache-size are not
+// written, pruning would evict every cached preview and then the sidecar itself
+const uint64_t SIDECAR_CACHE_SHARE = 4;
+// Estimated file size of packed's sidecar without the metadata section,
+// texcoords when its GPU stream keeps them
+uint64_t sidecarBytes(const PackedMeshes& packed, bool texcoords);
+int loadSidecar(const std::string& path, uint64_t source_hash, float crease_angle, ObjModel& model);
+int writeSidecar(const std::string& path, uint64_t source_hash, float crease_angle, const ObjModel& model, const PackedMeshes& packed,
+                 const GpuMeshes& gpu, const glm::vec3& bbox_min, const glm::vec3& bbox_max);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/analytics.h"
+
+// Out-of-core load for models larger than memory: the chunks of
+// streamObjNative are deduplicated, optimized on a worker thread and written
+// into growing GPU buffers through glMapBufferRange, so only the position and
+// normal tables stay on the CPU. Needs a current GL context. stats gets the
+// bounding box and surface sums, topology is not analyzed.
+int streamModel(const std::string& filename, size_t memory_limit, ObjModel& model, GeometryStats& stats, std::vector<MeshGL>& meshes);
+// Whether the file is larger than memory_limit bytes, which makes streaming=auto stream it
+bool exceedsMemoryLimit(const std::string& filename, size_t memory_limit);
+// Peak resident set size of the process so far
+size_t peakResidentBytes();
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <tiny_obj_loader.h>
+
+// Diffuse texture reduced for the preview with its mip chain: RGB rows
+// bottom-up, the way GL and the CPU rasterizer address texcoords
+struct TextureImage {
+    uint64_t hash;
+    int width;
+    int height;
+    // levels[i] is max(1, width >> i) x max(1, height >> i), down to 1x1
+    std::vector<std::vector<unsigned char>> levels;
+};
+
+// map_Kd images of a model by material id, null where a material has none or it failed to load
+using MaterialImages = std::vector<std::shared_ptr<const TextureImage>>;
+
+const size_t TEXTURE_CACHE_BYTES = (size_t)256 << 20;
+
+// Texture edge that covers a width x height frame, a model never spans more texels than that
+int textureSizeLimit(int width, int height);
+// Decodes an image file's bytes and halves it (box filter) down to the smallest
+// mip whose longer edge is still at least size_limit, then builds the mips
+// below it the same way, cheaper than glGenerateMipmap on software GL
+bool decodeTexture(const unsigned char* data, size_t size, int size_limit, TextureImage& image);
+
+// Decoded textures keyed by the XXH64 of their file bytes and the size limit,
+// so one image referenced by several materials, under other names or by other
+// models of a batch is decoded and stored once. Least recently used images are
+// dropped beyond max_bytes, models still holding them keep their copy.
+class TextureCache {
+public:
+    explicit TextureCache(size_t max_bytes = TEXTURE_CACHE_BYTES);
+
+    // Reads and decodes the map_Kd files of materials, looked up next to the OBJ
+    // file then in the working directory, on up to threads threads in the
+    // background. The future yields one entry per material.
+    std::future<MaterialImages> load(const std::vector<tinyobj::material_t>& materials, const std::string& base_dir, int size_limit, int threads);
+
+private:
+    struct Entry {
+        std::shared_future<std::shared_ptr<const TextureImage>> image;
+        // 0 while the image is decoding
+        size_t bytes;
+        std::list<std::string>::iterator position;
+    };
+
+    std::shared_ptr<const TextureImage> image(const std::string& path, int size_limit);
+    void evict();
+
+    std::mutex mutex;
+    size_t maxBytes;
+    size_t bytes;
+    // keys, most recently used first
+    std::list<std::string> order;
+    std::unordered_map<std::string, Entry> entries;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum class TraceCounter {
+    BytesRead,
+    VerticesDeduped,
+    DrawCalls,
+    FramesReadBack,
+    GpuNanoseconds,
+    Count
+};
+
+extern std::atomic<bool> traceActive;
+extern std::atomic<int64_t> traceCounters[(int)TraceCounter::Count];
+
+// A relaxed load, the only cost instrumentation has while tracing is off
+inline bool traceEnabled() {
+    return traceActive.load(std::memory_order_relaxed);
+}
+
+inline void traceCount(TraceCounter counter, int64_t value) {
+    if (traceEnabled()) traceCounters[(int)counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void startTrace();
+// Event on the GPU track: starts with the CPU submit at start_us, lasts as long as the GPU took
+void traceGpuEvent(const char* name, double start_us, double duration_us);
+double traceMicroseconds();
+// Writes the Chrome trace_event JSON (chrome://tracing, Perfetto) and returns the one-line summary
+int writeTrace(const std::string& path, std::string& summary);
+// Body of a JSON string literal holding text
+std::string jsonEscape(const std::string& text);
+
+// Records a complete event from construction to destruction on the calling
+// thread's track. name must outlive the trace (string literals), detail is copied.
+// A trace keeps its first 262144 events, later ones are counted as dropped.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), start(traceEnabled() ? traceMicroseconds() : -1.0) {}
+    TraceScope(const char* name, const std::string& detail) : TraceScope(name) {
+        if (start >= 0.0) this->detail = detail;
+    }
+    ~TraceScope() {
+        if (start >= 0.0) finish();
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    void finish();
+
+    const char* name;
+    double start;
+    std::string detail;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
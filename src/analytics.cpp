@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <emmintrin.h>
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t CHUNK_SIZE = 1 << 16;
+static const uint64_t NO_EDGE = UINT64_MAX;
+
+static size_t chunkCount(size_t count) {
+    return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+struct WeldItem {
+    uint32_t bits[3];
+    uint32_t vertex;
+    uint64_t hash;
+};
+
+struct FaceKey {
+    uint32_t v[3];
+    bool operator<(const FaceKey& other) const {
+        return std::lexicographical_compare(v, v + 3, other.v, other.v + 3);
+    }
+    bool operator==(const FaceKey& other) const {
+        return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+    }
+};
+
+// Maps every arena vertex to an id shared by all vertices at the same position
+static size_t weldVertices(const MeshArena& arena, size_t bucket_count, int shift, int threads, std::vector<uint32_t>& weld) {
+    std::vector<WeldItem> items(arena.vertexCount);
+    parallelFor(chunkCount(items.size()), threads, [&](size_t chunk) {
+        size_t end = std::min(items.size(), (chunk + 1) * CHUNK_SIZE);
+        for (size_t v = chunk * CHUNK_SIZE; v < end; v++) {
+            WeldItem& item = items[v];
+            std::memcpy(item.bits, arena.vertices + v * 8, sizeof(item.bits));
+            // -0.0 and 0.0 are the same position
+            for (uint32_t& bits : item.bits) {
+                if (bits == 0x80000000u) bits = 0;
+            }
+            item.vertex = (uint32_t)v;
+            item.hash = mix64(((uint64_t)item.bits[0] << 32 | item.bits[1]) ^ mix64(item.bits[2]));
+        }
+    });
+    std::vector<size_t> offsets = partitionSort(items, bucket_count, threads,
+        [&](const WeldItem& item) { return (size_t)(item.hash >> shift); },
+        [](const WeldItem& a, const WeldItem& b) {
+            if (a.hash != b.hash) return a.hash < b.hash;
+            return std::lexicographical_compare(a.bits, a.bits + 3, b.bits, b.bits + 3);
+        });
+
+    auto same = [](const WeldItem& a, const WeldItem& b) {
+        return a.hash == b.hash && std::equal(a.bits, a.bits + 3, b.bits);
+    };
+    std::vector<size_t> unique(bucket_count, 0);
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        for (size_t i = offsets[b]; i < offsets[b + 1]; i++) {
+            if (i == offsets[b] || !same(items[i], items[i - 1])) unique[b]++;
+        }
+    });
+    size_t total = 0;
+    for (size_t b = 0; b < bucket_count; b++) {
+        size_t count = unique[b];
+        unique[b] = total;
+        total += count;
+    }
+    weld.resize(arena.vertexCount);
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        uint32_t id = (uint32_t)unique[b];
+        for (size_t i = offsets[b]; i < offsets[b + 1]; i++) {
+            if (i != offsets[b] && !same(items[i], items[i - 1])) id++;
+            weld[items[i].vertex] = id;
+        }
+    });
+    return total;
+}
+
+// Welded ids and positions of triangle t
+static inline void loadTriangle(const MeshArena& arena, const std::vector<uint32_t>& weld, size_t t, uint32_t id[3], glm::dvec3 p[3]) {
+    for (int k = 0; k < 3; k++) {
+        uint32_t vertex = arena.indices[3 * t + k];
+        id[k] = weld[vertex];
+        const float* v = arena.vertices + (size_t)vertex * 8;
+        p[k] = glm::dvec3(v[0], v[1], v[2]);
+    }
+}
+
+// Collapsed or needle faces are left out of the area, edge and face statistics
+static inline bool degenerateTriangle(const uint32_t id[3], double doubled_area, double needle) {
+    return id[0] == id[1] || id[1] == id[2] || id[0] == id[2] || doubled_area <= needle;
+}
+
+static inline uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return a == b ? NO_EDGE : (uint64_t)std::min(a, b) << 32 | std::max(a, b);
+}
+
+static void boundingBox(const MeshArena& arena, int threads, glm::vec3& bbox_min, glm::vec3& bbox_max) {
+    std::mutex lock;
+    __m128 total_min = _mm_set1_ps(FLT_MAX);
+    __m128 total_max = _mm_set1_ps(-FLT_MAX);
+    parallelFor(chunkCount(arena.vertexCount), threads, [&](size_t chunk) {
+        size_t end = std::min(arena.vertexCount, (chunk + 1) * CHUNK_SIZE);
+        __m128 low = _mm_set1_ps(FLT_MAX);
+        __m128 high = _mm_set1_ps(-FLT_MAX);
+        // lanes are x, y, z and the first normal component, which is ignored
+        for (size_t v = chunk * CHUNK_SIZE; v < end; v++) {
+            __m128 p = _mm_loadu_ps(arena.vertices + v * 8);
+            low = _mm_min_ps(low, p);
+            high = _mm_max_ps(high, p);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        total_min = _mm_min_ps(total_min, low);
+        total_max = _mm_max_ps(total_max, high);
+    });
+    float low[4], high[4];
+    _mm_storeu_ps(low, total_min);
+    _mm_storeu_ps(high, total_max);
+    bbox_min = glm::vec3(low[0], low[1], low[2]);
+    bbox_max = glm::vec3(high[0], high[1], high[2]);
+}
+
+size_t weldPositions(const MeshArena& arena, int threads, std::vector<uint32_t>& weld) {
+    int bucket_bits = bucketBits(threads);
+    return weldVertices(arena, (size_t)1 << bucket_bits, 64 - bucket_bits, threads, weld);
+}
+
+GeometryStats analyzeGeometry(const MeshArena& arena, int threads) {
+    TRACE_SCOPE("analyze");
+    GeometryStats stats = {};
+    stats.topology = true;
+    stats.triangles = arena.indexCount / 3;
+    if (arena.vertexCount == 0) {
+        return stats;
+    }
+    boundingBox(arena, threads, stats.bboxMin, stats.bboxMax);
+
+    int bucket_bits = bucketBits(threads);
+    size_t bucket_count = (size_t)1 << bucket_bits;
+    int shift = 64 - bucket_bits;
+    std::vector<uint32_t> weld;
+    stats.weldedVertices = weldVertices(arena, bucket_count, shift, threads, weld);
+
+    // per chunk: area, volume and centroid sums plus edge keys. Face keys and
+    // the edges of the non-manifold pass are rebuilt from the indices later,
+    // so only one per-triangle array and its sorted copy are alive at a time.
+    struct Partial {
+        double area = 0.0;
+        double volume = 0.0;
+        glm::dvec3 centroid = glm::dvec3(0.0);
+        size_t degenerateEdges = 0;
+        size_t degenerateFaces = 0;
+    };
+    size_t triangle_count = stats.triangles;
+    std::vector<Partial> partials(chunkCount(triangle_count));
+    std::vector<uint64_t> edges(triangle_count * 3);
+    glm::vec3 extent = stats.bboxMax - stats.bboxMin;
+    double needle = 1e-12 * (double)glm::dot(extent, extent);
+    parallelFor(partials.size(), threads, [&](size_t chunk) {
+        Partial& partial = partials[chunk];
+        size_t end = std::min(triangle_count, (chunk + 1) * CHUNK_SIZE);
+        for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+            uint32_t id[3];
+            glm::dvec3 p[3];
+            loadTriangle(arena, weld, t, id, p);
+            for (int k = 0; k < 3; k++) {
+                partial.degenerateEdges += id[k] == id[(k + 1) % 3];
+                edges[3 * t + k] = edgeKey(id[k], id[(k + 1) % 3]);
+            }
+            double doubled_area = glm::length(glm::cross(p[1] - p[0], p[2] - p[0]));
+            if (degenerateTriangle(id, doubled_area, needle)) {
+                // collapsed faces would double count the edge they lie on
+                partial.degenerateFaces++;
+                edges[3 * t] = edges[3 * t + 1] = edges[3 * t + 2] = NO_EDGE;
+                continue;
+            }
+            partial.area += doubled_area * 0.5;
+            partial.volume += glm::dot(p[0], glm::cross(p[1], p[2])) / 6.0;
+            partial.centroid += (p[0] + p[1] + p[2]) * (doubled_area * 0.5 / 3.0);
+        }
+    });
+
+    glm::dvec3 centroid(0.0);
+    for (const auto& partial : partials) {
+        stats.surfaceArea += partial.area;
+        stats.signedVolume += partial.volume;
+        centroid += partial.centroid;
+        stats.degenerateEdges += partial.degenerateEdges;
+        stats.degenerateFaces += partial.degenerateFaces;
+    }
+    stats.centroid = stats.surfaceArea > 0.0 ? glm::vec3(centroid / stats.surfaceArea) : (stats.bboxMin + stats.bboxMax) * 0.5f;
+
+    // edges used by one face are boundary, by more than two non-manifold
+    std::vector<size_t> edge_offsets = partitionSort(edges, bucket_count, threads,
+        [&](uint64_t key) { return key == NO_EDGE ? PARTITION_SKIP : (size_t)(mix64(key) >> shift); },
+        [](uint64_t a, uint64_t b) { return a < b; });
+    std::vector<std::vector<uint64_t>> non_manifold(bucket_count);
+    std::atomic<size_t> boundary(0);
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        size_t count = 0;
+        for (size_t i = edge_offsets[b]; i < edge_offsets[b + 1]; i += count) {
+            count = 1;
+            while (i + count < edge_offsets[b + 1] && edges[i + count] == edges[i]) count++;
+            if (count == 1) boundary++;
+            if (count > 2) non_manifold[b].push_back(edges[i]);
+        }
+    });
+    stats.boundaryEdges = boundary;
+    edges = std::vector<uint64_t>();
+    std::vector<uint64_t> non_manifold_edges;
+    for (const auto& bucket : non_manifold) {
+        non_manifold_edges.insert(non_manifold_edges.end(), bucket.begin(), bucket.end());
+    }
+    std::sort(non_manifold_edges.begin(), non_manifold_edges.end());
+    stats.nonManifoldEdges = non_manifold_edges.size();
+
+    if (!non_manifold_edges.empty()) {
+        std::atomic<size_t> faces_touching(0);
+        parallelFor(chunkCount(triangle_count), threads, [&](size_t chunk) {
+            size_t end = std::min(triangle_count, (chunk + 1) * CHUNK_SIZE);
+            size_t count = 0;
+            for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+                uint32_t id[3];
+                glm::dvec3 p[3];
+                loadTriangle(arena, weld, t, id, p);
+                if (degenerateTriangle(id, glm::length(glm::cross(p[1] - p[0], p[2] - p[0])), needle)) continue;
+                for (int k = 0; k < 3; k++) {
+                    if (std::binary_search(non_manifold_edges.begin(), non_manifold_edges.end(), edgeKey(id[k], id[(k + 1) % 3]))) {
+                        count++;
+                        break;
+                    }
+                }
+            }
+            faces_touching += count;
+        });
+        stats.nonManifoldFaces = faces_touching;
+    }
+
+    // faces with the same three welded vertices, in any order
+    std::vector<FaceKey> faces(triangle_count);
+    parallelFor(chunkCount(triangle_count), threads, [&](size_t chunk) {
+        size_t end = std::min(triangle_count, (chunk + 1) * CHUNK_SIZE);
+        for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+            uint32_t id[3];
+            glm::dvec3 p[3];
+            loadTriangle(arena, weld, t, id, p);
+            if (degenerateTriangle(id, glm::length(glm::cross(p[1] - p[0], p[2] - p[0])), needle)) {
+                faces[t] = {{UINT32_MAX, UINT32_MAX, UINT32_MAX}};
+                continue;
+            }
+            std::sort(id, id + 3);
+            faces[t] = {{id[0], id[1], id[2]}};
+        }
+    });
+    std::vector<size_t> face_offsets = partitionSort(faces, bucket_count, threads,
+        [&](const FaceKey& face) {
+            if (face.v[0] == UINT32_MAX) return PARTITION_SKIP;
+            return (size_t)(mix64(((uint64_t)face.v[0] << 32 | face.v[1]) ^ mix64(face.v[2])) >> shift);
+        },
+        [](const FaceKey& a, const FaceKey& b) { return a < b; });
+    std::atomic<size_t> duplicates(0);
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        size_t count = 0;
+        for (size_t i = face_offsets[b] + 1; i < face_offsets[b + 1]; i++) {
+            count += faces[i] == faces[i - 1];
+        }
+        duplicates += count;
+    });
+    stats.duplicateFaces = duplicates;
+    return stats;
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <glob.h>
+#include "cpp_obj-preview/batch.h"
+
+namespace fs = std::filesystem;
+
+static bool isObjFile(const fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return ext == ".obj";
+}
+
+static int globFiles(const std::string& pattern, std::vector<std::string>& files) {
+    glob_t matches;
+    int ret = glob(pattern.c_str(), 0, nullptr, &matches);
+    if (ret == GLOB_NOMATCH) {
+        std::cerr << "Error: No files match " << pattern << std::endl;
+        return 1;
+    }
+    if (ret != 0) {
+        std::cerr << "Error: Failed to expand " << pattern << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        files.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return 0;
+}
+
+static int readManifest(const std::string& manifest, std::vector<std::string>& files) {
+    std::ifstream file(manifest);
+    if (!file) {
+        std::cerr << "Error: Failed to open manifest " << manifest << std::endl;
+        return 1;
+    }
+    fs::path base = fs::path(manifest).parent_path();
+    std::string line;
+    while (std::getline(file, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        fs::path path(line);
+        files.push_back(path.is_absolute() ? line : (base / path).string());
+    }
+    return 0;
+}
+
+int collectBatchFiles(const std::string& source, std::vector<std::string>& files) {
+    std::error_code ec;
+    if (source.find_first_of("*?[") != std::string::npos) {
+        if (globFiles(source, files) != 0) {
+            return 1;
+        }
+    } else if (fs::is_directory(source, ec)) {
+        for (fs::recursive_directory_iterator it(source, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec) && isObjFile(it->path())) {
+                files.push_back(it->path().string());
+            }
+        }
+        if (ec) {
+            std::cerr << "Error: Failed to list " << source << ": " << ec.message() << std::endl;
+            return 1;
+        }
+        std::sort(files.begin(), files.end());
+    } else if (fs::is_regular_file(source, ec)) {
+        if (readManifest(source, files) != 0) {
+            return 1;
+        }
+    } else {
+        std::cerr << "Error: Batch source " << source << " is not a directory, pattern or manifest\n";
+        return 1;
+    }
+
+    if (files.empty()) {
+        std::cerr << "Error: No OBJ files found in " << source << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+std::string batchSaveDir(const std::string& save_dir, const std::string& filename, std::unordered_map<std::string, int>& used) {
+    std::string stem = fs::path(filename).stem().string();
+    if (stem.empty()) {
+        stem = "asset";
+    }
+    std::string name = stem;
+    int suffix = 1;
+    while (used[name]++ > 0) {
+        name = stem + "-" + std::to_string(++suffix);
+    }
+    return save_dir + name + "/";
+}
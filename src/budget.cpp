@@ -0,0 +1,131 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "cpp_obj-preview/budget.h"
+#include "cpp_obj-preview/pipeline.h"
+#include "cpp_obj-preview/trace.h"
+
+// Quality ladder: frame count divisor and frame size scale (numerator / denominator)
+struct BudgetLevel {
+    int divisor;
+    int scale;
+    int scaleDenominator;
+};
+
+static const BudgetLevel BUDGET_LADDER[] = {
+    {1, 1, 1}, {2, 1, 1}, {2, 3, 4}, {3, 3, 4}, {4, 3, 4}, {4, 1, 2}, {6, 1, 2},
+    {8, 1, 2}, {8, 3, 8}, {12, 3, 8}, {12, 1, 4}, {15, 1, 4}, {20, 1, 4}, {30, 1, 4}
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int calibrateFrameCost(const RenderFormat& format, const FormatRenderer& render_format, bool encode, GifDither dither, int gif_scale, FrameCost& cost) {
+    TRACE_SCOPE("calibrate");
+    RenderFormat full = format;
+    full.frames = CALIBRATION_FRAMES;
+    full.tiles = 1;
+    RenderFormat quarter = full;
+    quarter.width = std::max(1, full.width / 2);
+    quarter.height = std::max(1, full.height / 2);
+
+    std::vector<unsigned char> sample;
+    FrameSink discard = [](int frame, const unsigned char* pixels) { return 0; };
+    FrameSink keep = [&](int frame, const unsigned char* pixels) {
+        sample.assign(pixels, pixels + (size_t)full.width * full.height * 3);
+        return 0;
+    };
+
+    // the first frame pays for residency and shader compilation
+    RenderFormat warmup = quarter;
+    warmup.frames = 1;
+    if (render_format(warmup, discard) != 0) {
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (render_format(full, keep) != 0) {
+        return 1;
+    }
+    double full_time = secondsSince(start) / CALIBRATION_FRAMES;
+    start = std::chrono::steady_clock::now();
+    if (render_format(quarter, discard) != 0) {
+        return 1;
+    }
+    double quarter_time = secondsSince(start) / CALIBRATION_FRAMES;
+
+    double full_pixels = (double)full.width * full.height;
+    double quarter_pixels = (double)quarter.width * quarter.height;
+    cost.perPixel = std::max(0.0, (full_time - quarter_time) / std::max(1.0, full_pixels - quarter_pixels));
+    cost.fixed = full_time - cost.perPixel * full_pixels;
+    if (cost.fixed < 0.0) {
+        cost.fixed = 0.0;
+        cost.perPixel = full_time / full_pixels;
+    }
+
+    cost.encodePerPixel = 0.0;
+    if (encode && !sample.empty()) {
+        // a scratch encoder with the sample's palette, its output is thrown away. Like
+        // the workers it encodes the frame scaled down by gif_scale, the downscale
+        // included in the cost per rendered pixel.
+        int scale = full.width >= gif_scale && full.height >= gif_scale ? std::max(1, gif_scale) : 1;
+        GifEncoder gif;
+        if (gif.open("/dev/null", full.width / scale, full.height / scale, full.fps, dither, true)) {
+            std::vector<unsigned char> scaled;
+            std::vector<uint8_t> indices;
+            std::vector<uint8_t> output;
+            GifScratch scratch;
+            auto encoded = [&]() {
+                if (scale == 1) {
+                    return (const unsigned char*)sample.data();
+                }
+                downscaleFrame(sample.data(), full.width, full.height, scale, scaled);
+                return (const unsigned char*)scaled.data();
+            };
+            gif.buildPalette(encoded());
+            start = std::chrono::steady_clock::now();
+            const unsigned char* pixels = encoded();
+            gif.quantize(pixels, indices, scratch);
+            gif.compress(indices, output, scratch);
+            gif.writeFrame(output);
+            cost.encodePerPixel = secondsSince(start) / full_pixels;
+            gif.close();
+        }
+    }
+    return 0;
+}
+
+double estimateSeconds(const RenderFormat& format, const FrameCost& cost, int workers, int sheet_frames) {
+    double pixels = (double)format.width * format.height;
+    double render_time = format.frames * (cost.fixed + cost.perPixel * pixels);
+    // the workers encode while the next frames render, the slower side sets the pace
+    double encode_time = format.frames * cost.encodePerPixel * pixels / std::max(1, workers);
+    double sheet_time = sheet_frames * (cost.fixed + cost.perPixel * pixels / 4.0);
+    return std::max(render_time, encode_time) + sheet_time;
+}
+
+RenderFormat budgetFormat(const RenderFormat& wanted, const FrameCost& cost, double seconds, int workers, int sheet_frames, double& estimate) {
+    RenderFormat format = wanted;
+    for (const auto& level : BUDGET_LADDER) {
+        format = wanted;
+        format.frames = std::max(std::min(wanted.frames, MIN_BUDGET_FRAMES), wanted.frames / level.divisor);
+        format.width = std::max(16, wanted.width * level.scale / level.scaleDenominator);
+        format.height = std::max(16, wanted.height * level.scale / level.scaleDenominator);
+        format.fps = std::max(1, (int)std::lround((double)wanted.fps * format.frames / wanted.frames));
+        estimate = estimateSeconds(format, cost, workers, sheet_frames);
+        if (estimate <= seconds * BUDGET_HEADROOM) {
+            break;
+        }
+    }
+    return format;
+}
+
+std::string describeFormat(const RenderFormat& format) {
+    std::ostringstream text;
+    text << format.width << "x" << format.height << ", " << format.frames << " frames at " << format.fps << " fps ("
+         << 360.0 / format.frames << "° step)";
+    return text.str();
+}
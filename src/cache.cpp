@@ -0,0 +1,245 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cpp_obj-preview/cache.h"
+#include "cpp_obj-preview/hash.h"
+#include "cpp_obj-preview/trace.h"
+
+namespace fs = std::filesystem;
+
+static const char* REPORT_FILE = "obj-preview.md";
+static const char* IMAGE_FILES[] = {"obj-overview.gif", "obj-contact-sheet.png", "obj-thumbnail.png"};
+// marks entries being written, pruneCache leaves them to their writer
+static const char* STAGING_TAG = ".tmp";
+
+// Hashes the whole file, optionally collecting the names on its lines starting
+// with keyword, only the last one of a line when last_name is set (texture
+// statements put their options first)
+static bool hashFile(const std::string& filename, Xxh64& hasher, const char* keyword, bool last_name, std::vector<std::string>* names) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    traceCount(TraceCounter::BytesRead, (int64_t)size);
+    uint64_t size_tag = size;
+    hasher.update(&size_tag, sizeof(size_tag));
+    if (size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    const char* data = (const char*)mapped;
+    hasher.update(data, size);
+
+    if (names) {
+        size_t keyword_size = std::strlen(keyword);
+        const char* end = data + size;
+        for (const char* line = data; line < end;) {
+            const char* line_end = (const char*)std::memchr(line, '\n', (size_t)(end - line));
+            if (!line_end) line_end = end;
+            while (line < line_end && (*line == ' ' || *line == '\t')) line++;
+            if ((size_t)(line_end - line) > keyword_size + 1 && std::strncmp(line, keyword, keyword_size) == 0 &&
+                (line[keyword_size] == ' ' || line[keyword_size] == '\t')) {
+                std::istringstream tokens(std::string(line + keyword_size + 1, line_end));
+                std::string name;
+                std::string last;
+                while (tokens >> name) {
+                    if (last_name) {
+                        last = name;
+                    } else {
+                        names->push_back(name);
+                    }
+                }
+                if (!last.empty()) {
+                    names->push_back(last);
+                }
+            }
+            line = line_end + 1;
+        }
+    }
+    munmap(mapped, size);
+    return true;
+}
+
+bool hashSource(const std::string& filename, uint64_t& hash) {
+    TRACE_SCOPE("hash");
+    Xxh64 hasher;
+    std::vector<std::string> mtllibs;
+    if (!hashFile(filename, hasher, "mtllib", false, &mtllibs)) {
+        return false;
+    }
+    fs::path base = fs::path(filename).parent_path();
+    std::vector<std::string> textures;
+    for (const auto& name : mtllibs) {
+        hasher.update(name);
+        // same lookup order as the parsers: next to the OBJ file, then the working directory
+        if (!hashFile((base / name).string(), hasher, "map_Kd", true, &textures) && !hashFile(name, hasher, "map_Kd", true, &textures)) {
+            hasher.update("missing", 7);
+        }
+    }
+    // diffuse textures are looked up like the MTL files
+    for (auto& name : textures) {
+        std::replace(name.begin(), name.end(), '\\', '/');
+        hasher.update(name);
+        if (!hashFile((base / name).string(), hasher, nullptr, false, nullptr) && !hashFile(name, hasher, nullptr, false, nullptr)) {
+            hasher.update("missing", 7);
+        }
+    }
+    hash = hasher.digest();
+    return true;
+}
+
+std::string previewCacheKey(uint64_t source_hash, const std::string& settings) {
+    Xxh64 hasher;
+    hasher.update(&source_hash, sizeof(source_hash));
+    hasher.update(settings);
+    return hashToHex(hasher.digest());
+}
+
+bool cacheContains(const std::string& cache_dir, const std::string& key) {
+    // entries appear complete or not at all, so the report stands for the whole entry
+    std::error_code ec;
+    return fs::is_regular_file(fs::path(cache_dir) / key / REPORT_FILE, ec);
+}
+
+// Hardlinks when source and target share a file system, copies otherwise
+static bool linkOrCopy(const fs::path& from, const fs::path& to) {
+    std::error_code ec;
+    fs::create_hard_link(from, to, ec);
+    if (!ec) {
+        return true;
+    }
+    return fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+}
+
+int restoreFromCache(const std::string& cache_dir, const std::string& key, const std::string& filename, const std::string& save_dir, bool overwrite) {
+    TRACE_SCOPE("cache_restore");
+    fs::path entry = fs::path(cache_dir) / key;
+    fs::path report_path = fs::path(save_dir) / REPORT_FILE;
+    std::error_code ec;
+    for (const char* name : IMAGE_FILES) {
+        if (!fs::is_regular_file(entry / name, ec)) continue;
+        fs::path image_path = fs::path(save_dir) / name;
+        if (fs::exists(image_path, ec)) {
+            if (!overwrite) {
+                std::cerr << "Error: " << image_path.string() << " already exists, set overwrite-flag to replace it\n";
+                return 1;
+            }
+            // unlink rather than truncate, the old file may be a link into the cache
+            fs::remove(image_path, ec);
+        }
+        if (!linkOrCopy(entry / name, image_path)) {
+            std::cerr << "Error: Failed to restore " << image_path.string() << " from the cache\n";
+            return 1;
+        }
+    }
+    fs::remove(report_path, ec);
+
+    // the report is shared between identical files, only the File line differs
+    std::ifstream cached(entry / REPORT_FILE);
+    std::ofstream report(report_path);
+    if (!cached || !report) {
+        std::cerr << "Error: Failed to restore " << report_path.string() << " from the cache\n";
+        return 1;
+    }
+    std::string line;
+    while (std::getline(cached, line)) {
+        if (line.compare(0, 7, "File: `") == 0) {
+            line = "File: `" + filename + "`";
+        }
+        report << line << "\n";
+    }
+
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+    return 0;
+}
+
+int storeInCache(const std::string& cache_dir, const std::string& key, const std::string& save_dir, const std::vector<std::string>& files) {
+    TRACE_SCOPE("cache_store");
+    std::error_code ec;
+    fs::path entry = fs::path(cache_dir) / key;
+    // serve workers share the process, two of them may store the same key at once
+    fs::path staging = fs::path(cache_dir) /
+                       (key + STAGING_TAG + std::to_string(getpid()) + "-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    fs::remove_all(staging, ec);
+    if (!fs::create_directories(staging, ec) && ec) {
+        std::cerr << "Error: Failed to create cache directory " << staging.string() << ": " << ec.message() << std::endl;
+        return 1;
+    }
+    for (const auto& name : files) {
+        if (!linkOrCopy(fs::path(save_dir) / name, staging / name)) {
+            std::cerr << "Error: Failed to store " << name << " in the cache\n";
+            fs::remove_all(staging, ec);
+            return 1;
+        }
+    }
+    // a complete entry appears atomically, a concurrent writer of the same key simply loses
+    fs::rename(staging, entry, ec);
+    if (ec) {
+        fs::remove_all(staging, ec);
+    }
+    return 0;
+}
+
+void pruneCache(const std::string& cache_dir, uint64_t max_bytes) {
+    TRACE_SCOPE("cache_prune");
+    struct Entry {
+        fs::path path;
+        fs::file_time_type used;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (fs::directory_iterator it(cache_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (it->path().filename().string().find(STAGING_TAG) != std::string::npos) {
+            // emptying the cache also clears what crashed writers left behind
+            if (max_bytes == 0) fs::remove_all(it->path(), entry_ec);
+            continue;
+        }
+        if (it->is_regular_file(entry_ec) && it->path().extension() == ".mesh") {
+            Entry sidecar{it->path(), it->last_write_time(entry_ec), it->file_size(entry_ec)};
+            if (entry_ec) continue;
+            total += sidecar.size;
+            entries.push_back(sidecar);
+            continue;
+        }
+        if (!it->is_directory(entry_ec)) continue;
+        Entry entry{it->path(), it->last_write_time(entry_ec), 0};
+        for (fs::directory_iterator file(entry.path, entry_ec), file_end; !entry_ec && file != file_end; file.increment(entry_ec)) {
+            std::error_code size_ec;
+            uint64_t size = file->file_size(size_ec);
+            if (!size_ec) entry.size += size;
+        }
+        total += entry.size;
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const auto& entry : entries) {
+        if (total <= max_bytes) break;
+        fs::remove_all(entry.path, ec);
+        total -= entry.size;
+    }
+}
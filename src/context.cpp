@@ -0,0 +1,226 @@
+#include <iostream>
+#include <cstring>
+#include "cpp_obj-preview/context.h"
+#include "cpp_obj-preview/trace.h"
+#ifdef CPP_OBJ_PREVIEW_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+ContextBackend parseContextBackend(const std::string& name) {
+    if (name == "glfw") return ContextBackend::Glfw;
+    if (name == "egl") return ContextBackend::Egl;
+    if (name == "cpu") return ContextBackend::Cpu;
+    std::cerr << "Error: Unknown context backend " << name << ", using " << (defaultContextBackend() == ContextBackend::Egl ? "egl" : "glfw") << std::endl;
+    return defaultContextBackend();
+}
+
+ContextBackend defaultContextBackend() {
+#ifdef CPP_OBJ_PREVIEW_EGL
+    return ContextBackend::Egl;
+#else
+    return ContextBackend::Glfw;
+#endif
+}
+
+RenderContext::RenderContext() : window(nullptr), eglDisplay(nullptr), eglContext(nullptr), eglSurface(nullptr), fbo(0), colorBuffer(0), depthBuffer(0), width(0), height(0) {}
+
+RenderContext::~RenderContext() {
+    destroy();
+}
+
+int RenderContext::create(ContextBackend backend, int width, int height) {
+    if (backend == ContextBackend::Cpu) {
+        return 0;
+    }
+    TRACE_SCOPE("context");
+    int ret = backend == ContextBackend::Egl ? createEgl() : createGlfw(width, height);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = createFramebuffer(width, height);
+    if (ret != 0) {
+        destroy();
+    }
+    return ret;
+}
+
+int RenderContext::resize(int width, int height) {
+    if (!fbo || (width == this->width && height == this->height)) {
+        return 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    fbo = colorBuffer = depthBuffer = 0;
+    return createFramebuffer(width, height);
+}
+
+int RenderContext::createGlfw(int width, int height) {
+    if (!glfwInit()) {
+        std::cerr << "Error: Failed to init GLFW\n";
+        return -1;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+
+    window = glfwCreateWindow(width, height, "360 Rotation Capture", nullptr, nullptr);
+    if (!window) {
+        std::cerr << "Error: Failed to create window\n";
+        glfwTerminate();
+        return -1;
+    }
+
+    glfwMakeContextCurrent(window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        std::cerr << "Error: Failed to initialize GLAD\n";
+        destroy();
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef CPP_OBJ_PREVIEW_EGL
+static EGLDisplay getEglDisplay() {
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (extensions && getPlatformDisplay) {
+        if (std::strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) return display;
+        }
+        auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        if (std::strstr(extensions, "EGL_EXT_platform_device") && queryDevices) {
+            EGLDeviceEXT device;
+            EGLint count = 0;
+            if (queryDevices(1, &device, &count) && count > 0) {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+                if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) return display;
+            }
+        }
+    }
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) return display;
+    return EGL_NO_DISPLAY;
+}
+
+int RenderContext::createEgl() {
+    EGLDisplay display = getEglDisplay();
+    if (display == EGL_NO_DISPLAY) {
+        std::cerr << "Error: Failed to initialize EGL display\n";
+        return -1;
+    }
+    eglDisplay = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "Error: EGL display does not support desktop OpenGL\n";
+        destroy();
+        return -1;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint config_count = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &config_count)) {
+        config_count = 0;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config_count > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT) {
+        std::cerr << "Error: Failed to create EGL context\n";
+        destroy();
+        return -1;
+    }
+    eglContext = context;
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        const EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        EGLSurface surface = config_count > 0 ? eglCreatePbufferSurface(display, config, pbuffer_attribs) : EGL_NO_SURFACE;
+        if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context)) {
+            std::cerr << "Error: Failed to make EGL context current\n";
+            destroy();
+            return -1;
+        }
+        eglSurface = surface;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        std::cerr << "Error: Failed to initialize GLAD\n";
+        destroy();
+        return -1;
+    }
+    return 0;
+}
+#else
+int RenderContext::createEgl() {
+    std::cerr << "Error: Built without EGL support, use context=glfw\n";
+    return -1;
+}
+#endif
+
+int RenderContext::createFramebuffer(int width, int height) {
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: Offscreen framebuffer is incomplete\n";
+        return -1;
+    }
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, width, height);
+    this->width = width;
+    this->height = height;
+    return 0;
+}
+
+void RenderContext::destroy() {
+    if ((window || eglContext) && fbo) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+    }
+    fbo = colorBuffer = depthBuffer = 0;
+
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        window = nullptr;
+    }
+#ifdef CPP_OBJ_PREVIEW_EGL
+    if (eglDisplay) {
+        eglMakeCurrent((EGLDisplay)eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (eglSurface) eglDestroySurface((EGLDisplay)eglDisplay, (EGLSurface)eglSurface);
+        if (eglContext) eglDestroyContext((EGLDisplay)eglDisplay, (EGLContext)eglContext);
+        eglTerminate((EGLDisplay)eglDisplay);
+    }
+#endif
+    eglDisplay = eglContext = eglSurface = nullptr;
+}
@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "cpp_obj-preview/decimate.h"
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t CHUNK_SIZE = 1 << 16;
+static const uint64_t MAX_RESOLUTION = 1 << 20;
+// keys with this bit belong to locked vertices, which never merge
+static const uint64_t LOCKED_KEY = 1ULL << 63;
+
+static size_t chunkCount(size_t count) {
+    return (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// One over-budget batch with its vertices renumbered locally
+struct ClusterBatch {
+    std::vector<uint32_t> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<bool> locked;
+    glm::vec3 bboxMin;
+    float cellScale;
+    std::vector<uint64_t> keys;
+};
+
+static void computeKeys(const MeshArena& arena, ClusterBatch& batch, uint64_t resolution, int threads) {
+    float scale = batch.cellScale * (float)resolution;
+    parallelFor(chunkCount(batch.vertices.size()), threads, [&](size_t chunk) {
+        size_t end = std::min(batch.vertices.size(), (chunk + 1) * CHUNK_SIZE);
+        for (size_t i = chunk * CHUNK_SIZE; i < end; i++) {
+            if (batch.locked[i]) {
+                batch.keys[i] = LOCKED_KEY | i;
+                continue;
+            }
+            const float* v = arena.vertices + (size_t)batch.vertices[i] * 8;
+            uint64_t cell[3];
+            for (int c = 0; c < 3; c++) {
+                cell[c] = std::min(resolution - 1, (uint64_t)std::max(0.0f, (v[c] - batch.bboxMin[c]) * scale));
+            }
+            batch.keys[i] = (cell[0] * resolution + cell[1]) * resolution + cell[2];
+        }
+    });
+}
+
+static size_t countSurviving(const ClusterBatch& batch, int threads) {
+    std::atomic<size_t> total(0);
+    parallelFor(chunkCount(batch.indices.size() / 3), threads, [&](size_t chunk) {
+        size_t end = std::min(batch.indices.size() / 3, (chunk + 1) * CHUNK_SIZE);
+        size_t count = 0;
+        for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+            uint64_t a = batch.keys[batch.indices[3 * t]];
+            uint64_t b = batch.keys[batch.indices[3 * t + 1]];
+            uint64_t c = batch.keys[batch.indices[3 * t + 2]];
+            count += a != b && b != c && a != c;
+        }
+        total += count;
+    });
+    return total;
+}
+
+// Finest resolution whose clustering keeps at most budget triangles, 1 when
+// even the coarsest grid keeps more (locked boundary vertices never merge)
+static uint64_t findResolution(const MeshArena& arena, ClusterBatch& batch, size_t budget, int threads) {
+    auto surviving = [&](uint64_t resolution) {
+        computeKeys(arena, batch, resolution, threads);
+        return countSurviving(batch, threads);
+    };
+    uint64_t low = 1;
+    uint64_t high = 2;
+    while (high < MAX_RESOLUTION && surviving(high) <= budget) {
+        low = high;
+        high *= 2;
+    }
+    while (high - low > 1) {
+        uint64_t mid = low + (high - low) / 2;
+        if (surviving(mid) <= budget) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void clusterBatch(const MeshArena& arena, ClusterBatch& batch, size_t budget, int threads, PackedMeshes& out) {
+    batch.bboxMin = glm::vec3(FLT_MAX);
+    glm::vec3 bbox_max(-FLT_MAX);
+    for (uint32_t vertex : batch.vertices) {
+        const float* v = arena.vertices + (size_t)vertex * 8;
+        batch.bboxMin = glm::min(batch.bboxMin, glm::vec3(v[0], v[1], v[2]));
+        bbox_max = glm::max(bbox_max, glm::vec3(v[0], v[1], v[2]));
+    }
+    glm::vec3 extent = bbox_max - batch.bboxMin;
+    float longest = std::max(extent.x, std::max(extent.y, extent.z));
+    batch.cellScale = longest > 0.0f ? 1.0f / longest : 0.0f;
+    batch.keys.resize(batch.vertices.size());
+
+    uint64_t resolution = findResolution(arena, batch, budget, threads);
+    computeKeys(arena, batch, resolution, threads);
+
+    // cells sorted by key, members by vertex so the averages do not depend on the thread count
+    struct CellItem {
+        uint64_t key;
+        uint32_t vertex;
+    };
+    std::vector<CellItem> items(batch.vertices.size());
+    parallelFor(chunkCount(items.size()), threads, [&](size_t chunk) {
+        size_t end = std::min(items.size(), (chunk + 1) * CHUNK_SIZE);
+        for (size_t i = chunk * CHUNK_SIZE; i < end; i++) {
+            items[i] = {batch.keys[i], (uint32_t)i};
+        }
+    });
+    int bucket_bits = bucketBits(threads);
+    int shift = 64 - bucket_bits;
+    std::vector<size_t> offsets = partitionSort(items, (size_t)1 << bucket_bits, threads,
+        [&](const CellItem& item) { return (size_t)(mix64(item.key) >> shift); },
+        [](const CellItem& a, const CellItem& b) { return a.key != b.key ? a.key < b.key : a.vertex < b.vertex; });
+    size_t bucket_count = offsets.size() - 1;
+
+    // every cell becomes one vertex at the average of its members, numbered bucket by bucket
+    std::vector<size_t> first_cluster(bucket_count + 1, 0);
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        for (size_t i = offsets[b]; i < offsets[b + 1]; i++) {
+            if (i == offsets[b] || items[i].key != items[i - 1].key) first_cluster[b + 1]++;
+        }
+    });
+    for (size_t b = 0; b < bucket_count; b++) {
+        first_cluster[b + 1] += first_cluster[b];
+    }
+    size_t base = out.vertices.size() / 8;
+    out.vertices.resize((base + first_cluster[bucket_count]) * 8);
+    std::vector<uint32_t> cluster(batch.vertices.size());
+    parallelFor(bucket_count, threads, [&](size_t b) {
+        size_t next = base + first_cluster[b];
+        for (size_t begin = offsets[b]; begin < offsets[b + 1];) {
+            size_t end = begin;
+            float sum[8] = {};
+            while (end < offsets[b + 1] && items[end].key == items[begin].key) {
+                const float* v = arena.vertices + (size_t)batch.vertices[items[end].vertex] * 8;
+                for (int c = 0; c < 8; c++) sum[c] += v[c];
+                cluster[items[end].vertex] = (uint32_t)next;
+                end++;
+            }
+            float inv = 1.0f / (float)(end - begin);
+            glm::vec3 normal(sum[3], sum[4], sum[5]);
+            float length = glm::length(normal);
+            normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+            float vertex[8] = {sum[0] * inv, sum[1] * inv, sum[2] * inv, normal.x, normal.y, normal.z, sum[6] * inv, sum[7] * inv};
+            std::memcpy(out.vertices.data() + next * 8, vertex, sizeof(vertex));
+            next++;
+            begin = end;
+        }
+    });
+    std::vector<CellItem>().swap(items);
+
+    // surviving triangles keep their order, every chunk writes after the ones before it
+    size_t triangle_count = batch.indices.size() / 3;
+    size_t chunks = chunkCount(triangle_count);
+    auto clustered = [&](size_t t, uint32_t corners[3]) {
+        for (int k = 0; k < 3; k++) corners[k] = cluster[batch.indices[3 * t + k]];
+        return corners[0] != corners[1] && corners[1] != corners[2] && corners[0] != corners[2];
+    };
+    std::vector<size_t> kept(chunks + 1, 0);
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(triangle_count, (chunk + 1) * CHUNK_SIZE);
+        uint32_t corners[3];
+        for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+            kept[chunk + 1] += clustered(t, corners);
+        }
+    });
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        kept[chunk + 1] += kept[chunk];
+    }
+    size_t index_base = out.indices.size();
+    out.indices.resize(index_base + kept[chunks] * 3);
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(triangle_count, (chunk + 1) * CHUNK_SIZE);
+        unsigned int* target = out.indices.data() + index_base + kept[chunk] * 3;
+        uint32_t corners[3];
+        for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+            if (clustered(t, corners)) {
+                std::memcpy(target, corners, sizeof(corners));
+                target += 3;
+            }
+        }
+    });
+}
+
+// Vertices whose position also appears in another batch sit on a material
+// boundary; they are kept as is so neighbouring batches still meet
+static std::vector<uint8_t> boundaryVertices(const MeshArena& arena, int threads) {
+    std::vector<uint8_t> boundary(arena.vertexCount, 0);
+    if (arena.batchCount <= 1) {
+        return boundary;
+    }
+    std::vector<uint32_t> weld;
+    size_t positions = weldPositions(arena, threads, weld);
+
+    // the batch using every position, shared once a second one does
+    const uint32_t unused = UINT32_MAX;
+    const uint32_t shared = UINT32_MAX - 1;
+    std::vector<std::atomic<uint32_t>> owners(positions);
+    parallelFor(chunkCount(positions), threads, [&](size_t chunk) {
+        size_t end = std::min(positions, (chunk + 1) * CHUNK_SIZE);
+        for (size_t g = chunk * CHUNK_SIZE; g < end; g++) {
+            owners[g].store(unused, std::memory_order_relaxed);
+        }
+    });
+    struct IndexRange {
+        uint32_t batch;
+        uint64_t begin;
+        uint64_t end;
+    };
+    std::vector<IndexRange> ranges;
+    for (size_t i = 0; i < arena.batchCount; i++) {
+        const MeshBatch& batch = arena.batches[i];
+        for (uint64_t begin = 0; begin < batch.indexCount; begin += CHUNK_SIZE) {
+            ranges.push_back({(uint32_t)i, batch.indexOffset + begin, batch.indexOffset + std::min<uint64_t>(batch.indexCount, begin + CHUNK_SIZE)});
+        }
+    }
+    parallelFor(ranges.size(), threads, [&](size_t r) {
+        const IndexRange& range = ranges[r];
+        for (uint64_t j = range.begin; j < range.end; j++) {
+            std::atomic<uint32_t>& owner = owners[weld[arena.indices[j]]];
+            uint32_t current = owner.load(std::memory_order_relaxed);
+            while (current != shared && current != range.batch &&
+                   !owner.compare_exchange_weak(current, current == unused ? range.batch : shared, std::memory_order_relaxed)) {
+            }
+        }
+    });
+    parallelFor(chunkCount(arena.vertexCount), threads, [&](size_t chunk) {
+        size_t end = std::min(arena.vertexCount, (chunk + 1) * CHUNK_SIZE);
+        for (size_t v = chunk * CHUNK_SIZE; v < end; v++) {
+            boundary[v] = owners[weld[v]].load(std::memory_order_relaxed) == shared;
+        }
+    });
+    return boundary;
+}
+
+bool decimateMeshes(const MeshArena& arena, size_t budget, int threads, PackedMeshes& out) {
+    TRACE_SCOPE("decimate");
+    bool over_budget = false;
+    for (size_t i = 0; i < arena.batchCount; i++) {
+        over_budget = over_budget || arena.batches[i].indexCount / 3 > budget;
+    }
+    if (!over_budget) {
+        return false;
+    }
+    std::vector<uint8_t> boundary = boundaryVertices(arena, threads);
+
+    out.vertices.clear();
+    out.indices.clear();
+    out.batches.clear();
+    // local[v] is valid for the batch whose number is in stamp[v]
+    std::vector<uint32_t> local(arena.vertexCount);
+    std::vector<uint32_t> stamp(arena.vertexCount, UINT32_MAX);
+    for (size_t i = 0; i < arena.batchCount; i++) {
+        const MeshBatch& source = arena.batches[i];
+        ClusterBatch batch;
+        batch.indices.reserve(source.indexCount);
+        for (uint64_t j = 0; j < source.indexCount; j++) {
+            uint32_t vertex = arena.indices[source.indexOffset + j];
+            if (stamp[vertex] != (uint32_t)i) {
+                stamp[vertex] = (uint32_t)i;
+                local[vertex] = (uint32_t)batch.vertices.size();
+                batch.vertices.push_back(vertex);
+                batch.locked.push_back(boundary[vertex] != 0);
+            }
+            batch.indices.push_back(local[vertex]);
+        }
+
+        uint64_t index_offset = out.indices.size();
+        if (source.indexCount / 3 > budget) {
+            clusterBatch(arena, batch, budget, threads, out);
+        } else {
+            uint32_t base = (uint32_t)(out.vertices.size() / 8);
+            for (uint32_t vertex : batch.vertices) {
+                out.vertices.insert(out.vertices.end(), arena.vertices + (size_t)vertex * 8, arena.vertices + (size_t)vertex * 8 + 8);
+            }
+            for (uint32_t index : batch.indices) {
+                out.indices.push_back(base + index);
+            }
+        }
+        if (out.indices.size() > index_offset) {
+            out.batches.push_back({source.materialId, 0, index_offset, out.indices.size() - index_offset});
+        }
+    }
+    return true;
+}
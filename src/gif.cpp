@@ -0,0 +1,404 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include "cpp_obj-preview/gif.h"
+
+static const int GIF_LZW_MIN_CODE_SIZE = 8;
+static const int GIF_LZW_MAX_CODE = 4095;
+static const int GIF_LZW_HASH_SIZE = 8192;
+
+static const int BAYER_8X8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+struct ColorBin {
+    uint32_t count;
+    uint64_t sum[3];
+    uint8_t key[3];
+};
+
+struct ColorBox {
+    size_t begin;
+    size_t end;
+    uint64_t count;
+    int axis;
+    int extent;
+};
+
+static inline int clampByte(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int lookupKey(int r, int g, int b) {
+    return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+}
+
+static void measureBox(const std::vector<ColorBin>& bins, ColorBox& box) {
+    int lo[3] = {INT_MAX, INT_MAX, INT_MAX};
+    int hi[3] = {INT_MIN, INT_MIN, INT_MIN};
+    box.count = 0;
+    for (size_t i = box.begin; i < box.end; i++) {
+        for (int c = 0; c < 3; c++) {
+            lo[c] = std::min(lo[c], (int)bins[i].key[c]);
+            hi[c] = std::max(hi[c], (int)bins[i].key[c]);
+        }
+        box.count += bins[i].count;
+    }
+    box.axis = 0;
+    box.extent = -1;
+    for (int c = 0; c < 3; c++) {
+        if (hi[c] - lo[c] > box.extent) {
+            box.extent = hi[c] - lo[c];
+            box.axis = c;
+        }
+    }
+}
+
+GifDither parseGifDither(const std::string& name) {
+    if (name == "none") return GifDither::None;
+    if (name == "bayer") return GifDither::Bayer;
+    if (name == "sierra2_4a") return GifDither::Sierra2_4a;
+    std::cerr << "Error: Unknown gif dither mode " << name << ", using sierra2_4a\n";
+    return GifDither::Sierra2_4a;
+}
+
+GifEncoder::GifEncoder() : file(nullptr), width(0), height(0), delay(5), dither(GifDither::Sierra2_4a), frameCount(0), headerWritten(false) {}
+
+GifEncoder::~GifEncoder() {
+    if (file) {
+        close();
+    }
+}
+
+bool GifEncoder::open(const std::string& path, int width, int height, int fps, GifDither dither, bool overwrite) {
+    if (!overwrite && std::ifstream(path).good()) {
+        std::cerr << "Error: " << path << " already exists, set overwrite-flag to replace it\n";
+        return false;
+    }
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error: Could not open file " << path << " for writing.\n";
+        return false;
+    }
+    this->width = width;
+    this->height = height;
+    this->delay = fps > 0 ? std::max(1, (100 + fps / 2) / fps) : 5;
+    this->dither = dither;
+    frameCount = 0;
+    headerWritten = false;
+    palette.clear();
+    lookup.clear();
+    return true;
+}
+
+bool GifEncoder::hasPalette() const {
+    return !palette.empty();
+}
+
+void GifEncoder::buildPalette(const unsigned char* pixels) {
+    std::vector<ColorBin> histogram(1 << 15);
+    for (size_t i = 0; i < histogram.size(); i++) {
+        histogram[i].key[0] = (uint8_t)(i >> 10);
+        histogram[i].key[1] = (uint8_t)((i >> 5) & 31);
+        histogram[i].key[2] = (uint8_t)(i & 31);
+    }
+    size_t pixel_count = (size_t)width * height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        const unsigned char* p = pixels + 3 * i;
+        ColorBin& bin = histogram[lookupKey(p[0], p[1], p[2])];
+        bin.count++;
+        bin.sum[0] += p[0];
+        bin.sum[1] += p[1];
+        bin.sum[2] += p[2];
+    }
+
+    std::vector<ColorBin> bins;
+    for (const auto& bin : histogram) {
+        if (bin.count > 0) bins.push_back(bin);
+    }
+
+    std::vector<ColorBox> boxes;
+    ColorBox root{0, bins.size(), 0, 0, 0};
+    measureBox(bins, root);
+    boxes.push_back(root);
+
+    while (boxes.size() < 256) {
+        size_t split = boxes.size();
+        uint64_t best = 0;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (boxes[i].end - boxes[i].begin < 2) continue;
+            uint64_t score = boxes[i].count * (uint64_t)(boxes[i].extent + 1);
+            if (score > best) {
+                best = score;
+                split = i;
+            }
+        }
+        if (split == boxes.size()) break;
+
+        ColorBox box = boxes[split];
+        int axis = box.axis;
+        std::sort(bins.begin() + box.begin, bins.begin() + box.end, [axis](const ColorBin& a, const ColorBin& b) {
+            return a.key[axis] < b.key[axis];
+        });
+
+        uint64_t half = box.count / 2, running = 0;
+        size_t mid = box.begin;
+        while (mid < box.end - 1 && running + bins[mid].count <= half) {
+            running += bins[mid].count;
+            mid++;
+        }
+        if (mid == box.begin) mid++;
+
+        ColorBox low{box.begin, mid, 0, 0, 0};
+        ColorBox high{mid, box.end, 0, 0, 0};
+        measureBox(bins, low);
+        measureBox(bins, high);
+        boxes[split] = low;
+        boxes.push_back(high);
+    }
+
+    palette.assign(256 * 3, 0);
+    for (size_t i = 0; i < boxes.size(); i++) {
+        uint64_t sum[3] = {0, 0, 0}, count = 0;
+        for (size_t j = boxes[i].begin; j < boxes[i].end; j++) {
+            for (int c = 0; c < 3; c++) sum[c] += bins[j].sum[c];
+            count += bins[j].count;
+        }
+        for (int c = 0; c < 3; c++) {
+            palette[3 * i + c] = count ? (uint8_t)((sum[c] + count / 2) / count) : 0;
+        }
+    }
+    size_t used = std::max<size_t>(boxes.size(), 1);
+
+    lookup.resize(1 << 15);
+    for (int key = 0; key < (1 << 15); key++) {
+        int r = ((key >> 10) << 3) | 4;
+        int g = (((key >> 5) & 31) << 3) | 4;
+        int b = ((key & 31) << 3) | 4;
+        int best_distance = INT_MAX;
+        uint8_t best_index = 0;
+        for (size_t i = 0; i < used; i++) {
+            int dr = r - palette[3 * i + 0];
+            int dg = g - palette[3 * i + 1];
+            int db = b - palette[3 * i + 2];
+            int distance = 2 * dr * dr + 4 * dg * dg + 3 * db * db;
+            if (distance < best_distance) {
+                best_distance = distance;
+                best_index = (uint8_t)i;
+            }
+        }
+        lookup[key] = best_index;
+    }
+}
+
+uint8_t GifEncoder::nearest(int r, int g, int b) const {
+    return lookup[lookupKey(r, g, b)];
+}
+
+void GifEncoder::quantize(const unsigned char* pixels, std::vector<uint8_t>& indices, GifScratch& scratch) const {
+    indices.resize((size_t)width * height);
+    size_t row_size = (size_t)width * 3;
+
+    if (dither == GifDither::Sierra2_4a) {
+        // Sierra-2-4A ("Sierra Lite"): 2/4 right, 1/4 below-left, 1/4 below
+        // error rows of the current and the next line, swapped by pointer
+        size_t error_size = (size_t)(width + 2) * 3;
+        scratch.errors.assign(error_size * 2, 0);
+        int* current = scratch.errors.data();
+        int* next = current + error_size;
+        for (int y = 0; y < height; y++) {
+            const unsigned char* row = pixels + (size_t)(height - 1 - y) * row_size;
+            uint8_t* out = indices.data() + (size_t)y * width;
+            std::fill(next, next + error_size, 0);
+            for (int x = 0; x < width; x++) {
+                int* err = &current[(x + 1) * 3];
+                int r = clampByte(row[3 * x + 0] + err[0] / 4);
+                int g = clampByte(row[3 * x + 1] + err[1] / 4);
+                int b = clampByte(row[3 * x + 2] + err[2] / 4);
+                uint8_t index = nearest(r, g, b);
+                out[x] = index;
+                int diff[3] = {r - palette[3 * index + 0], g - palette[3 * index + 1], b - palette[3 * index + 2]};
+                for (int c = 0; c < 3; c++) {
+                    current[(x + 2) * 3 + c] += 2 * diff[c];
+                    next[x * 3 + c] += diff[c];
+                    next[(x + 1) * 3 + c] += diff[c];
+                }
+            }
+            std::swap(current, next);
+        }
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* row = pixels + (size_t)(height - 1 - y) * row_size;
+        uint8_t* out = indices.data() + (size_t)y * width;
+        if (dither == GifDither::Bayer) {
+            for (int x = 0; x < width; x++) {
+                int offset = (BAYER_8X8[y & 7][x & 7] - 32) / 4;
+                out[x] = nearest(clampByte(row[3 * x + 0] + offset), clampByte(row[3 * x + 1] + offset), clampByte(row[3 * x + 2] + offset));
+            }
+        } else {
+            for (int x = 0; x < width; x++) {
+                out[x] = nearest(row[3 * x + 0], row[3 * x + 1], row[3 * x + 2]);
+            }
+        }
+    }
+}
+
+void GifEncoder::compress(const std::vector<uint8_t>& indices, std::vector<uint8_t>& out, GifScratch& scratch) const {
+    const int clear_code = 1 << GIF_LZW_MIN_CODE_SIZE;
+    const int end_code = clear_code + 1;
+
+    std::vector<int32_t>& keys = scratch.keys;
+    std::vector<uint16_t>& codes = scratch.codes;
+    keys.assign(GIF_LZW_HASH_SIZE, -1);
+    codes.resize(GIF_LZW_HASH_SIZE);
+
+    // at most one code of up to 12 bits per index plus the clear codes, and a
+    // length byte per 255: reserving that once keeps later frames from growing out
+    size_t max_bytes = indices.size() * 3 / 2 + indices.size() / (GIF_LZW_MAX_CODE - end_code) * 2 + 8;
+    out.clear();
+    out.reserve(max_bytes + max_bytes / 255 + 3);
+    out.push_back(GIF_LZW_MIN_CODE_SIZE);
+
+    uint8_t block[256];
+    int block_size = 0;
+    uint32_t bit_buffer = 0;
+    int bit_count = 0;
+    int code_size = GIF_LZW_MIN_CODE_SIZE + 1;
+    int max_code = end_code;
+
+    auto flushBlock = [&]() {
+        if (block_size == 0) return;
+        out.push_back((uint8_t)block_size);
+        out.insert(out.end(), block, block + block_size);
+        block_size = 0;
+    };
+    auto emit = [&](int code) {
+        bit_buffer |= (uint32_t)code << bit_count;
+        bit_count += code_size;
+        while (bit_count >= 8) {
+            block[block_size++] = (uint8_t)(bit_buffer & 0xFF);
+            bit_buffer >>= 8;
+            bit_count -= 8;
+            if (block_size == 255) flushBlock();
+        }
+    };
+
+    emit(clear_code);
+    if (indices.empty()) {
+        emit(end_code);
+    } else {
+        int current = indices[0];
+        for (size_t i = 1; i < indices.size(); i++) {
+            int value = indices[i];
+            int32_t key = (current << 8) | value;
+            uint32_t slot = ((uint32_t)key * 2654435761u) >> 19;
+            bool found = false;
+            while (keys[slot] != -1) {
+                if (keys[slot] == key) {
+                    current = codes[slot];
+                    found = true;
+                    break;
+                }
+                slot = (slot + 1) & (GIF_LZW_HASH_SIZE - 1);
+            }
+            if (found) continue;
+
+            emit(current);
+            keys[slot] = key;
+            codes[slot] = (uint16_t)++max_code;
+            if (max_code >= (1 << code_size)) {
+                code_size++;
+            }
+            if (max_code == GIF_LZW_MAX_CODE) {
+                emit(clear_code);
+                std::fill(keys.begin(), keys.end(), -1);
+                code_size = GIF_LZW_MIN_CODE_SIZE + 1;
+                max_code = end_code;
+            }
+            current = value;
+        }
+        emit(current);
+        emit(end_code);
+    }
+    if (bit_count > 0) {
+        block[block_size++] = (uint8_t)(bit_buffer & 0xFF);
+        if (block_size == 255) flushBlock();
+    }
+    flushBlock();
+    out.push_back(0);
+}
+
+bool GifEncoder::writeHeader() {
+    uint8_t header[13] = {
+        'G', 'I', 'F', '8', '9', 'a',
+        (uint8_t)(width & 0xFF), (uint8_t)(width >> 8),
+        (uint8_t)(height & 0xFF), (uint8_t)(height >> 8),
+        0xF7, 0, 0
+    };
+    uint8_t loop[19] = {
+        0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+        0x03, 0x01, 0x00, 0x00, 0x00
+    };
+    bool ok = std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    ok = ok && std::fwrite(palette.data(), 1, palette.size(), file) == palette.size();
+    ok = ok && std::fwrite(loop, 1, sizeof(loop), file) == sizeof(loop);
+    headerWritten = ok;
+    return ok;
+}
+
+bool GifEncoder::writeFrame(const std::vector<uint8_t>& lzw) {
+    if (!file || (!headerWritten && !writeHeader())) {
+        std::cerr << "Error: Failed to write gif header\n";
+        return false;
+    }
+    uint8_t control[8] = {0x21, 0xF9, 0x04, 0x04, (uint8_t)(delay & 0xFF), (uint8_t)(delay >> 8), 0x00, 0x00};
+    uint8_t descriptor[10] = {
+        0x2C, 0, 0, 0, 0,
+        (uint8_t)(width & 0xFF), (uint8_t)(width >> 8),
+        (uint8_t)(height & 0xFF), (uint8_t)(height >> 8),
+        0x00
+    };
+    bool ok = std::fwrite(control, 1, sizeof(control), file) == sizeof(control);
+    ok = ok && std::fwrite(descriptor, 1, sizeof(descriptor), file) == sizeof(descriptor);
+    ok = ok && std::fwrite(lzw.data(), 1, lzw.size(), file) == lzw.size();
+    if (!ok) {
+        std::cerr << "Error: Failed to write gif frame " << frameCount << std::endl;
+        return false;
+    }
+    frameCount++;
+    return true;
+}
+
+bool GifEncoder::addFrame(const unsigned char* pixels) {
+    if (!file) return false;
+    if (!hasPalette()) {
+        buildPalette(pixels);
+    }
+    quantize(pixels, indexBuffer, scratch);
+    compress(indexBuffer, lzwBuffer, scratch);
+    return writeFrame(lzwBuffer);
+}
+
+bool GifEncoder::close() {
+    if (!file) return false;
+    bool ok = headerWritten || frameCount > 0;
+    uint8_t trailer = 0x3B;
+    ok = ok && std::fwrite(&trailer, 1, 1, file) == 1;
+    ok = (std::fclose(file) == 0) && ok;
+    file = nullptr;
+    if (!ok) {
+        std::cerr << "Error: Failed to finish gif file\n";
+    }
+    return ok;
+}
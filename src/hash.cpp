@@ -0,0 +1,124 @@
+#include <cstring>
+#include "cpp_obj-preview/hash.h"
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+    acc ^= round64(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+Xxh64::Xxh64(uint64_t seed) : buffered(0), total(0), seed(seed) {
+    acc[0] = seed + PRIME64_1 + PRIME64_2;
+    acc[1] = seed + PRIME64_2;
+    acc[2] = seed;
+    acc[3] = seed - PRIME64_1;
+}
+
+void Xxh64::update(const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    total += size;
+
+    if (buffered + size < 32) {
+        std::memcpy(buffer + buffered, p, size);
+        buffered += size;
+        return;
+    }
+    if (buffered > 0) {
+        size_t fill = 32 - buffered;
+        std::memcpy(buffer + buffered, p, fill);
+        for (int i = 0; i < 4; i++) {
+            acc[i] = round64(acc[i], read64(buffer + i * 8));
+        }
+        p += fill;
+        buffered = 0;
+    }
+    // the reference keeps stripes in little endian order, which is what we run on
+    while (end - p >= 32) {
+        acc[0] = round64(acc[0], read64(p));
+        acc[1] = round64(acc[1], read64(p + 8));
+        acc[2] = round64(acc[2], read64(p + 16));
+        acc[3] = round64(acc[3], read64(p + 24));
+        p += 32;
+    }
+    buffered = (size_t)(end - p);
+    std::memcpy(buffer, p, buffered);
+}
+
+void Xxh64::update(const std::string& text) {
+    update(text.data(), text.size());
+}
+
+uint64_t Xxh64::digest() const {
+    uint64_t hash;
+    if (total >= 32) {
+        hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = mergeRound(hash, acc[i]);
+        }
+    } else {
+        hash = seed + PRIME64_5;
+    }
+    hash += total;
+
+    const unsigned char* p = buffer;
+    const unsigned char* end = buffer + buffered;
+    while (end - p >= 8) {
+        hash ^= round64(0, read64(p));
+        hash = rotl(hash, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        hash ^= (uint64_t)read32(p) * PRIME64_1;
+        hash = rotl(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (*p++) * PRIME64_5;
+        hash = rotl(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string hashToHex(uint64_t hash) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        hex[i] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+    return hex;
+}
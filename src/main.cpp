@@ -5,24 +5,38 @@
 #include <vector>
 #include <cstdio>
 #include <unordered_map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <filesystem>
+#include <unistd.h>
 #include "cpp_obj-preview/processing.h"
-
-std::vector<std::string> readObjComments(const std::string& filename) {
-    std::vector<std::string> comments;
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open OBJ file for reading comments: " << filename << std::endl;
-        return comments;
-    }
-
-    std::string line;
-    while (std::getline(file, line)) {
-        if (!line.empty() && line[0] == '#') {
-            comments.push_back(line.substr(1));
-        }
-    }
-    return comments;
-}
+#include "cpp_obj-preview/gif.h"
+#include "cpp_obj-preview/pipeline.h"
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/context.h"
+#include "cpp_obj-preview/rasterizer.h"
+#include "cpp_obj-preview/batch.h"
+#include "cpp_obj-preview/cache.h"
+#include "cpp_obj-preview/sidecar.h"
+#include "cpp_obj-preview/optimize.h"
+#include "cpp_obj-preview/decimate.h"
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/report.h"
+#include "cpp_obj-preview/trace.h"
+#include "cpp_obj-preview/stream.h"
+#include "cpp_obj-preview/serve.h"
+#include "cpp_obj-preview/sheet.h"
+#include "cpp_obj-preview/budget.h"
+#include "cpp_obj-preview/normals.h"
+#include "cpp_obj-preview/texture.h"
+#include "cpp_obj-preview/overview.h"
 
 std::unordered_map<std::string, std::string> readConfig(std::string filename) {
     std::unordered_map<std::string, std::string> config; 
@@ -57,13 +71,16 @@ void viewCmd(const std::string& open_cmd, std::string save_dir) {
 void clean(std::string save_dir) {
     std::remove((save_dir + "obj-preview.md").c_str());
     std::remove((save_dir + "obj-overview.gif").c_str());
+    std::remove((save_dir + "obj-contact-sheet.png").c_str());
+    std::remove((save_dir + "obj-thumbnail.png").c_str());
 }
 
-int runGifGenCmd(std::string save_dir, std::string overwrite_flag) {
-    std::string ffmpegCmd = "ffmpeg -framerate 20 -i frame_%03d.ppm -filter_complex "
+int runGifGenCmd(std::string save_dir, std::string overwrite_flag, int fps) {
+    std::string ffmpegCmd = "ffmpeg -framerate " + std::to_string(fps) + " -i frame_%03d.ppm -filter_complex "
                              "\"palettegen=stats_mode=full[p];[0][p]paletteuse=dither=sierra2_4a\" "
                              "-fps_mode passthrough " + overwrite_flag + save_dir + "obj-overview.gif";
 
+    TRACE_SCOPE("ffmpeg");
     int ret = std::system(ffmpegCmd.c_str());
     if (ret != 0) {
         std::cerr << "Error: Failed to run: " << ffmpegCmd << std::endl;
@@ -79,6 +96,35 @@ int runGifGenCmd(std::string save_dir, std::string overwrite_flag) {
     return 0;
 }
 
+int configInt(const std::unordered_map<std::string, std::string>& config, const std::string& key, int fallback) {
+    if (config.find(key) == config.end()) {
+        return fallback;
+    }
+    const std::string& value = config.at(key);
+    char* end = nullptr;
+    long parsed = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || parsed < 1) {
+        std::cerr << "Error: Invalid value " << value << " for " << key << ", using " << fallback << std::endl;
+        return fallback;
+    }
+    return (int)parsed;
+}
+
+// Positive decimal value of key, fallback when it is missing or invalid
+double configNumber(const std::unordered_map<std::string, std::string>& config, const std::string& key, double fallback) {
+    if (config.find(key) == config.end()) {
+        return fallback;
+    }
+    const std::string& value = config.at(key);
+    char* end = nullptr;
+    double parsed = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || !(parsed > 0.0)) {
+        std::cerr << "Error: Invalid value " << value << " for " << key << ", using " << fallback << std::endl;
+        return fallback;
+    }
+    return parsed;
+}
+
 std::string extendHome(std::string path) {
     if (!path.empty() && path[0] == '~') {
         const char* home = getenv("HOME");
@@ -89,120 +135,799 @@ std::string extendHome(std::string path) {
     return path;
 }
 
-int generateOverview(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t>& materials, std::string filename, std::string save_dir) {
-    std::string warn, err;
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str());
-    if (!warn.empty()) std::cout << "Error: " << warn << std::endl;
-    if (!err.empty()) std::cerr << "Error: " << err << std::endl;
-    if (!ret) {
-        std::cerr << "Error: Failed to load/parse OBJ file: " << filename << std::endl;
-        return 1;
+// Settings read once from the config and shared by every previewed model
+struct PreviewSettings {
+    std::string overwrite_flag;
+    bool use_ffmpeg;
+    GifDither dither;
+    int workers;
+    int queue_depth;
+    int gif_scale;
+    int threads;
+    ObjParser parser;
+    ContextBackend backend;
+    bool use_cache;
+    bool use_sidecar;
+    size_t triangle_budget;
+    std::string cache_dir;
+    uint64_t cache_bytes;
+    std::string trace_path;
+    RenderFormat format;
+    // false, true or auto (files larger than memory_limit)
+    std::string streaming;
+    size_t memory_limit;
+    std::string serve_socket;
+    int serve_jobs;
+    int serve_queue;
+    bool overview_gif;
+    bool overview_sheet;
+    int sheet_columns;
+    int sheet_rows;
+    // seconds one overview may take, 0 without a budget
+    double time_budget;
+    // publish a thumbnail and a coarse gif before the full overview
+    bool progressive;
+    // degrees between faces beyond which generated normals are not smoothed
+    float crease_angle;
+};
+
+PreviewSettings readSettings(const std::unordered_map<std::string, std::string>& config) {
+    PreviewSettings settings;
+    settings.overwrite_flag = "";
+    if (config.find("overwrite-flag") != config.end()) {
+        config.at("overwrite-flag") == "true" || config.at("overwrite-flag") == "1" ? settings.overwrite_flag = "-y " : settings.overwrite_flag = "";
     }
 
-    if (!glfwInit()) {
-        std::cerr << "Error: Failed to init GLFW\n";
-        return -1;
+    settings.use_ffmpeg = config.find("gif-encoder") != config.end() && config.at("gif-encoder") == "ffmpeg";
+    settings.dither = GifDither::Sierra2_4a;
+    if (config.find("gif-dither") != config.end()) {
+        settings.dither = parseGifDither(config.at("gif-dither"));
     }
 
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    settings.workers = configInt(config, "workers", std::max(1, (int)std::thread::hardware_concurrency() - 1));
+    settings.queue_depth = configInt(config, "queue-depth", 8);
+    settings.gif_scale = configInt(config, "gif-scale", 1);
+    settings.threads = configInt(config, "threads", defaultThreadCount());
+    settings.parser = ObjParser::Native;
+    if (config.find("obj-parser") != config.end()) {
+        settings.parser = parseObjParser(config.at("obj-parser"));
+    }
+    settings.backend = defaultContextBackend();
+    if (config.find("context") != config.end()) {
+        settings.backend = parseContextBackend(config.at("context"));
+    }
 
-    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "360 Rotation Capture", nullptr, nullptr);
-    if (!window) {
-        std::cerr << "Error: Failed to create window\n";
-        glfwTerminate();
-        return -1;
+    settings.use_cache = config.find("cache") == config.end() || (config.at("cache") != "false" && config.at("cache") != "0");
+    settings.cache_dir = extendHome(config.find("cache-dir") != config.end() ? config.at("cache-dir") : "~/.cache/cpp_obj-preview");
+    settings.cache_bytes = (uint64_t)configInt(config, "cache-size", 1024) << 20;
+    settings.triangle_budget = config.find("triangle-budget") != config.end() ? (size_t)configInt(config, "triangle-budget", 1) : 0;
+    settings.use_sidecar = config.find("mesh-sidecar") == config.end() || (config.at("mesh-sidecar") != "false" && config.at("mesh-sidecar") != "0");
+    settings.trace_path = config.find("trace") != config.end() ? extendHome(config.at("trace")) : "";
+    settings.format = DEFAULT_FORMAT;
+    settings.format.width = std::min(configInt(config, "width", WIDTH), MAX_FRAME_SIZE);
+    settings.format.height = std::min(configInt(config, "height", HEIGHT), MAX_FRAME_SIZE);
+    settings.format.frames = configInt(config, "frames", FRAMES);
+    settings.format.fps = configInt(config, "fps", FPS);
+    if (config.find("step") != config.end()) {
+        double step = configNumber(config, "step", 0.0);
+        if (step > 0.0 && step <= 360.0) {
+            settings.format.frames = std::max(1, (int)std::lround(360.0 / step));
+        } else if (step > 0.0) {
+            std::cerr << "Error: Invalid value " << config.at("step") << " for step, using " << 360.0 / settings.format.frames << std::endl;
+        }
+    }
+    if (settings.format.width < settings.gif_scale || settings.format.height < settings.gif_scale) {
+        std::cerr << "Error: Frames of " << settings.format.width << "x" << settings.format.height << " are smaller than gif-scale, using "
+                  << WIDTH << "x" << HEIGHT << std::endl;
+        settings.format.width = WIDTH;
+        settings.format.height = HEIGHT;
     }
+    settings.time_budget = configNumber(config, "time-budget", 0.0);
+    settings.format.tiles = std::min(configInt(config, "atlas-tiles", 1), MAX_ATLAS_TILES);
+    std::string overview = config.find("overview") != config.end() ? config.at("overview") : "gif";
+    if (overview != "gif" && overview != "sheet" && overview != "both") {
+        std::cerr << "Error: Invalid value " << overview << " for overview, using gif\n";
+        overview = "gif";
+    }
+    settings.overview_gif = overview != "sheet";
+    settings.overview_sheet = overview != "gif";
+    settings.sheet_columns = settings.sheet_rows = 4;
+    if (config.find("sheet-grid") != config.end() && !parseSheetGrid(config.at("sheet-grid"), settings.sheet_columns, settings.sheet_rows)) {
+        std::cerr << "Error: Invalid value " << config.at("sheet-grid") << " for sheet-grid, using 4x4\n";
+        settings.sheet_columns = settings.sheet_rows = 4;
+    }
+    settings.crease_angle = (float)configNumber(config, "crease-angle", DEFAULT_CREASE_ANGLE);
+    settings.progressive = config.find("progressive") == config.end() || (config.at("progressive") != "false" && config.at("progressive") != "0");
+    settings.streaming = config.find("streaming") != config.end() ? config.at("streaming") : "false";
+    if (settings.streaming == "1") settings.streaming = "true";
+    if (settings.streaming == "0") settings.streaming = "false";
+    if (settings.streaming != "true" && settings.streaming != "false" && settings.streaming != "auto") {
+        std::cerr << "Error: Invalid value " << settings.streaming << " for streaming, using false\n";
+        settings.streaming = "false";
+    }
+    settings.memory_limit = (size_t)configInt(config, "memory-limit", 1024) << 20;
+    if (config.find("serve-socket") != config.end()) {
+        settings.serve_socket = extendHome(config.at("serve-socket"));
+    } else {
+        const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+        settings.serve_socket = runtime_dir ? std::string(runtime_dir) + "/cpp_obj-preview.sock"
+                                            : "/tmp/cpp_obj-preview-" + std::to_string(getuid()) + ".sock";
+    }
+    settings.serve_jobs = configInt(config, "serve-jobs", 2);
+    settings.serve_queue = configInt(config, "serve-queue", 64);
+    return settings;
+}
+
+// Everything besides the model files that changes the rendered preview
+std::string cacheSettings(const PreviewSettings& settings) {
+    std::ostringstream key;
+    key << "v1 " << settings.format.width << "x" << settings.format.height << " " << settings.format.frames << "@" << settings.format.fps
+        << " encoder=" << (settings.use_ffmpeg ? "ffmpeg" : "builtin")
+        << " dither=" << (int)settings.dither
+        << " scale=" << settings.gif_scale
+        << " context=" << (settings.backend == ContextBackend::Cpu ? "cpu" : "gl")
+        << " budget=" << settings.triangle_budget
+        << " streaming=" << settings.streaming << " memory-limit=" << settings.memory_limit
+        << " time-budget=" << settings.time_budget << " gif=" << settings.overview_gif << " sheet=" << (settings.overview_sheet ? settings.sheet_columns : 0) << "x" << settings.sheet_rows
+        << " progressive=" << settings.progressive << " crease-angle=" << settings.crease_angle;
+    return key.str();
+}
+
+// Files previewModel writes into the save directory
+std::vector<std::string> previewOutputs(const PreviewSettings& settings) {
+    std::vector<std::string> outputs = {"obj-preview.md"};
+    if (settings.overview_gif) outputs.push_back("obj-overview.gif");
+    if (settings.overview_sheet) outputs.push_back("obj-contact-sheet.png");
+    if (settings.progressive) outputs.push_back("obj-thumbnail.png");
+    return outputs;
+}
+
+const int PROGRESSIVE_FRAMES = 36;
 
-    glfwMakeContextCurrent(window);
+// Frames of the coarse gif published while the full one renders, 0 when the
+// full gif is not long enough to be worth one
+int coarseFrames(const PreviewSettings& settings, const RenderFormat& format) {
+    if (!settings.progressive || !settings.overview_gif || settings.use_ffmpeg || format.frames < 2 * PROGRESSIVE_FRAMES) {
+        return 0;
+    }
+    return PROGRESSIVE_FRAMES;
+}
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cerr << "Error: Failed to initialize GLAD\n";
-        glfwDestroyWindow(window);
-        glfwTerminate();
-        return -1;
+void cacheStore(const PreviewSettings& settings, const std::string& key, const std::string& save_dir) {
+    if (key.empty() || storeInCache(settings.cache_dir, key, save_dir, previewOutputs(settings)) != 0) {
+        return;
     }
+    pruneCache(settings.cache_dir, settings.cache_bytes);
+}
 
-    std::vector<MeshGL> meshes = setupMeshes(attrib, shapes);
- 
-    int render_ret = render(meshes, attrib, materials, window);
+// GL context and compiled program, created once and reused for every model
+// together with the decoded textures
+struct Renderer {
+    ContextBackend backend;
+    RenderContext context;
+    std::unique_ptr<Shader> shader;
+    TextureCache textures;
+};
+
+void createRenderer(Renderer& renderer, ContextBackend backend, const RenderFormat& format) {
+    if (backend != ContextBackend::Cpu && renderer.context.create(backend, format.width, format.height) != 0) {
+        std::cerr << "Error: Failed to create GL context, falling back to the CPU rasterizer\n";
+        backend = ContextBackend::Cpu;
+    }
+    renderer.backend = backend;
+    if (backend != ContextBackend::Cpu) {
+        renderer.shader.reset(new Shader());
+    }
+}
+
+bool shouldStream(const std::string& filename, const PreviewSettings& settings) {
+    return settings.streaming == "true" || (settings.streaming == "auto" && exceedsMemoryLimit(filename, settings.memory_limit));
+}
+
+// One turntable rendering of the model: a stage of the overview gif or the contact sheet.
+// done, when set, finishes the pass's output before the next pass starts.
+struct OverviewPass {
+    RenderFormat format;
+    FrameSink sink;
+    std::function<int()> done;
+};
+
+// Sets up the outputs of the chosen overview format and returns their passes
+using PassBuilder = std::function<int(const RenderFormat& format, std::vector<OverviewPass>& passes)>;
+
+// Picks the overview format, calibrated against the time budget when there is
+// one, then builds and renders its passes. start is when the overview began.
+int renderOverview(const PreviewSettings& settings, const FormatRenderer& render_format, size_t triangles,
+                   std::chrono::steady_clock::time_point start, const PassBuilder& build, OverviewSummary& summary) {
+    RenderFormat format = settings.format;
+    summary.format = format;
+    summary.budget.clear();
+    if (settings.time_budget > 0.0 && settings.overview_gif) {
+        FrameCost cost;
+        if (calibrateFrameCost(format, render_format, !settings.use_ffmpeg, settings.dither, settings.gif_scale, cost) != 0) {
+            return 1;
+        }
+        // the contact sheet and the coarse gif are rendered at half size
+        int quarter_frames = (settings.overview_sheet ? settings.sheet_columns * settings.sheet_rows : 0) + coarseFrames(settings, format);
+        double remaining = settings.time_budget - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double estimate = 0.0;
+        format = budgetFormat(format, cost, remaining, settings.workers, quarter_frames, estimate);
+
+        std::ostringstream budget;
+        budget << settings.time_budget << " s, " << cost.fixed * 1e3 << " ms per frame";
+        if (triangles > 0) {
+            budget << " (" << cost.fixed * 1e9 / triangles << " ns per triangle)";
+        }
+        budget << " + " << cost.perPixel * 1e9 << " ns per pixel";
+        if (cost.encodePerPixel > 0.0) {
+            budget << " + " << cost.encodePerPixel * 1e9 << " ns per encoded pixel";
+        }
+        budget << ", " << estimate << " s estimated for " << remaining << " s left";
+        summary.budget = budget.str();
+        std::cout << "Time budget " << settings.time_budget << " s: rendering " << describeFormat(format) << ", estimated " << estimate << " s\n";
+    }
+    summary.format = format;
+
+    std::vector<OverviewPass> passes;
+    if (build(format, passes) != 0) {
+        return 1;
+    }
+    for (const auto& pass : passes) {
+        if (render_format(pass.format, pass.sink) != 0 || (pass.done && pass.done() != 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Renders with the uploaded geometry, the context framebuffer follows the frame size
+FormatRenderer glRenderer(Renderer& renderer, std::vector<MeshGL>& meshes, const Camera& camera, const std::vector<tinyobj::material_t>& materials,
+                          const std::vector<GLuint>& textures) {
+    return [&renderer, &meshes, &camera, &materials, &textures](const RenderFormat& format, const FrameSink& sink) {
+        if (renderer.context.resize(format.width, format.height) != 0) {
+            return 1;
+        }
+        return render(*renderer.shader, meshes, camera, materials, textures, format, sink);
+    };
+}
+
+// Renders a model streamed straight into GPU buffers, it is never whole on the
+// CPU so it is neither decimated nor written to a sidecar, nor textured since
+// the stream carries no texcoords
+int streamOverview(ObjModel& model, const PreviewSettings& settings, Renderer& renderer, const PassBuilder& build, GeometryStats& stats,
+                   OverviewSummary& summary) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<MeshGL> meshes;
+    if (streamModel(model.filename, settings.memory_limit, model, stats, meshes) != 0) {
+        return 1;
+    }
+    if (settings.triangle_budget > 0 && stats.triangles > settings.triangle_budget) {
+        std::cout << "Streamed models are not decimated, rendering all " << stats.triangles << " triangles\n";
+    }
+    model.renderedTriangles = stats.triangles;
+    Camera camera = frameCamera(stats.bboxMin, stats.bboxMax, settings.format.width / (float)settings.format.height);
+    std::vector<GLuint> textures;
+    int render_ret = renderOverview(settings, glRenderer(renderer, meshes, camera, model.materials, textures), stats.triangles, start, build, summary);
+    deleteMeshes(meshes);
     if (render_ret != 0) {
-        std::cerr << "Error: Failed to render the OBJ file: " << filename << std::endl;
+        std::cerr << "Error: Failed to render the OBJ file: " << model.filename << std::endl;
         return 1;
     }
+    return 0;
+}
+
+int generateOverview(ObjModel& model, const PreviewSettings& settings, Renderer& renderer, const PassBuilder& build, GeometryStats& stats,
+                     OverviewSummary& summary) {
+    if (model.streamed && renderer.backend == ContextBackend::Cpu) {
+        std::cerr << "Error: Streaming needs a GL context, loading " << model.filename << " into memory\n";
+        model.streamed = false;
+        if (loadModel(model.filename, settings.parser, settings.threads, model) != 0) {
+            return 1;
+        }
+    }
+    if (model.streamed) {
+        return streamOverview(model, settings, renderer, build, stats, summary);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    // textures decode on their own threads while the geometry is set up
+    std::future<MaterialImages> texture_load = renderer.textures.load(model.materials, std::filesystem::path(model.filename).parent_path().string(),
+                                                                     textureSizeLimit(settings.format.width, settings.format.height), settings.threads);
+    PackedMeshes packed;
+    MeshArena arena;
+    // the arena's optimized stream when one was mapped or built, uploaded as is
+    GpuMeshes optimized;
+    GpuArena gpu = optimized.arena();
+    if (model.sidecar) {
+        arena = model.sidecar->arena();
+        gpu = model.sidecar->gpuArena();
+    } else {
+        packed = packShapes(model.attrib, model.shapes, settings.threads);
+        auto normals_start = std::chrono::steady_clock::now();
+        size_t generated = generateNormals(packed, settings.crease_angle, settings.threads);
+        if (generated > 0) {
+            std::cout << "Generated " << generated << " normals in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - normals_start).count() << " ms\n";
+        }
+        arena = packed.arena();
+    }
+
+    auto analyze_start = std::chrono::steady_clock::now();
+    stats = analyzeGeometry(arena, settings.threads);
+    std::cout << "Analyzed " << stats.triangles << " triangles in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - analyze_start).count() << " ms\n";
+    if (!model.sidecar && settings.use_sidecar && model.sourceHash != 0) {
+        // the stream keeps texcoords whenever the file has them, uploads skip them for untextured materials
+        bool texcoords = model.texcoordCount > 0;
+        uint64_t sidecar_bytes = sidecarBytes(packed, texcoords);
+        if (sidecar_bytes > settings.cache_bytes / SIDECAR_CACHE_SHARE) {
+            std::cout << "Skipped the mesh sidecar, its " << ((sidecar_bytes + (1 << 20) - 1) >> 20) << " MiB exceed 1/" << SIDECAR_CACHE_SHARE
+                      << " of cache-size\n";
+        } else {
+            optimized = optimizeMeshes(arena, texcoords, settings.threads);
+            gpu = optimized.arena();
+            if (writeSidecar(sidecarPath(settings.cache_dir, model.sourceHash), model.sourceHash, settings.crease_angle, model, packed, optimized,
+                             stats.bboxMin, stats.bboxMax) == 0) {
+                pruneCache(settings.cache_dir, settings.cache_bytes);
+            }
+        }
+    }
+    Camera camera = frameCamera(stats.bboxMin, stats.bboxMax, settings.format.width / (float)settings.format.height);
+
+    PackedMeshes decimated;
+    auto decimate_start = std::chrono::steady_clock::now();
+    if (settings.triangle_budget > 0 && decimateMeshes(arena, settings.triangle_budget, settings.threads, decimated)) {
+        double decimate_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decimate_start).count();
+        size_t largest = 0;
+        for (const auto& batch : decimated.batches) {
+            largest = std::max(largest, (size_t)batch.indexCount / 3);
+        }
+        if (largest > settings.triangle_budget) {
+            // vertices on material boundaries never merge, even the coarsest grid keeps them
+            std::cerr << "Error: Could not meet the triangle budget of " << settings.triangle_budget << " per material, decimated "
+                      << arena.indexCount / 3 << " to " << decimated.indices.size() / 3 << " triangles with " << largest
+                      << " left in one material in " << decimate_ms << " ms\n";
+        } else {
+            std::cout << "Decimated " << arena.indexCount / 3 << " to " << decimated.indices.size() / 3 << " triangles in " << decimate_ms << " ms\n";
+        }
+        arena = decimated.arena();
+        gpu = GpuArena{};
+        optimized = GpuMeshes();
+    }
+    model.renderedTriangles = arena.indexCount / 3;
+
+    auto texture_wait = std::chrono::steady_clock::now();
+    MaterialImages images = texture_load.get();
+    size_t textured = (size_t)std::count_if(images.begin(), images.end(), [](const std::shared_ptr<const TextureImage>& image) { return image != nullptr; });
+    if (textured > 0) {
+        std::cout << "Loaded the textures of " << textured << " material(s), waited "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - texture_wait).count() << " ms on decoding\n";
+    }
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    int render_ret;
+    if (renderer.backend == ContextBackend::Cpu) {
+        FormatRenderer render_format = [&](const RenderFormat& format, const FrameSink& sink) {
+            return renderCpu(arena, camera, model.materials, images, settings.threads, format, sink);
+        };
+        render_ret = renderOverview(settings, render_format, model.renderedTriangles, start, build, summary);
+    } else {
+        std::vector<MeshGL> meshes = gpu.batchCount > 0 ? uploadGpuArena(gpu, textured > 0) : uploadArena(arena, textured > 0, settings.threads);
+        std::vector<GLuint> textures = uploadTextures(images);
+        render_ret = renderOverview(settings, glRenderer(renderer, meshes, camera, model.materials, textures), model.renderedTriangles, start, build,
+                                    summary);
+        deleteTextures(textures);
+        deleteMeshes(meshes);
+    }
+    if (render_ret != 0) {
+        std::cerr << "Error: Failed to render the OBJ file: " << model.filename << std::endl;
+        return 1;
+    }
 
     return 0;
 }
 
-int generateReport(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t>& materials, std::string filename, std::string save_dir) { 
-    std::ofstream report((save_dir + "obj-preview.md").c_str());
-    if (!report.is_open()) {
-        std::cerr << "Error: Failed to create report file obj-preview.md\n";
+// Maps the model's mesh sidecar when it matches the sources, parses the OBJ
+// file otherwise unless it is streamed while rendering
+int loadAsset(const std::string& filename, const PreviewSettings& settings, uint64_t source_hash, ObjModel& model) {
+    model.filename = filename;
+    if (settings.use_sidecar && source_hash != 0) {
+        auto load_start = std::chrono::steady_clock::now();
+        std::string sidecar_path = sidecarPath(settings.cache_dir, source_hash);
+        if (loadSidecar(sidecar_path, source_hash, settings.crease_angle, model) == 0) {
+            std::cout << "Loaded " << sidecar_path << " in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count() << " ms\n";
+            return 0;
+        }
+    }
+    if (shouldStream(filename, settings)) {
+        model.streamed = true;
+        model.sourceHash = source_hash;
+        return 0;
+    }
+    if (loadModel(filename, settings.parser, settings.threads, model) != 0) {
         return 1;
     }
-    report << "# OBJ file preview\n\n";
-    report << "File: `" << filename << "`\n\n";
+    model.sourceHash = source_hash;
+    return 0;
+}
 
-    report << "## File Comments\n\n";
-    std::vector<std::string> comments = readObjComments(filename);
-    if (comments.empty()) {
-        report << "_No comments found in the OBJ file._\n";
-    } else {
-        for (const auto& c : comments) {
-            report << "- " << c << "\n";
+GifOutputOptions gifOptions(const PreviewSettings& settings) {
+    return {settings.gif_scale, settings.use_ffmpeg, settings.dither, settings.workers, settings.queue_depth};
+}
+
+// Moves a finished output over its published name
+int publishFile(const std::string& from, const std::string& to) {
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        std::cerr << "Error: Failed to rename " << from << " to " << to << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Renders, encodes and reports one parsed model into save_dir. With progressive
+// previews a front view thumbnail and a provisional report are published from
+// the first rendered frame, then a coarse gif, then the full overview.
+// first_report runs once the first report is in place.
+int previewModel(ObjModel& model, const PreviewSettings& settings, Renderer& renderer, const std::string& save_dir,
+                 const std::function<void()>& first_report = nullptr) {
+    TRACE_SCOPE("preview", model.filename);
+    auto preview_start = std::chrono::steady_clock::now();
+    int ret;
+
+    // replace outputs by unlinking them, they may be hardlinks into the preview cache
+    if (!settings.overwrite_flag.empty()) {
+        for (const auto& output : previewOutputs(settings)) {
+            std::remove((save_dir + output).c_str());
+        }
+    }
+    std::string gif_path = save_dir + "obj-overview.gif";
+    std::string sheet_path = save_dir + "obj-contact-sheet.png";
+    std::vector<std::string> kept;
+    if (settings.overview_gif && !settings.use_ffmpeg) kept.push_back(gif_path);
+    if (settings.overview_sheet) kept.push_back(sheet_path);
+    for (const auto& path : kept) {
+        if (settings.overwrite_flag.empty() && std::ifstream(path).good()) {
+            std::cerr << "Error: " << path << " already exists, set overwrite-flag to replace it\n";
+            return 1;
+        }
+    }
+    // the builtin encoder writes next to the published gif and replaces it once done
+    std::string gif_part = gif_path + ".part";
+    std::string coarse_part = gif_path + ".coarse";
+
+    GeometryStats stats;
+    OverviewSummary summary;
+    summary.gif = false;
+    summary.sheet = false;
+    summary.thumbnail = false;
+    bool reported = false;
+    auto publishReport = [&](const std::string& status) {
+        summary.status = status;
+        if (generateReport(model, stats, save_dir, summary) != 0) {
+            return 1;
+        }
+        if (!reported && first_report) {
+            first_report();
+        }
+        reported = true;
+        return 0;
+    };
+
+    // the outputs are sized once the format is known, a time budget may shrink it
+    RenderFormat gif_format = settings.format;
+    GifOutput gif;
+    GifOutput coarse;
+    std::unique_ptr<ContactSheet> sheet;
+    std::vector<unsigned char> thumbnail;
+    PassBuilder build = [&](const RenderFormat& format, std::vector<OverviewPass>& passes) {
+        int width = format.width;
+        int height = format.height;
+        gif_format = format;
+        int coarse_frames = coarseFrames(settings, format);
+        if (coarse_frames > 0) {
+            RenderFormat coarse_format = format;
+            coarse_format.width = std::max(settings.gif_scale, width / 2);
+            coarse_format.height = std::max(settings.gif_scale, height / 2);
+            coarse_format.frames = coarse_frames;
+            coarse_format.fps = std::max(1, (int)std::lround((double)format.fps * coarse_frames / format.frames));
+            FrameSink sink;
+            if (openGifOutput(coarse, coarse_part, coarse_format, gifOptions(settings), sink) != 0) {
+                return 1;
+            }
+            passes.push_back({coarse_format, sink, [&, coarse_format]() {
+                if (closeGifOutput(coarse) != 0 || publishFile(coarse_part, gif_path) != 0) {
+                    return 1;
+                }
+                summary.gif = true;
+                summary.format = coarse_format;
+                std::cout << "Published the coarse overview after "
+                          << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - preview_start).count() << " ms\n";
+                return publishReport("coarse overview, the full one is rendering");
+            }});
+        }
+        if (settings.overview_gif) {
+            FrameSink sink;
+            if (openGifOutput(gif, gif_part, format, gifOptions(settings), sink) != 0) {
+                return 1;
+            }
+            passes.push_back({format, sink});
+        }
+
+        // the contact sheet holds one atlas of half sized frames, rendered in a single pass where it fits
+        if (settings.overview_sheet) {
+            RenderFormat sheet_format = format;
+            sheet_format.width = std::max(1, width / 2);
+            sheet_format.height = std::max(1, height / 2);
+            // tiles shrink, keeping their aspect, until the sheet's edges fit MAX_FRAME_SIZE
+            double shrink = std::min({1.0, (double)MAX_FRAME_SIZE / ((double)settings.sheet_columns * sheet_format.width),
+                                      (double)MAX_FRAME_SIZE / ((double)settings.sheet_rows * sheet_format.height)});
+            sheet_format.width = std::max(1, (int)(sheet_format.width * shrink));
+            sheet_format.height = std::max(1, (int)(sheet_format.height * shrink));
+            sheet_format.frames = settings.sheet_columns * settings.sheet_rows;
+            sheet_format.tiles = std::min(sheet_format.frames, MAX_ATLAS_TILES);
+            sheet.reset(new ContactSheet(settings.sheet_columns, settings.sheet_rows, sheet_format.width, sheet_format.height));
+            ContactSheet* target = sheet.get();
+            passes.push_back({sheet_format, [target](int frame, const unsigned char* pixels) {
+                return target->add(frame, pixels);
+            }});
+        }
+
+        // the first frame of the first pass faces the camera, it becomes the half sized thumbnail
+        if (settings.progressive && !passes.empty()) {
+            const RenderFormat& first = passes[0].format;
+            passes[0].sink = firstFrameSink(passes[0].sink, first.width, first.height, first.width == width, thumbnail,
+                [&](const unsigned char* pixels, int thumb_width, int thumb_height) {
+                    TRACE_SCOPE("thumbnail");
+                    std::string thumb_path = save_dir + "obj-thumbnail.png";
+                    if (!writePng(thumb_path + ".part", pixels, thumb_width, thumb_height) || publishFile(thumb_path + ".part", thumb_path) != 0) {
+                        return 1;
+                    }
+                    summary.thumbnail = true;
+                    if (publishReport("rendering the overview, this report is refreshed when it is done") != 0) {
+                        return 1;
+                    }
+                    std::cout << "Published the thumbnail after "
+                              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - preview_start).count() << " ms\n";
+                    return 0;
+                });
         }
+        return 0;
+    };
+
+    ret = generateOverview(model, settings, renderer, build, stats, summary);
+    if (closeGifOutput(coarse) != 0 && ret == 0) {
+        ret = 1;
+    }
+    if (closeGifOutput(gif) != 0 && ret == 0) {
+        ret = 1;
+    }
+    if (ret != 0) {
+        std::remove(gif_part.c_str());
+        std::remove(coarse_part.c_str());
+        return ret;
+    }
+
+    summary.format = gif_format;
+    if (settings.overview_gif && settings.use_ffmpeg) {
+        ret = runGifGenCmd(save_dir, settings.overwrite_flag, summary.format.fps);
+        if (ret != 0) {
+            return ret;
+        }
+    } else if (settings.overview_gif && publishFile(gif_part, gif_path) != 0) {
+        return 1;
     }
-    report << "\n";
+    if (sheet && (!sheet->save(sheet_path + ".part") || publishFile(sheet_path + ".part", sheet_path) != 0)) {
+        std::remove((sheet_path + ".part").c_str());
+        return 1;
+    }
+
+    summary.gif = settings.overview_gif;
+    summary.sheet = settings.overview_sheet;
+    summary.thumbnail = false;
+    return publishReport("");
+}
 
-    report << "## Summary\n";
-    report << "- Number of vertices: " << (attrib.vertices.size() / 3) << "\n";
-    report << "- Number of normals: " << (attrib.normals.size() / 3) << "\n";
-    report << "- Number of texture coordinates: " << (attrib.texcoords.size() / 2) << "\n";
-    report << "- Number of shapes: " << shapes.size() << "\n";
-    report << "- Number of materials: " << materials.size() << "\n\n";
+// Previews every asset of a batch source with one renderer, parsing the next
+// asset on a background thread while the current one renders
+int runBatch(const std::string& source, const PreviewSettings& settings, const std::string& save_dir) {
+    std::vector<std::string> files;
+    if (collectBatchFiles(source, files) != 0) {
+        return 1;
+    }
 
-    if (!materials.empty()) {
-        report << "## Materials\n\n";
-        for (size_t i = 0; i < materials.size(); i++) {
-            std::string ambient_hex = rgbToHex(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
-            std::string diffuse_hex = rgbToHex(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
-            std::string specular_hex = rgbToHex(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
-            std::stringstream ambient_string;
-            ambient_string << "- Ambient color: ![" << ambient_hex << "](https://placehold.co/15x15/" << ambient_hex << "/" << ambient_hex << ".png)\n";
-            std::stringstream diffuse_string;
-            diffuse_string << "- Diffuse color: ![" << diffuse_hex << "](https://placehold.co/15x15/" << diffuse_hex << "/" << diffuse_hex << ".png)\n";
-            std::stringstream specular_string;
-            specular_string << "- Specular color: ![" << specular_hex << "](https://placehold.co/15x15/" << specular_hex << "/" << specular_hex << ".png)\n";
+    Renderer renderer;
+    createRenderer(renderer, settings.backend, settings.format);
+
+    struct BatchAsset {
+        std::string key;
+        bool cached;
+        std::unique_ptr<ObjModel> model;
+    };
+    auto load = [&settings](const std::string& filename) {
+        TRACE_SCOPE("load", filename);
+        BatchAsset asset;
+        uint64_t source_hash = 0;
+        if (settings.use_cache || settings.use_sidecar) {
+            hashSource(filename, source_hash);
+        }
+        asset.key = settings.use_cache && source_hash != 0 ? previewCacheKey(source_hash, cacheSettings(settings)) : "";
+        asset.cached = !asset.key.empty() && cacheContains(settings.cache_dir, asset.key);
+        if (asset.cached) {
+            return asset;
+        }
+        asset.model.reset(new ObjModel());
+        if (loadAsset(filename, settings, source_hash, *asset.model) != 0) {
+            asset.model.reset();
+        }
+        return asset;
+    };
+
+    auto batch_start = std::chrono::steady_clock::now();
+    double parse_wait = 0.0;
+    size_t failed = 0;
+    size_t cached = 0;
+    size_t triangles = 0;
+    std::unordered_map<std::string, int> used_dirs;
+    std::future<BatchAsset> next = std::async(std::launch::async, load, files[0]);
+    for (size_t i = 0; i < files.size(); i++) {
+        TRACE_SCOPE("asset", files[i]);
+        auto wait_start = std::chrono::steady_clock::now();
+        BatchAsset asset;
+        {
+            TRACE_SCOPE("parse_wait");
+            asset = next.get();
+        }
+        parse_wait += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+        if (i + 1 < files.size()) {
+            next = std::async(std::launch::async, load, files[i + 1]);
+        }
 
-            report << "Material `" << materials[i].name << "`\n\n";
-            report << ambient_string.str();
-            report << diffuse_string.str();
-            report << specular_string.str();
-            report << "- Specular exponent: " << materials[i].shininess << "\n\n";
+        std::string asset_dir = batchSaveDir(save_dir, files[i], used_dirs);
+        std::error_code ec;
+        std::filesystem::create_directories(asset_dir, ec);
+        if (ec) {
+            std::cerr << "Error: Failed to create " << asset_dir << ": " << ec.message() << std::endl;
         }
-        report << "\n";
+        if (!ec && asset.cached) {
+            if (restoreFromCache(settings.cache_dir, asset.key, files[i], asset_dir, !settings.overwrite_flag.empty()) != 0) {
+                failed++;
+            } else {
+                cached++;
+            }
+            continue;
+        }
+        if (!asset.model || ec || previewModel(*asset.model, settings, renderer, asset_dir) != 0) {
+            std::cerr << "Error: Failed to preview " << files[i] << std::endl;
+            failed++;
+            continue;
+        }
+        cacheStore(settings, asset.key, asset_dir);
+        triangles += asset.model->renderedTriangles;
     }
 
-    report << "## Shapes\n";
-    for (size_t i = 0; i < shapes.size(); i++) {
-        size_t face_count = shapes[i].mesh.num_face_vertices.size();
-        report << "- Shape `" << shapes[i].name << "` has " << face_count << " face(s)\n";
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+    size_t done = files.size() - failed;
+    std::cout << "Batch: previewed " << done << " of " << files.size() << " assets (" << cached << " from cache) in " << total << " s ("
+              << done / total << " assets/s, " << triangles / total << " triangles/s, "
+              << parse_wait * 1000.0 << " ms waiting on parsing)\n";
+    if (failed > 0) {
+        std::cerr << "Error: " << failed << " asset(s) failed\n";
+        return 1;
     }
-    report << "\n";
+    return 0;
+}
 
-    report << "## Overview\n";
-    report << "![Overview gif](obj-overview.gif)\n";
+// Previews one OBJ file, restoring it from the preview cache when possible.
+// first_report runs once a rendered preview has its first report.
+int previewFile(const std::string& filename, const PreviewSettings& settings, const std::string& save_dir, const std::function<void()>& first_report) {
+    uint64_t source_hash = 0;
+    if (settings.use_cache || settings.use_sidecar) {
+        hashSource(filename, source_hash);
+    }
+    std::string key = settings.use_cache && source_hash != 0 ? previewCacheKey(source_hash, cacheSettings(settings)) : "";
+    if (!key.empty() && cacheContains(settings.cache_dir, key)) {
+        auto restore_start = std::chrono::steady_clock::now();
+        if (restoreFromCache(settings.cache_dir, key, filename, save_dir, !settings.overwrite_flag.empty()) != 0) {
+            return 1;
+        }
+        std::cout << "Restored " << filename << " from the preview cache in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - restore_start).count() << " ms\n";
+        return 0;
+    }
 
-    report.close();
+    ObjModel model;
+    if (loadAsset(filename, settings, source_hash, model) != 0) {
+        return 1;
+    }
 
+    Renderer renderer;
+    createRenderer(renderer, settings.backend, settings.format);
+    int ret = previewModel(model, settings, renderer, save_dir, first_report);
+    if (ret != 0) {
+        return ret;
+    }
+    cacheStore(settings, key, save_dir);
     return 0;
 }
 
+// Answers preview requests on a Unix socket with one warm renderer. Requests
+// are hashed, restored from the preview cache or loaded on the server's
+// workers, and rendered through previewModel on this thread.
+int runServe(const std::string& socket_path, const PreviewSettings& settings, const std::string& save_dir) {
+    Renderer renderer;
+    createRenderer(renderer, settings.backend, settings.format);
+
+    ServeHandler handler = [&](const ServeRequest& request, ServeResult& result) -> std::function<void()> {
+        auto fail = [&result](const std::string& error) {
+            result.status = 1;
+            result.error = error;
+            return std::function<void()>();
+        };
+        std::shared_ptr<PreviewSettings> job_settings = std::make_shared<PreviewSettings>(settings);
+        RenderFormat& format = job_settings->format;
+        if (request.frames > 0) {
+            format.frames = request.frames;
+        }
+        if (request.width > 0) {
+            format.width = request.width;
+            format.height = request.height;
+        }
+        if (format.width < job_settings->gif_scale || format.height < job_settings->gif_scale) {
+            return fail("size is smaller than gif-scale");
+        }
+        // output directories are named after the content and settings, so stale outputs are simply replaced
+        job_settings->overwrite_flag = "-y ";
+
+        std::string filename = extendHome(request.obj);
+        uint64_t source_hash = 0;
+        if (!hashSource(filename, source_hash)) {
+            return fail("cannot read " + filename);
+        }
+        std::string key = previewCacheKey(source_hash, cacheSettings(*job_settings));
+        std::string dir = request.output.empty() ? save_dir + std::filesystem::path(filename).stem().string() + "-" + key.substr(0, 16)
+                                                 : extendHome(request.output);
+        if (dir.back() != '/') {
+            dir += '/';
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) {
+            return fail("cannot create " + dir + ": " + ec.message());
+        }
+        result.gif = settings.overview_gif ? dir + "obj-overview.gif" : "";
+        result.sheet = settings.overview_sheet ? dir + "obj-contact-sheet.png" : "";
+        result.report = dir + "obj-preview.md";
+
+        if (settings.use_cache && cacheContains(settings.cache_dir, key)) {
+            if (restoreFromCache(settings.cache_dir, key, filename, dir, true) != 0) {
+                return fail("cannot restore " + filename + " from the preview cache");
+            }
+            result.cached = true;
+            return std::function<void()>();
+        }
+        std::shared_ptr<ObjModel> model = std::make_shared<ObjModel>();
+        if (loadAsset(filename, *job_settings, source_hash, *model) != 0) {
+            return fail("cannot load " + filename);
+        }
+        return [&renderer, &result, job_settings, model, key, dir]() {
+            if (previewModel(*model, *job_settings, renderer, dir) != 0) {
+                result.status = 1;
+                result.error = "cannot render " + model->filename;
+                return;
+            }
+            cacheStore(*job_settings, job_settings->use_cache ? key : "", dir);
+            result.triangles = model->renderedTriangles;
+        };
+    };
+
+    return runServer(socket_path, {settings.serve_jobs, settings.serve_queue}, handler);
+}
+
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: exe [file.obj | mode]\n\nmodes:\n\n    - clean - cleans saved preview.md and overview.gif";
+        std::cerr << "Usage: exe [file.obj | mode]\n\nmodes:\n\n    - clean - cleans saved preview.md and overview.gif"
+                     "\n    - batch <dir | glob | manifest> - previews every OBJ file into its own save-dir subdirectory"
+                     "\n    - serve [socket] - answers JSON preview requests on a Unix socket with a warm renderer\n";
         return 1;
     } 
 
@@ -215,43 +940,53 @@ int main(int argc, char** argv) {
         }
     }
 
+    PreviewSettings settings = readSettings(config);
+
     if (std::string(argv[1]) == "clean") {
-        std::remove((save_dir + "obj-preview.md").c_str());
-        std::remove((save_dir + "obj-overview.gif").c_str());
+        clean(save_dir);
+        pruneCache(settings.cache_dir, 0);
         return 0;
     }
 
-    std::string filename = extendHome(argv[1]); 
-
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    int ret;
+    bool batch = std::string(argv[1]) == "batch";
+    if (batch && argc < 3) {
+        std::cerr << "Error: batch mode needs a directory, glob or manifest\n";
+        return 1;
+    }
+    bool serve = std::string(argv[1]) == "serve";
 
-    ret = generateOverview(attrib, shapes, materials, filename, save_dir);
-    if (ret != 0) {
-        return ret;
+    if (!settings.trace_path.empty()) {
+        startTrace();
     }
-    
-    std::string overwrite_flag = "";
-    if (config.find("overwrite-flag") != config.end()) {
-        config.at("overwrite-flag") == "true" || config.at("overwrite-flag") == "1" ? overwrite_flag = "-y " : overwrite_flag = "";
+    // the viewer opens on the first report, a progressive preview keeps refining it meanwhile
+    std::future<void> viewer;
+    std::function<void()> open_viewer;
+    if (!batch && !serve && config.find("view-cmd") != config.end()) {
+        std::string view_cmd = config.at("view-cmd");
+        open_viewer = [&viewer, view_cmd, save_dir]() {
+            viewer = std::async(std::launch::async, viewCmd, view_cmd, save_dir);
+        };
     }
-
-    ret = runGifGenCmd(save_dir, overwrite_flag);
-    if (ret != 0) {
-        return ret;
+    int ret;
+    if (serve) {
+        ret = runServe(argc > 2 ? extendHome(argv[2]) : settings.serve_socket, settings, save_dir);
+    } else if (batch) {
+        ret = runBatch(extendHome(argv[2]), settings, save_dir);
+    } else {
+        ret = previewFile(extendHome(argv[1]), settings, save_dir, open_viewer);
     }
-
-    ret = generateReport(attrib, shapes, materials, filename, save_dir);
-    if (ret != 0) {
-        return ret;
+    if (!settings.trace_path.empty()) {
+        std::string summary;
+        if (writeTrace(settings.trace_path, summary) == 0) {
+            std::cout << summary << std::endl;
+        }
     }
 
-    if (config.find("view-cmd") != config.end()) {
+    if (viewer.valid()) {
+        viewer.wait();
+    } else if (ret == 0 && open_viewer) {
         viewCmd(config.at("view-cmd"), save_dir);
     }
 
-    return 0;
+    return ret;
 }
-
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+#include "cpp_obj-preview/normals.h"
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t CHUNK_SIZE = 1 << 16;
+// vertices solving their position touch a few corners each, smaller chunks balance the threads better
+static const size_t SOLVE_CHUNK_SIZE = 1 << 12;
+// positions shared by more corners (fan centres, collapsed geometry) are
+// smoothed as a whole instead of paying the quadratic crease test
+static const size_t MAX_CREASE_CORNERS = 256;
+static const float PI = 3.14159265f;
+
+static const size_t SKIP = SIZE_MAX;
+
+static size_t chunkCount(size_t count, size_t chunk_size) {
+    return (count + chunk_size - 1) / chunk_size;
+}
+
+// Lock-free counting sort of the items 0 .. item_count - 1 by key (items keyed
+// SKIP are dropped): items of key k end up in sorted[offsets[k] .. offsets[k + 1]),
+// in the order the threads claimed their slots
+template <typename Key>
+static void countingSort(size_t item_count, size_t key_count, int threads, Key key, std::vector<size_t>& offsets, std::vector<uint32_t>& sorted) {
+    std::vector<std::atomic<uint32_t>> cursors(key_count);
+    size_t chunks = chunkCount(item_count, CHUNK_SIZE);
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(item_count, (chunk + 1) * CHUNK_SIZE);
+        for (size_t i = chunk * CHUNK_SIZE; i < end; i++) {
+            size_t k = key(i);
+            if (k != SKIP) cursors[k].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    // the counts become write cursors
+    offsets.resize(key_count + 1);
+    size_t total = 0;
+    for (size_t k = 0; k < key_count; k++) {
+        offsets[k] = total;
+        total += cursors[k].load(std::memory_order_relaxed);
+        cursors[k].store((uint32_t)offsets[k], std::memory_order_relaxed);
+    }
+    offsets[key_count] = total;
+    sorted.resize(total);
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(item_count, (chunk + 1) * CHUNK_SIZE);
+        for (size_t i = chunk * CHUNK_SIZE; i < end; i++) {
+            size_t k = key(i);
+            if (k != SKIP) sorted[cursors[k].fetch_add(1, std::memory_order_relaxed)] = (uint32_t)i;
+        }
+    });
+}
+
+// Unit normal of a face and the weights of its corners, side by side so a
+// corner costs one cache miss
+struct FaceWeights {
+    glm::vec3 normal;
+    float corners[3];
+};
+
+// A missing corner gathered with its face for the position it lies on
+struct PositionCorner {
+    uint32_t vertex;
+    uint32_t corner;
+    glm::vec3 face;
+    float weight;
+};
+
+// A further normal of a vertex, given to a copy of it
+struct VertexSplit {
+    glm::vec3 normal;
+    uint32_t vertex;
+};
+
+struct CornerMove {
+    uint32_t corner;
+    uint32_t split;
+};
+
+size_t generateNormals(PackedMeshes& packed, float crease_angle, int threads) {
+    size_t vertex_count = packed.vertices.size() / 8;
+    size_t triangle_count = packed.indices.size() / 3;
+    std::vector<uint8_t> missing(vertex_count);
+    std::atomic<size_t> missing_count(0);
+    parallelFor(chunkCount(vertex_count, CHUNK_SIZE), threads, [&](size_t chunk) {
+        size_t end = std::min(vertex_count, (chunk + 1) * CHUNK_SIZE);
+        size_t count = 0;
+        for (size_t v = chunk * CHUNK_SIZE; v < end; v++) {
+            const float* n = &packed.vertices[v * 8 + 3];
+            missing[v] = n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f;
+            count += missing[v];
+        }
+        missing_count += count;
+    });
+    if (missing_count == 0) {
+        return 0;
+    }
+    TRACE_SCOPE("normals");
+
+    // corners are gathered by position, so smoothing crosses texcoord seams and shapes
+    std::vector<uint32_t> weld;
+    size_t positions = weldPositions(packed.arena(), threads, weld);
+
+    // unit face normals and corner weights (doubled area times corner angle)
+    // of the faces touching a missing normal
+    size_t triangle_chunks = chunkCount(triangle_count, CHUNK_SIZE);
+    std::vector<FaceWeights> faces(triangle_count);
+    parallelFor(triangle_chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(triangle_count, (chunk + 1) * CHUNK_SIZE);
+        for (size_t t = chunk * CHUNK_SIZE; t < end; t++) {
+            const unsigned int* corner = &packed.indices[3 * t];
+            if (!missing[corner[0]] && !missing[corner[1]] && !missing[corner[2]]) {
+                continue;
+            }
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; k++) {
+                const float* v = &packed.vertices[(size_t)corner[k] * 8];
+                p[k] = glm::vec3(v[0], v[1], v[2]);
+            }
+            glm::vec3 cross = glm::cross(p[1] - p[0], p[2] - p[0]);
+            float doubled_area = glm::length(cross);
+            faces[t].normal = doubled_area > 0.0f ? cross / doubled_area : glm::vec3(0.0f);
+            // the third corner angle is what the other two leave of pi
+            glm::vec3 e01 = p[1] - p[0];
+            glm::vec3 e02 = p[2] - p[0];
+            glm::vec3 e12 = p[2] - p[1];
+            float l01 = glm::length(e01), l02 = glm::length(e02), l12 = glm::length(e12);
+            float angle[3] = {0.0f, 0.0f, 0.0f};
+            if (l01 > 0.0f && l02 > 0.0f && l12 > 0.0f) {
+                angle[0] = std::acos(glm::clamp(glm::dot(e01, e02) / (l01 * l02), -1.0f, 1.0f));
+                angle[1] = std::acos(glm::clamp(-glm::dot(e01, e12) / (l01 * l12), -1.0f, 1.0f));
+                angle[2] = std::max(0.0f, PI - angle[0] - angle[1]);
+            }
+            for (int k = 0; k < 3; k++) {
+                faces[t].corners[k] = doubled_area * angle[k];
+            }
+        }
+    });
+
+    // missing corners by vertex (neighbouring faces share vertices, so this
+    // scatter stays in cache), then the vertices by position
+    std::vector<size_t> vertex_offsets;
+    std::vector<uint32_t> corners;
+    countingSort(packed.indices.size(), vertex_count, threads, [&](size_t corner) {
+        unsigned int vertex = packed.indices[corner];
+        return missing[vertex] ? (size_t)vertex : SKIP;
+    }, vertex_offsets, corners);
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> vertices;
+    countingSort(vertex_count, positions, threads, [&](size_t vertex) {
+        return missing[vertex] ? (size_t)weld[vertex] : SKIP;
+    }, offsets, vertices);
+    // the lowest vertex of every position is moved to its front, the solve below
+    // gathers the corners by vertex so the rest of the order does not matter
+    parallelFor(chunkCount(positions, CHUNK_SIZE), threads, [&](size_t chunk) {
+        size_t end = std::min(positions, (chunk + 1) * CHUNK_SIZE);
+        for (size_t g = chunk * CHUNK_SIZE; g < end; g++) {
+            if (offsets[g + 1] - offsets[g] > 1) {
+                std::iter_swap(vertices.begin() + offsets[g], std::min_element(vertices.begin() + offsets[g], vertices.begin() + offsets[g + 1]));
+            }
+        }
+    });
+
+    // per position, solved by its lowest vertex so the work follows the vertex
+    // order: every corner averages the faces within the crease angle of its own
+    // face. The first normal of a vertex is written in place, corners across a
+    // crease from it are moved to split vertices appended below.
+    float crease_degrees = std::min(std::max(crease_angle, 0.0f), 180.0f);
+    float min_dot = std::cos(glm::radians(crease_degrees));
+    float half_dot = std::cos(glm::radians(crease_degrees / 2.0f));
+    size_t solve_chunks = chunkCount(vertex_count, SOLVE_CHUNK_SIZE);
+    std::vector<std::vector<VertexSplit>> splits(solve_chunks);
+    std::vector<std::vector<CornerMove>> moves(solve_chunks);
+    std::atomic<size_t> written(0);
+    parallelFor(solve_chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(vertex_count, (chunk + 1) * SOLVE_CHUNK_SIZE);
+        std::vector<PositionCorner> local;
+        std::vector<std::pair<glm::vec3, int>> distinct;
+        size_t count = 0;
+        for (size_t leader = chunk * SOLVE_CHUNK_SIZE; leader < end; leader++) {
+            if (!missing[leader]) {
+                continue;
+            }
+            size_t g = weld[leader];
+            if (vertices[offsets[g]] != leader) {
+                continue;
+            }
+            local.clear();
+            glm::vec3 smooth(0.0f);
+            for (size_t j = offsets[g]; j < offsets[g + 1]; j++) {
+                uint32_t vertex = vertices[j];
+                for (size_t c = vertex_offsets[vertex]; c < vertex_offsets[vertex + 1]; c++) {
+                    uint32_t corner = corners[c];
+                    const FaceWeights& face = faces[corner / 3];
+                    local.push_back({vertex, corner, face.normal, face.corners[corner % 3]});
+                }
+            }
+            // by vertex, then by corner, so the sums below do not depend on the scatter order
+            std::sort(local.begin(), local.end(), [](const PositionCorner& a, const PositionCorner& b) {
+                return a.vertex != b.vertex ? a.vertex < b.vertex : a.corner < b.corner;
+            });
+            for (const auto& other : local) {
+                smooth += other.weight * other.face;
+            }
+            bool crease = local.size() <= MAX_CREASE_CORNERS && min_dot > -1.0f;
+            float smooth_length = glm::length(smooth);
+            if (crease && smooth_length > 0.0f) {
+                // faces within half the crease angle of their mean are within it of each other
+                glm::vec3 mean = smooth / smooth_length;
+                crease = !std::all_of(local.begin(), local.end(), [&](const PositionCorner& c) {
+                    return glm::dot(c.face, mean) >= half_dot;
+                });
+            }
+            for (size_t i = 0; i < local.size(); i++) {
+                glm::vec3 sum(0.0f);
+                if (crease) {
+                    for (const auto& other : local) {
+                        if (glm::dot(local[i].face, other.face) >= min_dot) {
+                            sum += other.weight * other.face;
+                        }
+                    }
+                }
+                // degenerate faces take the normal of the whole position
+                if (!crease || sum == glm::vec3(0.0f)) {
+                    sum = smooth;
+                }
+                float length = glm::length(sum);
+                glm::vec3 normal = length > 0.0f ? sum / length : glm::vec3(0.0f);
+
+                uint32_t vertex = local[i].vertex;
+                if (i == 0 || vertex != local[i - 1].vertex) {
+                    distinct.clear();
+                }
+                auto found = std::find_if(distinct.begin(), distinct.end(), [&](const std::pair<glm::vec3, int>& d) {
+                    return d.first == normal;
+                });
+                int split = -1;
+                if (found != distinct.end()) {
+                    split = found->second;
+                } else if (distinct.empty()) {
+                    float* v = &packed.vertices[(size_t)vertex * 8];
+                    v[3] = normal.x;
+                    v[4] = normal.y;
+                    v[5] = normal.z;
+                    distinct.push_back({normal, -1});
+                    count++;
+                } else {
+                    split = (int)splits[chunk].size();
+                    splits[chunk].push_back({normal, vertex});
+                    distinct.push_back({normal, split});
+                    count++;
+                }
+                if (split >= 0) {
+                    moves[chunk].push_back({local[i].corner, (uint32_t)split});
+                }
+            }
+        }
+        written += count;
+    });
+
+    // split vertices copy their source and are appended, each chunk from its own base
+    std::vector<size_t> bases(solve_chunks + 1, vertex_count);
+    for (size_t chunk = 0; chunk < solve_chunks; chunk++) {
+        bases[chunk + 1] = bases[chunk] + splits[chunk].size();
+    }
+    if (bases[solve_chunks] > vertex_count) {
+        packed.vertices.resize(bases[solve_chunks] * 8);
+        parallelFor(solve_chunks, threads, [&](size_t chunk) {
+            for (size_t k = 0; k < splits[chunk].size(); k++) {
+                const VertexSplit& split = splits[chunk][k];
+                float* v = &packed.vertices[(bases[chunk] + k) * 8];
+                std::memcpy(v, &packed.vertices[(size_t)split.vertex * 8], 8 * sizeof(float));
+                v[3] = split.normal.x;
+                v[4] = split.normal.y;
+                v[5] = split.normal.z;
+            }
+            for (const auto& move : moves[chunk]) {
+                packed.indices[move.corner] = (unsigned int)(bases[chunk] + move.split);
+            }
+        });
+    }
+    return written;
+}
@@ -0,0 +1,701 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+struct ObjSegment {
+    std::string name;
+    size_t firstFace;
+};
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<tinyobj::index_t> indices;
+    std::vector<int> faceMaterials;
+    std::vector<std::string> materialNames;
+    std::vector<ObjSegment> segments;
+    // Positions in indices holding negative (relative) references, with a v/vt/vn field mask
+    std::vector<std::pair<size_t, int>> relative;
+    std::vector<std::string> comments;
+    std::vector<std::string> mtllibs;
+    std::string error;
+};
+
+ObjParser parseObjParser(const std::string& name) {
+    if (name == "native") return ObjParser::Native;
+    if (name == "tinyobj") return ObjParser::TinyObj;
+    std::cerr << "Error: Unknown obj parser " << name << ", using native\n";
+    return ObjParser::Native;
+}
+
+static inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) p++;
+    return p;
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* parseFloat(const char* p, const char* end, float& out) {
+    p = skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    const char* start = p;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    while (p < end && isDigit(*p)) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isDigit(*p)) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p == start) {
+        return nullptr;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool exp_negative = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            exp_negative = *q == '-';
+            q++;
+        }
+        if (q < end && isDigit(*q)) {
+            int value = 0;
+            while (q < end && isDigit(*q)) {
+                if (value < 10000) value = value * 10 + (*q - '0');
+                q++;
+            }
+            exponent += exp_negative ? -value : value;
+            p = q;
+        }
+    }
+    double value = (double)mantissa;
+    if (exponent < 0) {
+        value = exponent >= -22 ? value / POW10[-exponent] : value * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        value = exponent <= 22 ? value * POW10[exponent] : value * std::pow(10.0, exponent);
+    }
+    out = (float)(negative ? -value : value);
+    return p;
+}
+
+static inline const char* parseInt(const char* p, const char* end, int& out) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p >= end || !isDigit(*p)) return nullptr;
+    long value = 0;
+    while (p < end && isDigit(*p)) {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    out = (int)(negative ? -value : value);
+    return p;
+}
+
+static std::string restOfLine(const char* p, const char* end) {
+    p = skipSpaces(p, end);
+    const char* q = end;
+    while (q > p && isSpace(q[-1])) q--;
+    return std::string(p, q);
+}
+
+// Converts a 1-based or negative OBJ reference into a 0-based one, negative
+// results stay chunk-relative until the chunk offsets are known
+static inline int resolveIndex(int value, size_t count, bool& relative) {
+    if (value > 0) return value - 1;
+    relative = true;
+    return (int)count + value;
+}
+
+static bool parseFace(ObjChunk& chunk, const char* p, const char* end, int material, std::vector<tinyobj::index_t>& face, std::vector<int>& masks) {
+    face.clear();
+    masks.clear();
+    for (;;) {
+        p = skipSpaces(p, end);
+        if (p >= end) break;
+        tinyobj::index_t idx{-1, -1, -1};
+        int mask = 0;
+        bool relative = false;
+        int value;
+        p = parseInt(p, end, value);
+        if (!p || value == 0) return false;
+        idx.vertex_index = resolveIndex(value, chunk.vertices.size() / 3, relative);
+        if (relative) mask |= 1;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/') {
+                relative = false;
+                p = parseInt(p, end, value);
+                if (!p || value == 0) return false;
+                idx.texcoord_index = resolveIndex(value, chunk.texcoords.size() / 2, relative);
+                if (relative) mask |= 2;
+            }
+            if (p < end && *p == '/') {
+                p++;
+                relative = false;
+                p = parseInt(p, end, value);
+                if (!p || value == 0) return false;
+                idx.normal_index = resolveIndex(value, chunk.normals.size() / 3, relative);
+                if (relative) mask |= 4;
+            }
+        }
+        if (p < end && !isSpace(*p)) return false;
+        face.push_back(idx);
+        masks.push_back(mask);
+    }
+    if (face.size() < 3) return true;
+
+    for (size_t i = 1; i + 1 < face.size(); i++) {
+        size_t corners[3] = {0, i, i + 1};
+        for (size_t corner : corners) {
+            if (masks[corner]) {
+                chunk.relative.push_back({chunk.indices.size(), masks[corner]});
+            }
+            chunk.indices.push_back(face[corner]);
+        }
+        chunk.faceMaterials.push_back(material);
+    }
+    return true;
+}
+
+static void parseChunk(ObjChunk& chunk) {
+    std::vector<tinyobj::index_t> face;
+    std::vector<int> masks;
+    int material = -1;
+
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* line_end = (const char*)std::memchr(p, '\n', chunk.end - p);
+        if (!line_end) line_end = chunk.end;
+
+        const char* q = skipSpaces(p, line_end);
+        if (q < line_end) {
+            char c0 = q[0];
+            char c1 = q + 1 < line_end ? q[1] : '\0';
+            bool ok = true;
+            if (c0 == '#') {
+                chunk.comments.push_back(std::string(q + 1, line_end > q + 1 && line_end[-1] == '\r' ? line_end - 1 : line_end));
+            } else if (c0 == 'v' && isSpace(c1)) {
+                float x = 0, y = 0, z = 0;
+                q = parseFloat(q + 1, line_end, x);
+                if (q) q = parseFloat(q, line_end, y);
+                if (q) q = parseFloat(q, line_end, z);
+                ok = q != nullptr;
+                chunk.vertices.insert(chunk.vertices.end(), {x, y, z});
+            } else if (c0 == 'v' && c1 == 'n' && q + 2 < line_end && isSpace(q[2])) {
+                float x = 0, y = 0, z = 0;
+                q = parseFloat(q + 2, line_end, x);
+                if (q) q = parseFloat(q, line_end, y);
+                if (q) q = parseFloat(q, line_end, z);
+                ok = q != nullptr;
+                chunk.normals.insert(chunk.normals.end(), {x, y, z});
+            } else if (c0 == 'v' && c1 == 't' && q + 2 < line_end && isSpace(q[2])) {
+                float u = 0, v = 0;
+                q = parseFloat(q + 2, line_end, u);
+                if (q) {
+                    const char* r = parseFloat(q, line_end, v);
+                    if (!r) v = 0;
+                }
+                ok = q != nullptr;
+                chunk.texcoords.insert(chunk.texcoords.end(), {u, v});
+            } else if (c0 == 'f' && isSpace(c1)) {
+                ok = parseFace(chunk, q + 1, line_end, material, face, masks);
+            } else if ((c0 == 'o' || c0 == 'g') && (isSpace(c1) || q + 1 == line_end)) {
+                chunk.segments.push_back({restOfLine(q + 1, line_end), chunk.faceMaterials.size()});
+            } else if (line_end - q > 6 && std::strncmp(q, "usemtl", 6) == 0 && isSpace(q[6])) {
+                chunk.materialNames.push_back(restOfLine(q + 6, line_end));
+                material = (int)chunk.materialNames.size() - 1;
+            } else if (line_end - q > 6 && std::strncmp(q, "mtllib", 6) == 0 && isSpace(q[6])) {
+                chunk.mtllibs.push_back(restOfLine(q + 6, line_end));
+            }
+            if (!ok && chunk.error.empty()) {
+                chunk.error = "Failed to parse line: " + std::string(p, line_end);
+            }
+        }
+        p = line_end + 1;
+    }
+}
+
+static std::string baseDir(const std::string& filename) {
+    size_t pos = filename.find_last_of("/\\");
+    return pos == std::string::npos ? "" : filename.substr(0, pos + 1);
+}
+
+bool loadObjNative(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+                   std::vector<std::string>* comments, std::string* warn, std::string* err, const std::string& filename, int threads) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        *err += "Cannot open file [" + filename + "]\n";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        *err += "Cannot stat file [" + filename + "]\n";
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    traceCount(TraceCounter::BytesRead, (int64_t)size);
+    const char* data = nullptr;
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            *err += "Cannot mmap file [" + filename + "]\n";
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char*)mapped;
+    }
+    ::close(fd);
+
+    size_t chunk_count = std::max<size_t>(1, std::min<size_t>((size_t)threads * 4, size / MIN_CHUNK_SIZE));
+    std::vector<ObjChunk> chunks(chunk_count);
+    const char* cursor = data;
+    const char* data_end = data + size;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const char* chunk_end = i + 1 == chunk_count ? data_end : std::max(cursor, data + size / chunk_count * (i + 1));
+        if (chunk_end < data_end) {
+            const char* newline = (const char*)std::memchr(chunk_end, '\n', data_end - chunk_end);
+            chunk_end = newline ? newline + 1 : data_end;
+        }
+        chunks[i].begin = cursor;
+        chunks[i].end = chunk_end;
+        cursor = chunk_end;
+    }
+
+    parallelFor(chunk_count, threads, [&](size_t i) {
+        parseChunk(chunks[i]);
+    });
+
+    if (data) {
+        munmap((void*)data, size);
+    }
+
+    size_t vertex_total = 0, normal_total = 0, texcoord_total = 0;
+    std::vector<size_t> vertex_base(chunk_count), normal_base(chunk_count), texcoord_base(chunk_count);
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (!chunks[i].error.empty()) {
+            *warn += chunks[i].error + "\n";
+        }
+        vertex_base[i] = vertex_total;
+        normal_base[i] = normal_total;
+        texcoord_base[i] = texcoord_total;
+        vertex_total += chunks[i].vertices.size() / 3;
+        normal_total += chunks[i].normals.size() / 3;
+        texcoord_total += chunks[i].texcoords.size() / 2;
+    }
+
+    attrib->vertices.reserve(vertex_total * 3);
+    attrib->normals.reserve(normal_total * 3);
+    attrib->texcoords.reserve(texcoord_total * 2);
+    for (auto& chunk : chunks) {
+        attrib->vertices.insert(attrib->vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+        attrib->normals.insert(attrib->normals.end(), chunk.normals.begin(), chunk.normals.end());
+        attrib->texcoords.insert(attrib->texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+        std::vector<float>().swap(chunk.vertices);
+        std::vector<float>().swap(chunk.normals);
+        std::vector<float>().swap(chunk.texcoords);
+        comments->insert(comments->end(), chunk.comments.begin(), chunk.comments.end());
+    }
+
+    parallelFor(chunk_count, threads, [&](size_t i) {
+        for (const auto& entry : chunks[i].relative) {
+            tinyobj::index_t& idx = chunks[i].indices[entry.first];
+            if (entry.second & 1) idx.vertex_index += (int)vertex_base[i];
+            if (entry.second & 2) idx.texcoord_index += (int)texcoord_base[i];
+            if (entry.second & 4) idx.normal_index += (int)normal_base[i];
+        }
+    });
+
+    std::map<std::string, int> material_map;
+    std::string base_dir = baseDir(filename);
+    for (const auto& chunk : chunks) {
+        for (const auto& mtllib : chunk.mtllibs) {
+            std::ifstream mtl_file(base_dir + mtllib);
+            if (!mtl_file) {
+                *warn += "Material file [ " + base_dir + mtllib + " ] not found.\n";
+                continue;
+            }
+            tinyobj::LoadMtl(&material_map, materials, &mtl_file, warn, err);
+        }
+    }
+
+    tinyobj::shape_t current;
+    int current_material = -1;
+    auto flush = [&](const ObjChunk& chunk, const std::vector<int>& material_ids, size_t first, size_t last) {
+        tinyobj::mesh_t& mesh = current.mesh;
+        mesh.indices.insert(mesh.indices.end(), chunk.indices.begin() + 3 * first, chunk.indices.begin() + 3 * last);
+        mesh.num_face_vertices.insert(mesh.num_face_vertices.end(), last - first, 3);
+        mesh.smoothing_group_ids.insert(mesh.smoothing_group_ids.end(), last - first, 0);
+        for (size_t f = first; f < last; f++) {
+            int slot = chunk.faceMaterials[f];
+            mesh.material_ids.push_back(slot < 0 ? current_material : material_ids[slot]);
+        }
+    };
+
+    for (const auto& chunk : chunks) {
+        std::vector<int> material_ids;
+        for (const auto& name : chunk.materialNames) {
+            auto it = material_map.find(name);
+            if (it == material_map.end()) {
+                *warn += "material [ '" + name + "' ] not found in .mtl\n";
+                material_ids.push_back(-1);
+            } else {
+                material_ids.push_back(it->second);
+            }
+        }
+
+        size_t face = 0;
+        for (const auto& segment : chunk.segments) {
+            flush(chunk, material_ids, face, segment.firstFace);
+            face = segment.firstFace;
+            if (!current.mesh.indices.empty()) {
+                shapes->push_back(std::move(current));
+                current = tinyobj::shape_t();
+            }
+            current.name = segment.name;
+        }
+        flush(chunk, material_ids, face, chunk.faceMaterials.size());
+        if (!chunk.materialNames.empty()) {
+            current_material = material_ids.back();
+        }
+    }
+    if (!current.mesh.indices.empty()) {
+        shapes->push_back(std::move(current));
+    }
+
+    return true;
+}
+
+static const size_t STREAM_WINDOW = 8 << 20;
+
+// Parser state of streamObjNative carried from line to line and window to window
+struct ObjStream {
+    ObjModel& model;
+    const ObjChunkSink& sink;
+    size_t chunkTriangles;
+    size_t memoryLimit;
+    std::string baseDir;
+    std::map<std::string, int> materialMap;
+    tinyobj::shape_t chunk;
+    std::string shapeName;
+    size_t shapeTriangles = 0;
+    int material = -1;
+    std::vector<tinyobj::index_t> face;
+    std::string warn;
+};
+
+static size_t streamBytes(const ObjStream& stream) {
+    const tinyobj::attrib_t& attrib = stream.model.attrib;
+    return STREAM_WINDOW + (attrib.vertices.capacity() + attrib.normals.capacity()) * sizeof(float)
+           + stream.chunk.mesh.indices.capacity() * sizeof(tinyobj::index_t);
+}
+
+// Grows a table for three more floats the way push_back would, but never past the memory limit
+static bool growTable(const ObjStream& stream, std::vector<float>& table) {
+    if (table.size() + 3 <= table.capacity()) return true;
+    size_t capacity = std::max<size_t>(3 << 10, table.capacity() * 2);
+    if (stream.memoryLimit > 0) {
+        size_t used = streamBytes(stream) - table.capacity() * sizeof(float);
+        size_t room = stream.memoryLimit > used ? (stream.memoryLimit - used) / sizeof(float) : 0;
+        capacity = std::min(capacity, room / 3 * 3);
+        if (capacity < table.size() + 3) return false;
+    }
+    table.reserve(capacity);
+    return true;
+}
+
+static int flushStreamChunk(ObjStream& stream) {
+    if (stream.chunk.mesh.indices.empty()) return 0;
+    stream.chunk.name = stream.shapeName;
+    stream.chunk.mesh.material_ids.assign(1, stream.material);
+    int ret = stream.sink(stream.model.attrib, stream.chunk);
+    stream.chunk.mesh.indices.clear();
+    return ret;
+}
+
+static int endStreamShape(ObjStream& stream) {
+    int ret = flushStreamChunk(stream);
+    if (stream.shapeTriangles > 0) {
+        stream.model.shapeFaces.push_back({stream.shapeName, stream.shapeTriangles});
+    }
+    stream.shapeTriangles = 0;
+    return ret;
+}
+
+// Like parseFace, but every reference resolves against the elements read so
+// far and has to point at one of them
+static bool parseStreamFace(ObjStream& stream, const char* p, const char* end) {
+    const ObjModel& model = stream.model;
+    int counts[3] = {(int)(model.attrib.vertices.size() / 3), (int)model.texcoordCount, (int)(model.attrib.normals.size() / 3)};
+    std::vector<tinyobj::index_t>& face = stream.face;
+    face.clear();
+    for (;;) {
+        p = skipSpaces(p, end);
+        if (p >= end) break;
+        int resolved[3] = {-1, -1, -1};
+        for (int field = 0; field < 3; field++) {
+            if (field > 0) {
+                if (p >= end || *p != '/') break;
+                p++;
+                if (field == 1 && p < end && *p == '/') continue;
+            }
+            int value;
+            p = parseInt(p, end, value);
+            if (!p || value == 0) return false;
+            resolved[field] = value > 0 ? value - 1 : counts[field] + value;
+            if (resolved[field] < 0 || resolved[field] >= counts[field]) return false;
+        }
+        if (p < end && !isSpace(*p)) return false;
+        // texcoords are not kept, so they must not split vertices either
+        tinyobj::index_t idx;
+        idx.vertex_index = resolved[0];
+        idx.normal_index = resolved[2];
+        idx.texcoord_index = -1;
+        face.push_back(idx);
+    }
+
+    std::vector<tinyobj::index_t>& indices = stream.chunk.mesh.indices;
+    for (size_t i = 1; i + 1 < face.size(); i++) {
+        indices.push_back(face[0]);
+        indices.push_back(face[i]);
+        indices.push_back(face[i + 1]);
+        stream.shapeTriangles++;
+    }
+    return true;
+}
+
+static int parseStreamLines(ObjStream& stream, const char* p, const char* end) {
+    tinyobj::attrib_t& attrib = stream.model.attrib;
+    while (p < end) {
+        const char* line_end = (const char*)std::memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+
+        const char* q = skipSpaces(p, line_end);
+        if (q < line_end) {
+            char c0 = q[0];
+            char c1 = q + 1 < line_end ? q[1] : '\0';
+            bool ok = true;
+            if (c0 == '#') {
+                stream.model.comments.push_back(std::string(q + 1, line_end > q + 1 && line_end[-1] == '\r' ? line_end - 1 : line_end));
+            } else if (c0 == 'v' && (isSpace(c1) || (c1 == 'n' && q + 2 < line_end && isSpace(q[2])))) {
+                std::vector<float>& table = isSpace(c1) ? attrib.vertices : attrib.normals;
+                float x = 0, y = 0, z = 0;
+                q = parseFloat(q + (isSpace(c1) ? 1 : 2), line_end, x);
+                if (q) q = parseFloat(q, line_end, y);
+                if (q) q = parseFloat(q, line_end, z);
+                ok = q != nullptr;
+                if (!growTable(stream, table)) {
+                    std::cerr << "Error: " << stream.model.filename << " needs more than memory-limit for its vertex tables ("
+                              << attrib.vertices.size() / 3 << " positions, " << attrib.normals.size() / 3 << " normals read)\n";
+                    return 1;
+                }
+                table.insert(table.end(), {x, y, z});
+            } else if (c0 == 'v' && c1 == 't' && q + 2 < line_end && isSpace(q[2])) {
+                stream.model.texcoordCount++;
+            } else if (c0 == 'f' && isSpace(c1)) {
+                ok = parseStreamFace(stream, q + 1, line_end);
+                if (stream.chunk.mesh.indices.size() >= stream.chunkTriangles * 3 && flushStreamChunk(stream) != 0) {
+                    return 1;
+                }
+            } else if ((c0 == 'o' || c0 == 'g') && (isSpace(c1) || q + 1 == line_end)) {
+                if (endStreamShape(stream) != 0) return 1;
+                stream.shapeName = restOfLine(q + 1, line_end);
+            } else if (line_end - q > 6 && std::strncmp(q, "usemtl", 6) == 0 && isSpace(q[6])) {
+                std::string name = restOfLine(q + 6, line_end);
+                auto it = stream.materialMap.find(name);
+                if (it == stream.materialMap.end()) {
+                    stream.warn += "material [ '" + name + "' ] not found in .mtl\n";
+                }
+                int material = it == stream.materialMap.end() ? -1 : it->second;
+                if (material != stream.material) {
+                    if (flushStreamChunk(stream) != 0) return 1;
+                    stream.material = material;
+                }
+            } else if (line_end - q > 6 && std::strncmp(q, "mtllib", 6) == 0 && isSpace(q[6])) {
+                std::string mtllib = restOfLine(q + 6, line_end);
+                std::ifstream mtl_file(stream.baseDir + mtllib);
+                if (!mtl_file) {
+                    stream.warn += "Material file [ " + stream.baseDir + mtllib + " ] not found.\n";
+                } else {
+                    std::string err;
+                    tinyobj::LoadMtl(&stream.materialMap, &stream.model.materials, &mtl_file, &stream.warn, &err);
+                    stream.warn += err;
+                }
+            }
+            if (!ok) {
+                stream.warn += "Failed to parse line: " + std::string(p, line_end) + "\n";
+            }
+        }
+        p = line_end + 1;
+    }
+    return 0;
+}
+
+int streamObjNative(const std::string& filename, size_t chunk_triangles, size_t memory_limit, ObjModel& model, const ObjChunkSink& sink) {
+    model.filename = filename;
+    ObjStream stream{model, sink, std::max<size_t>(1, chunk_triangles), memory_limit, baseDir(filename)};
+    if (memory_limit > 0 && streamBytes(stream) + chunk_triangles * 3 * sizeof(tinyobj::index_t) > memory_limit) {
+        std::cerr << "Error: memory-limit is too small to stream " << filename << std::endl;
+        return 1;
+    }
+    stream.chunk.mesh.indices.reserve(stream.chunkTriangles * 3 + 3);
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Failed to open OBJ file: " << filename << std::endl;
+        return 1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // the unfinished last line of a window moves to the front of the next one
+    std::vector<char> window(STREAM_WINDOW);
+    size_t filled = 0;
+    off_t offset = 0;
+    int ret = 0;
+    for (;;) {
+        ssize_t count = ::read(fd, window.data() + filled, window.size() - filled);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            std::cerr << "Error: Failed to read OBJ file: " << filename << std::endl;
+            ret = 1;
+            break;
+        }
+        traceCount(TraceCounter::BytesRead, count);
+        offset += count;
+        filled += (size_t)count;
+        bool eof = count == 0;
+        const char* begin = window.data();
+        const char* lines_end = begin + filled;
+        if (!eof) {
+            const char* newline = (const char*)memrchr(begin, '\n', filled);
+            if (!newline) {
+                if (filled < window.size()) continue;
+                std::cerr << "Error: Line longer than " << (STREAM_WINDOW >> 20) << " MiB in " << filename << std::endl;
+                ret = 1;
+                break;
+            }
+            lines_end = newline + 1;
+        }
+        if (parseStreamLines(stream, begin, lines_end) != 0) {
+            ret = 1;
+            break;
+        }
+        filled = (size_t)(begin + filled - lines_end);
+        std::memmove(window.data(), lines_end, filled);
+        // parsed pages are never read again, keep them from crowding out the rest of the page cache
+        posix_fadvise(fd, 0, offset - (off_t)filled, POSIX_FADV_DONTNEED);
+        if (eof) break;
+    }
+    ::close(fd);
+    if (ret == 0) {
+        ret = endStreamShape(stream);
+    }
+    if (!stream.warn.empty()) std::cout << "Error: " << stream.warn << std::endl;
+
+    model.vertexCount = model.attrib.vertices.size() / 3;
+    model.normalCount = model.attrib.normals.size() / 3;
+    return ret;
+}
+
+std::vector<std::string> readObjComments(const std::string& filename) {
+    TRACE_SCOPE("comment_scan");
+    std::vector<std::string> comments;
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open OBJ file for reading comments: " << filename << std::endl;
+        return comments;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        traceCount(TraceCounter::BytesRead, (int64_t)line.size() + 1);
+        if (!line.empty() && line[0] == '#') {
+            comments.push_back(line.substr(1));
+        }
+    }
+    return comments;
+}
+
+int loadModel(const std::string& filename, ObjParser parser, int threads, ObjModel& model) {
+    model.filename = filename;
+    std::string warn, err;
+    bool ret;
+    TRACE_SCOPE("parse", filename);
+    auto parse_start = std::chrono::steady_clock::now();
+    if (parser == ObjParser::Native) {
+        ret = loadObjNative(&model.attrib, &model.shapes, &model.materials, &model.comments, &warn, &err, filename, threads);
+    } else {
+        ret = tinyobj::LoadObj(&model.attrib, &model.shapes, &model.materials, &warn, &err, filename.c_str());
+        struct stat info;
+        if (stat(filename.c_str(), &info) == 0) {
+            traceCount(TraceCounter::BytesRead, (int64_t)info.st_size);
+        }
+        if (ret) {
+            model.comments = readObjComments(filename);
+        }
+    }
+    std::cout << "Parsed " << filename << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parse_start).count() << " ms\n";
+    if (!warn.empty()) std::cout << "Error: " << warn << std::endl;
+    if (!err.empty()) std::cerr << "Error: " << err << std::endl;
+    if (!ret) {
+        std::cerr << "Error: Failed to load/parse OBJ file: " << filename << std::endl;
+        return 1;
+    }
+
+    model.vertexCount = model.attrib.vertices.size() / 3;
+    model.normalCount = model.attrib.normals.size() / 3;
+    model.texcoordCount = model.attrib.texcoords.size() / 2;
+    for (const auto& shape : model.shapes) {
+        model.shapeFaces.push_back({shape.name, shape.mesh.num_face_vertices.size()});
+    }
+    return 0;
+}
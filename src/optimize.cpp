@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "cpp_obj-preview/optimize.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+static const int VERTEX_CACHE_SIZE = 16;
+// the pieces of one large batch spread over the threads and mostly fit 16-bit indices,
+// fixed so the stream does not depend on the thread count
+static const uint64_t PIECE_TRIANGLES = 1 << 16;
+
+uint32_t packNormal(float x, float y, float z) {
+    auto snorm10 = [](float value) {
+        int quantized = (int)std::round(std::max(-1.0f, std::min(1.0f, value)) * 511.0f);
+        return (uint32_t)quantized & 0x3FF;
+    };
+    return snorm10(x) | (snorm10(y) << 10) | (snorm10(z) << 20);
+}
+
+std::vector<uint32_t> tipsify(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size) {
+    size_t triangle_count = indices.size() / 3;
+
+    // triangles around every vertex, as offsets into one list
+    std::vector<uint32_t> live(vertex_count, 0);
+    for (uint32_t index : indices) live[index]++;
+    std::vector<size_t> adjacency_start(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; v++) adjacency_start[v + 1] = adjacency_start[v] + live[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<size_t> fill(adjacency_start.begin(), adjacency_start.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    std::vector<uint64_t> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_end;
+    std::vector<uint32_t> candidates;
+    uint64_t timestamp = (uint64_t)cache_size + 1;
+    size_t cursor = 0;
+    int64_t fanning = vertex_count > 0 ? 0 : -1;
+
+    while (fanning >= 0) {
+        candidates.clear();
+        for (size_t a = adjacency_start[fanning]; a < adjacency_start[fanning + 1]; a++) {
+            uint32_t triangle = adjacency[a];
+            if (emitted[triangle]) continue;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[3 * triangle + k];
+                output.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (timestamp - cache_time[v] > (uint64_t)cache_size) {
+                    cache_time[v] = timestamp++;
+                }
+            }
+            emitted[triangle] = true;
+        }
+
+        // prefer the candidate that stays in cache longest while its fan is emitted
+        fanning = -1;
+        int64_t best_priority = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) continue;
+            int64_t priority = 0;
+            if (timestamp - cache_time[v] + 2 * live[v] <= (uint64_t)cache_size) {
+                priority = (int64_t)(timestamp - cache_time[v]);
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                fanning = v;
+            }
+        }
+        if (fanning >= 0) continue;
+
+        while (!dead_end.empty() && fanning < 0) {
+            uint32_t v = dead_end.back();
+            dead_end.pop_back();
+            if (live[v] > 0) fanning = v;
+        }
+        while (fanning < 0 && cursor < vertex_count) {
+            if (live[cursor] > 0) fanning = (int64_t)cursor;
+            cursor++;
+        }
+    }
+    return output;
+}
+
+double averageCacheMissRatio(const std::vector<uint32_t>& indices, size_t vertex_count, int cache_size) {
+    if (indices.empty()) return 0.0;
+    std::vector<uint64_t> inserted(vertex_count, 0);
+    uint64_t time = (uint64_t)cache_size + 1;
+    size_t misses = 0;
+    for (uint32_t v : indices) {
+        if (time - inserted[v] > (uint64_t)cache_size) {
+            inserted[v] = time++;
+            misses++;
+        }
+    }
+    return (double)misses / (double)(indices.size() / 3);
+}
+
+struct OptimizedBatch {
+    std::vector<GpuVertex> vertices;
+    std::vector<float> texcoords;
+    std::vector<uint32_t> indices;
+};
+
+static void optimizeBatch(const MeshArena& arena, const MeshBatch& batch, bool texcoords, OptimizedBatch& out) {
+    // renumber the batch's vertices locally
+    std::vector<uint32_t> local_vertices;
+    std::vector<uint32_t> local_indices(batch.indexCount);
+    {
+        std::vector<uint32_t> sorted(arena.indices + batch.indexOffset, arena.indices + batch.indexOffset + batch.indexCount);
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        local_vertices.swap(sorted);
+        for (uint64_t i = 0; i < batch.indexCount; i++) {
+            uint32_t vertex = arena.indices[batch.indexOffset + i];
+            local_indices[i] = (uint32_t)(std::lower_bound(local_vertices.begin(), local_vertices.end(), vertex) - local_vertices.begin());
+        }
+    }
+
+    std::vector<uint32_t> ordered = tipsify(local_indices, local_vertices.size(), VERTEX_CACHE_SIZE);
+
+    // vertices in the order the reordered triangles first touch them
+    const uint32_t unassigned = UINT32_MAX;
+    std::vector<uint32_t> remap(local_vertices.size(), unassigned);
+    out.vertices.reserve(local_vertices.size());
+    out.indices.resize(ordered.size());
+    for (size_t i = 0; i < ordered.size(); i++) {
+        uint32_t v = ordered[i];
+        if (remap[v] == unassigned) {
+            remap[v] = (uint32_t)out.vertices.size();
+            const float* source = arena.vertices + (size_t)local_vertices[v] * 8;
+            GpuVertex vertex;
+            std::memcpy(vertex.position, source, sizeof(vertex.position));
+            vertex.normal = packNormal(source[3], source[4], source[5]);
+            out.vertices.push_back(vertex);
+            if (texcoords) {
+                out.texcoords.insert(out.texcoords.end(), source + 6, source + 8);
+            }
+        }
+        out.indices[i] = remap[v];
+    }
+}
+
+GpuMeshes optimizeMeshes(const MeshArena& arena, bool texcoords, int threads) {
+    TRACE_SCOPE("optimize");
+    std::vector<MeshBatch> pieces;
+    for (size_t i = 0; i < arena.batchCount; i++) {
+        const MeshBatch& batch = arena.batches[i];
+        for (uint64_t first = 0; first < batch.indexCount; first += PIECE_TRIANGLES * 3) {
+            pieces.push_back({batch.materialId, 0, batch.indexOffset + first, std::min(PIECE_TRIANGLES * 3, batch.indexCount - first)});
+        }
+    }
+    std::vector<OptimizedBatch> optimized(pieces.size());
+    parallelFor(pieces.size(), threads, [&](size_t i) {
+        optimizeBatch(arena, pieces[i], texcoords, optimized[i]);
+    });
+
+    GpuMeshes meshes;
+    size_t vertex_total = 0, index_bytes = 0;
+    for (const auto& batch : optimized) {
+        vertex_total += batch.vertices.size();
+        index_bytes += batch.indices.size() * 4;
+    }
+    meshes.vertices.reserve(vertex_total);
+    meshes.texcoords.reserve(texcoords ? vertex_total * 2 : 0);
+    meshes.indices.reserve(index_bytes);
+    for (size_t i = 0; i < optimized.size(); i++) {
+        const OptimizedBatch& batch = optimized[i];
+        if (batch.indices.empty()) continue;
+        bool narrow = batch.vertices.size() < 65536;
+        size_t width = narrow ? sizeof(uint16_t) : sizeof(uint32_t);
+        // keep wide indices aligned after a run of narrow ones
+        size_t offset = (meshes.indices.size() + width - 1) / width * width;
+        meshes.indices.resize(offset + batch.indices.size() * width);
+        uint8_t* target = meshes.indices.data() + offset;
+        for (size_t j = 0; j < batch.indices.size(); j++) {
+            if (narrow) {
+                uint16_t index = (uint16_t)batch.indices[j];
+                std::memcpy(target + j * width, &index, width);
+            } else {
+                std::memcpy(target + j * width, &batch.indices[j], width);
+            }
+        }
+        meshes.batches.push_back({pieces[i].materialId, narrow ? (uint32_t)GL_UNSIGNED_SHORT : (uint32_t)GL_UNSIGNED_INT, offset,
+                                  batch.indices.size(), (int32_t)meshes.vertices.size(), 0});
+        meshes.vertices.insert(meshes.vertices.end(), batch.vertices.begin(), batch.vertices.end());
+        meshes.texcoords.insert(meshes.texcoords.end(), batch.texcoords.begin(), batch.texcoords.end());
+    }
+    return meshes;
+}
+
+GpuArena GpuMeshes::arena() const {
+    return {vertices.data(), vertices.size(), texcoords.empty() ? nullptr : texcoords.data(), indices.data(), indices.size(), batches.data(),
+            batches.size()};
+}
@@ -0,0 +1,92 @@
+#include "cpp_obj-preview/overview.h"
+#include "cpp_obj-preview/trace.h"
+
+int openGifOutput(GifOutput& output, const std::string& path, const RenderFormat& format, const GifOutputOptions& options, FrameSink& sink) {
+    int gif_scale = options.scale;
+    int width = format.width;
+    int height = format.height;
+    int out_width = width / gif_scale;
+    int out_height = height / gif_scale;
+    FramePipeline::Stage stage;
+    FramePipeline::Writer writer;
+    output.ffmpeg = options.ffmpeg;
+    if (options.ffmpeg) {
+        stage = [=](FrameJob& job) {
+            TRACE_SCOPE("encode_frame");
+            const unsigned char* pixels = job.pixels.data();
+            if (gif_scale > 1) {
+                downscaleFrame(pixels, width, height, gif_scale, job.scaled);
+                pixels = job.scaled.data();
+            }
+            return saveFrameAsPPM(job.frame, pixels, out_width, out_height);
+        };
+        writer = [](int frame, const std::vector<uint8_t>& output) {
+            return 0;
+        };
+    } else {
+        if (!output.gif.open(path, out_width, out_height, format.fps, options.dither, true)) {
+            return 1;
+        }
+        GifEncoder& gif = output.gif;
+        stage = [&gif, gif_scale, width, height](FrameJob& job) {
+            TRACE_SCOPE("encode_frame");
+            const unsigned char* pixels = job.pixels.data();
+            if (gif_scale > 1) {
+                downscaleFrame(pixels, width, height, gif_scale, job.scaled);
+                pixels = job.scaled.data();
+            }
+            gif.quantize(pixels, job.indices, job.scratch);
+            gif.compress(job.indices, job.output, job.scratch);
+            return 0;
+        };
+        writer = [&gif](int frame, const std::vector<uint8_t>& output) {
+            TRACE_SCOPE("write_frame");
+            return gif.writeFrame(output) ? 0 : 1;
+        };
+    }
+
+    output.pipeline.reset(new FramePipeline((size_t)width * height * 3, options.workers, options.queueDepth, stage, writer));
+    bool use_ffmpeg = options.ffmpeg;
+    sink = [&output, use_ffmpeg, gif_scale, width, height](int frame, const unsigned char* pixels) {
+        if (!use_ffmpeg && !output.gif.hasPalette()) {
+            TRACE_SCOPE("palette");
+            if (gif_scale > 1) {
+                downscaleFrame(pixels, width, height, gif_scale, output.paletteFrame);
+                output.gif.buildPalette(output.paletteFrame.data());
+            } else {
+                output.gif.buildPalette(pixels);
+            }
+        }
+        return output.pipeline->push(frame, pixels);
+    };
+    return 0;
+}
+
+int closeGifOutput(GifOutput& output) {
+    if (!output.pipeline) {
+        return 0;
+    }
+    int ret = output.pipeline->finish();
+    output.pipeline.reset();
+    if (!output.ffmpeg && !output.gif.close()) {
+        ret = 1;
+    }
+    return ret;
+}
+
+FrameSink firstFrameSink(const FrameSink& next, int width, int height, bool halve, std::vector<unsigned char>& buffer,
+                         const std::function<int(const unsigned char* pixels, int width, int height)>& publish) {
+    return [&buffer, next, width, height, halve, publish](int frame, const unsigned char* pixels) {
+        if (frame == 0) {
+            if (halve && width >= 2 && height >= 2) {
+                downscaleFrame(pixels, width, height, 2, buffer);
+                if (publish(buffer.data(), width / 2, height / 2) != 0) {
+                    return 1;
+                }
+            } else if (publish(pixels, width, height) != 0) {
+                return 1;
+            }
+        }
+        return next(frame, pixels);
+    };
+}
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "cpp_obj-preview/pipeline.h"
+
+static const int SPINS_BEFORE_SLEEP = 64;
+
+static void backoff(int& spins) {
+    if (++spins < SPINS_BEFORE_SLEEP) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+FramePipeline::FramePipeline(size_t frameSize, int workers, int depth, Stage stage, Writer writer)
+    : frameSize(frameSize), stage(stage), writer(writer), jobs(depth + workers), freeJobs(depth + workers), pendingJobs(depth),
+      done(false), failed(false), reorder(depth + workers, nullptr), nextFrame(0) {
+    for (auto& job : jobs) {
+        job.pixels.resize(frameSize);
+        freeJobs.tryPush(&job);
+    }
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(&FramePipeline::work, this);
+    }
+}
+
+FramePipeline::~FramePipeline() {
+    finish();
+}
+
+int FramePipeline::push(int frame, const unsigned char* pixels) {
+    if (failed.load()) return 1;
+
+    FrameJob* job = nullptr;
+    int spins = 0;
+    while (!freeJobs.tryPop(job)) {
+        if (failed.load()) return 1;
+        backoff(spins);
+    }
+    job->frame = frame;
+    std::memcpy(job->pixels.data(), pixels, frameSize);
+
+    spins = 0;
+    while (!pendingJobs.tryPush(job)) {
+        backoff(spins);
+    }
+    return 0;
+}
+
+int FramePipeline::finish() {
+    done.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    bool waiting = std::any_of(reorder.begin(), reorder.end(), [](FrameJob* job) { return job != nullptr; });
+    if (waiting && !failed.load()) {
+        std::cerr << "Error: Frame " << nextFrame << " never reached the frame pipeline\n";
+        failed.store(true);
+    }
+    return failed.load() ? 1 : 0;
+}
+
+void FramePipeline::work() {
+    int spins = 0;
+    for (;;) {
+        FrameJob* job = nullptr;
+        if (!pendingJobs.tryPop(job)) {
+            if (done.load()) {
+                if (!pendingJobs.tryPop(job)) return;
+            } else {
+                backoff(spins);
+                continue;
+            }
+        }
+        spins = 0;
+        if (!failed.load() && stage(*job) != 0) {
+            std::cerr << "Error: Failed to process frame " << job->frame << std::endl;
+            failed.store(true);
+        }
+        complete(job);
+    }
+}
+
+void FramePipeline::complete(FrameJob* job) {
+    std::lock_guard<std::mutex> lock(orderMutex);
+    reorder[(size_t)job->frame % reorder.size()] = job;
+    for (;;) {
+        FrameJob*& slot = reorder[(size_t)nextFrame % reorder.size()];
+        if (!slot || slot->frame != nextFrame) break;
+        FrameJob* ready = slot;
+        slot = nullptr;
+        if (!failed.load() && writer(ready->frame, ready->output) != 0) {
+            std::cerr << "Error: Failed to write frame " << ready->frame << std::endl;
+            failed.store(true);
+        }
+        nextFrame++;
+        freeJobs.tryPush(ready);
+    }
+}
+
+void downscaleFrame(const unsigned char* pixels, int width, int height, int factor, std::vector<unsigned char>& out) {
+    int out_width = width / factor;
+    int out_height = height / factor;
+    out.resize((size_t)out_width * out_height * 3);
+    int area = factor * factor;
+    for (int y = 0; y < out_height; y++) {
+        unsigned char* dst = out.data() + (size_t)y * out_width * 3;
+        for (int x = 0; x < out_width; x++) {
+            int sum[3] = {0, 0, 0};
+            for (int dy = 0; dy < factor; dy++) {
+                const unsigned char* src = pixels + ((size_t)(y * factor + dy) * width + (size_t)x * factor) * 3;
+                for (int dx = 0; dx < factor; dx++) {
+                    sum[0] += src[3 * dx + 0];
+                    sum[1] += src[3 * dx + 1];
+                    sum[2] += src[3 * dx + 2];
+                }
+            }
+            dst[3 * x + 0] = (unsigned char)((sum[0] + area / 2) / area);
+            dst[3 * x + 1] = (unsigned char)((sum[1] + area / 2) / area);
+            dst[3 * x + 2] = (unsigned char)((sum[2] + area / 2) / area);
+        }
+    }
+}
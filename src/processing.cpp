@@ -7,19 +7,58 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <sstream>
-#include <iomanip>
+#include <cstdio>
 #include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/optimize.h"
+#include "cpp_obj-preview/normals.h"
+#include "cpp_obj-preview/trace.h"
+
+// Open addressing table from packed (vertex, normal, texcoord) triples to output vertex ids
+class IndexTable {
+public:
+    IndexTable() : mask(0) {}
+
+    // Empties the table and sizes it for expected triples, the storage of a larger earlier use is kept
+    void reset(size_t expected) {
+        size_t size = 16;
+        while (size < expected * 2) size <<= 1;
+        keys.assign(size, {-1, -1, -1});
+        values.resize(size);
+        mask = size - 1;
+    }
 
-struct IndexLess {
-    bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
-        if (a.vertex_index != b.vertex_index)
-            return a.vertex_index < b.vertex_index;
-        if (a.normal_index != b.normal_index)
-            return a.normal_index < b.normal_index;
-        return a.texcoord_index < b.texcoord_index;
+    // Returns the id stored for idx, inserting next_id when the triple is new
+    unsigned int insert(const tinyobj::index_t& idx, unsigned int next_id, bool& inserted) {
+        uint64_t h = (uint64_t)(uint32_t)idx.vertex_index * 0x9E3779B97F4A7C15ull;
+        h ^= (uint64_t)(uint32_t)idx.normal_index * 0xC2B2AE3D27D4EB4Full;
+        h ^= (uint64_t)(uint32_t)idx.texcoord_index * 0x165667B19E3779F9ull;
+        size_t slot = (size_t)(h ^ (h >> 29)) & mask;
+        for (;;) {
+            tinyobj::index_t& key = keys[slot];
+            if (key.vertex_index == -1) {
+                key = idx;
+                values[slot] = next_id;
+                inserted = true;
+                return next_id;
+            }
+            if (key.vertex_index == idx.vertex_index && key.normal_index == idx.normal_index && key.texcoord_index == idx.texcoord_index) {
+                inserted = false;
+                return values[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
     }
+
+private:
+    std::vector<tinyobj::index_t> keys;
+    std::vector<unsigned int> values;
+    size_t mask;
 };
 
 Shader::Shader() {
@@ -47,6 +86,10 @@ Shader::Shader() {
     glAttachShader(ID, fragment);
     glLinkProgram(ID);
     glGetProgramiv(ID, GL_LINK_STATUS, &success); 
+    GLuint material_block = glGetUniformBlockIndex(ID, "Material");
+    if (material_block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(ID, material_block, MATERIAL_BINDING);
+    }
     glDeleteShader(vertex);
     glDeleteShader(fragment);
 }
@@ -55,123 +98,225 @@ void Shader::use() const {
     glUseProgram(ID);
 }
 
+GLint Shader::uniformLocation(const std::string& name) const {
+    auto it = uniformLocations.find(name);
+    if (it != uniformLocations.end()) {
+        return it->second;
+    }
+    GLint location = glGetUniformLocation(ID, name.c_str());
+    uniformLocations.emplace(name, location);
+    return location;
+}
+
 void Shader::setBool(const std::string& name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(uniformLocation(name), (int)value);
 }
 void Shader::setInt(const std::string& name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(uniformLocation(name), value);
 }
 void Shader::setFloat(const std::string& name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(uniformLocation(name), value);
 }
 void Shader::setVec3(const std::string& name, const glm::vec3& value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(uniformLocation(name), 1, &value[0]);
 }
 void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const {
-    GLint location = glGetUniformLocation(ID, name.c_str());
+    GLint location = uniformLocation(name);
     if (location != -1) {
         glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(mat));
     }
 }
+void Shader::setMat4Array(const std::string& name, const glm::mat4* mats, int count) const {
+    GLint location = uniformLocation(name);
+    if (location != -1) {
+        glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(mats[0]));
+    }
+}
 
-std::tuple<glm::vec3, glm::vec3> getBoundingBox(const tinyobj::attrib_t& attrib) {
-    glm::vec3 bbox_min(FLT_MAX);
-    glm::vec3 bbox_max(-FLT_MAX);
+int saveFrameAsPPM(int frame, const unsigned char* pixels, int width, int height) {
+    char filename[32];
+    std::snprintf(filename, sizeof(filename), "frame_%03d.ppm", frame);
 
-    for (size_t i = 0; i < attrib.vertices.size() / 3; i++) {
-        float x = attrib.vertices[3 * i + 0];
-        float y = attrib.vertices[3 * i + 1];
-        float z = attrib.vertices[3 * i + 2];
+    FILE* out = std::fopen(filename, "wb");
+    if (!out) {
+        std::cerr << "Error: Could not open file " << filename << " for writing.\n";
+        return 1;
+    }
 
-        if (x < bbox_min.x) bbox_min.x = x;
-        if (y < bbox_min.y) bbox_min.y = y;
-        if (z < bbox_min.z) bbox_min.z = z;
+    bool ok = std::fprintf(out, "P6\n%d %d\n255\n", width, height) > 0;
+    for (int y = height - 1; y >= 0 && ok; --y) {
+        const unsigned char* row = &pixels[(size_t)y * width * 3];
+        ok = std::fwrite(row, 1, (size_t)width * 3, out) == (size_t)width * 3;
+    }
+    ok = std::fclose(out) == 0 && ok;
+    if (!ok) {
+        std::cerr << "Error: Could not write file " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
-        if (x > bbox_max.x) bbox_max.x = x;
-        if (y > bbox_max.y) bbox_max.y = y;
-        if (z > bbox_max.z) bbox_max.z = z;
+ReadbackRing::ReadbackRing(int width, int height, int count) : buffers(count), fences(count, nullptr), frames(count, -1), width(width), height(height), head(0), pending(0), waitTime(0.0) {
+    glGenBuffers(count, buffers.data());
+    for (GLuint buffer : buffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 3, nullptr, GL_STREAM_READ);
     }
-    return std::make_tuple(bbox_min, bbox_max);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 }
 
-void centerizeModel(tinyobj::attrib_t& attrib, glm::vec3& bbox_center) {
-    for (size_t i = 0; i < attrib.vertices.size() / 3; i++) {
-        attrib.vertices[3 * i + 0] -= bbox_center.x;
-        attrib.vertices[3 * i + 1] -= bbox_center.y;
-        attrib.vertices[3 * i + 2] -= bbox_center.z;
+ReadbackRing::~ReadbackRing() {
+    for (GLsync fence : fences) {
+        if (fence) glDeleteSync(fence);
     }
+    glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
 }
 
-void saveFrameAsPPM(int frame, const std::vector<unsigned char>& pixels, int width, int height) {
-    std::ostringstream filename;
-    filename << "frame_" << std::setw(3) << std::setfill('0') << frame << ".ppm";
+int ReadbackRing::submit(int frame, const FrameSink& sink) {
+    if (pending == (int)buffers.size() && consume(sink) != 0) {
+        return 1;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[head]);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frames[head] = frame;
+    head = (head + 1) % (int)buffers.size();
+    pending++;
+    return 0;
+}
 
-    std::ofstream out(filename.str(), std::ios::binary);
-    if (!out) {
-        std::cerr << "Error: Could not open file " << filename.str() << " for writing.\n";
-        return;
+int ReadbackRing::flush(const FrameSink& sink) {
+    while (pending > 0) {
+        if (consume(sink) != 0) return 1;
     }
+    return 0;
+}
 
-    out << "P6\n" << width << " " << height << "\n255\n";
+double ReadbackRing::waitSeconds() const {
+    return waitTime;
+}
 
-    for (int y = height - 1; y >= 0; --y) {
-        const unsigned char* row = &pixels[y * width * 3];
-        out.write(reinterpret_cast<const char*>(row), width * 3);
+int ReadbackRing::consume(const FrameSink& sink) {
+    int slot = (head - pending + (int)buffers.size()) % (int)buffers.size();
+
+    auto wait_start = std::chrono::steady_clock::now();
+    GLenum status;
+    {
+        TRACE_SCOPE("readback_wait");
+        status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        while (status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(fences[slot], 0, 1000000000ull);
+        }
     }
-    out.close();
+    waitTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+    glDeleteSync(fences[slot]);
+    fences[slot] = nullptr;
+    pending--;
+    if (status == GL_WAIT_FAILED) {
+        std::cerr << "Error: Failed to wait for frame " << frames[slot] << " readback\n";
+        return 1;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+    const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * 3, GL_MAP_READ_BIT);
+    int ret = 1;
+    if (pixels) {
+        traceCount(TraceCounter::FramesReadBack, 1);
+        ret = sink(frames[slot], pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        std::cerr << "Error: Failed to map frame " << frames[slot] << " readback buffer\n";
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (ret != 0) {
+        std::cerr << "Error: Failed to store frame " << frames[slot] << std::endl;
+    }
+    return ret;
 }
 
-void drawModel(const std::vector<MeshGL>& meshes, const std::vector<tinyobj::material_t>& materials, Shader& shader) {
-    for (const auto& mesh : meshes) {
-        glBindVertexArray(mesh.vao);
-        if (mesh.materialId >= 0 && mesh.materialId < (int)materials.size()) {
-            const auto& mat = materials[mesh.materialId];
-            shader.setVec3("material.ambient", glm::vec3(mat.ambient[0], mat.ambient[1], mat.ambient[2]));
-            shader.setVec3("material.diffuse", glm::vec3(mat.diffuse[0], mat.diffuse[1], mat.diffuse[2]));
-            shader.setVec3("material.specular", glm::vec3(mat.specular[0], mat.specular[1], mat.specular[2]));
-            shader.setFloat("material.shininess", mat.shininess);
+MaterialBuffer createMaterialBuffer(const std::vector<tinyobj::material_t>& materials, const std::vector<GLuint>& textures) {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    GLsizeiptr block_size = 12 * sizeof(float);
+    GLsizeiptr stride = (block_size + alignment - 1) / alignment * alignment;
+
+    int count = (int)materials.size() + 1;
+    std::vector<unsigned char> data((size_t)(stride * count), 0);
+    std::vector<GLuint> block_textures(count, 0);
+    for (int i = 0; i < count; i++) {
+        float* block = (float*)&data[(size_t)(i * stride)];
+        if (i < (int)materials.size()) {
+            const auto& mat = materials[i];
+            for (int c = 0; c < 3; c++) {
+                block[0 + c] = mat.ambient[c];
+                block[4 + c] = mat.diffuse[c];
+                block[8 + c] = mat.specular[c];
+            }
+            block[11] = mat.shininess;
+            if (i < (int)textures.size() && textures[i] != 0) {
+                block_textures[i] = textures[i];
+                block[7] = 1.0f;
+            }
         } else {
-            shader.setVec3("material.ambient", glm::vec3(0.5f));
-            shader.setVec3("material.diffuse", glm::vec3(0.5f));
-            shader.setVec3("material.specular", glm::vec3(0.5f));
-            shader.setFloat("material.shininess", 0.5f);
+            for (int c = 0; c < 3; c++) {
+                block[0 + c] = block[4 + c] = block[8 + c] = DEFAULT_MATERIAL_COLOR[c];
+            }
+            block[11] = DEFAULT_MATERIAL_SHININESS;
+        }
+    }
+
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)data.size(), data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return {ubo, stride, count, block_textures};
+}
+
+void drawModel(const std::vector<MeshGL>& meshes, const MaterialBuffer& materials, int instances) {
+    if (meshes.empty()) return;
+    traceCount(TraceCounter::DrawCalls, (int64_t)meshes.size());
+    // batches of one arena share a VAO, streamed models have one per GPU block
+    GLuint vao = 0;
+    GLuint texture = 0;
+    for (const auto& mesh : meshes) {
+        if (mesh.vao != vao) {
+            vao = mesh.vao;
+            glBindVertexArray(vao);
         }
-        glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, 0);
+        int block = mesh.materialId >= 0 && mesh.materialId < materials.count - 1 ? mesh.materialId : materials.count - 1;
+        glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BINDING, materials.ubo, block * materials.stride, 12 * sizeof(float));
+        // untextured blocks never sample, whatever stays bound is fine for them
+        if (materials.textures[block] != 0 && materials.textures[block] != texture) {
+            texture = materials.textures[block];
+            glBindTexture(GL_TEXTURE_2D, texture);
+        }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, mesh.indexType, (void*)mesh.indexOffset, instances, mesh.baseVertex);
     }
     glBindVertexArray(0);
 }
 
 std::string rgbToHex(float red, float green, float blue) {
-    int r = static_cast<int>(std::round(red * 255.0f));
-    int g = static_cast<int>(std::round(green * 255.0f));
-    int b = static_cast<int>(std::round(blue * 255.0f));
-
-    std::stringstream ss;
-    ss << std::hex << std::uppercase << std::setfill('0');
-    ss << std::setw(2) << r;
-    ss << std::setw(2) << g;
-    ss << std::setw(2) << b;
-    return ss.str();
+    // MTL colors may leave [0, 1] (Blender writes Ka 2 for emissive looking
+    // materials), a channel still has to fit two digits
+    static const char DIGITS[] = "0123456789ABCDEF";
+    float channels[3] = {red, green, blue};
+    char hex[6];
+    for (int c = 0; c < 3; c++) {
+        int value = static_cast<int>(std::round(glm::clamp(channels[c], 0.0f, 1.0f) * 255.0f));
+        hex[2 * c] = DIGITS[value >> 4];
+        hex[2 * c + 1] = DIGITS[value & 15];
+    }
+    // six characters stay in std::string's inline buffer
+    return std::string(hex, 6);
 }
 
-int render(std::vector<MeshGL>& meshes, tinyobj::attrib_t& attrib, const std::vector<tinyobj::material_t>& materials, GLFWwindow* window) {
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-
-    Shader shader;
-    shader.use();
-
-    auto [bbox_min, bbox_max] = getBoundingBox(attrib);
-    glm::vec3 bbox_center =(bbox_max + bbox_min) / 2.0f;
-    centerizeModel(attrib, bbox_center);
-
-    shader.setVec3("light.position", glm::vec3(1.2f, 1.0f, 2.0f));
-    shader.setVec3("light.ambient", glm::vec3(0.2f, 0.2f, 0.2f));
-    shader.setVec3("light.diffuse", glm::vec3(0.5f, 0.5f, 0.5f));
-    shader.setVec3("light.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-
-    shader.setMat4("projection", glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, 100.0f));
-    shader.setVec3("viewPos", glm::vec3(0.0f, 0.0f, 3.0f));
+Camera frameCamera(const glm::vec3& bbox_min, const glm::vec3& bbox_max, float aspect) {
+    Camera camera;
+    camera.center = (bbox_max + bbox_min) / 2.0f;
+    camera.projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+    camera.viewPos = glm::vec3(0.0f, 0.0f, 3.0f);
 
     float fovY = glm::radians(45.0f);
     float bbox_height = (bbox_max - bbox_min).y;
@@ -179,109 +324,511 @@ int render(std::vector<MeshGL>& meshes, tinyobj::attrib_t& attrib, const std::ve
 
     float distanceY = (bbox_height * 0.5f) / tan(fovY * 0.5f);
 
-    float aspect = WIDTH / (float)HEIGHT;
     float fovX = 2.0f * atan(tan(fovY * 0.5f) * aspect);
     float distanceX = (bbox_width * 0.5f) / tan(fovX * 0.5f);
 
     float camera_distance = glm::max(distanceX, distanceY);
-    shader.setMat4("view", glm::lookAt(
-        glm::vec3(0.0f, 0.0f, bbox_center.z + camera_distance + (bbox_max - bbox_min).z * 0.5f),
-        bbox_center,
+    camera.view = glm::lookAt(
+        glm::vec3(0.0f, 0.0f, camera_distance + (bbox_max - bbox_min).z * 0.5f),
+        glm::vec3(0.0f),
         glm::vec3(0, 1, 0)
-    ));
- 
-    for (int frame = 0; frame < 360; ++frame) {
-        glClearColor(0.f, 0.f, 0.f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    );
+    return camera;
+}
+
+float frameAngle(int frame, int frames) {
+    return 360.0f * (float)frame / (float)frames;
+}
 
-        float angle = glm::radians((float)frame);
+glm::mat4 modelMatrix(float degrees, const glm::vec3& center) {
+    float angle = glm::radians(degrees);
+    return glm::translate(glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0,1,0)), -center);
+}
+
+MaterialBuffer beginRender(const Shader& shader, const Camera& camera, const std::vector<tinyobj::material_t>& materials, const std::vector<GLuint>& textures) {
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    shader.use();
 
-        shader.setMat4("model", glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0,1,0)));
+    MaterialBuffer material_buffer = createMaterialBuffer(materials, textures);
+    shader.setInt("diffuseMap", 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setVec3("light.position", LIGHT_POSITION);
+    shader.setVec3("light.ambient", LIGHT_AMBIENT);
+    shader.setVec3("light.diffuse", LIGHT_DIFFUSE);
+    shader.setVec3("light.specular", LIGHT_SPECULAR);
+
+    shader.setMat4("projection", camera.projection);
+    shader.setVec3("viewPos", camera.viewPos);
+    shader.setMat4("view", camera.view);
+    shader.setInt("columns", 1);
+    shader.setInt("rows", 1);
+    return material_buffer;
+}
 
-        drawModel(meshes, materials, shader);
+void drawFrame(const Shader& shader, const std::vector<MeshGL>& meshes, const MaterialBuffer& materials, const Camera& camera, float degrees) {
+    glClearColor(0.f, 0.f, 0.f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        std::vector<unsigned char> pixels(WIDTH * HEIGHT * 3);
-        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    shader.setMat4("models", modelMatrix(degrees, camera.center));
 
-        saveFrameAsPPM(frame, pixels, WIDTH, HEIGHT);
+    drawModel(meshes, materials, 1);
+}
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+// Framebuffer holding a whole atlas, the context's one only fits a single frame
+struct AtlasTarget {
+    GLuint fbo = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    GLint previousFbo = 0;
+    GLint previousViewport[4] = {0, 0, 0, 0};
+
+    int create(int width, int height) {
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            release();
+            return 1;
+        }
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glViewport(0, 0, width, height);
+        for (int plane = 0; plane < 4; plane++) {
+            glEnable(GL_CLIP_DISTANCE0 + plane);
+        }
+        return 0;
     }
 
-    return 0;
+    // Restores the previous framebuffer and viewport
+    void release() {
+        if (!fbo) return;
+        for (int plane = 0; plane < 4; plane++) {
+            glDisable(GL_CLIP_DISTANCE0 + plane);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previousFbo);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        fbo = colorBuffer = depthBuffer = 0;
+    }
+
+    ~AtlasTarget() {
+        release();
+    }
+};
+
+// Near-square grid for tiles frames of width x height, shrunk to the renderbuffer size limit
+static void atlasGrid(int tiles, int width, int height, int& columns, int& rows) {
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_size);
+    GLint max_viewport[2] = {0, 0};
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+    int max_columns = std::max(1, std::min(max_size, max_viewport[0]) / std::max(width, 1));
+    int max_rows = std::max(1, std::min(max_size, max_viewport[1]) / std::max(height, 1));
+
+    columns = 1;
+    while (columns * columns < tiles) columns++;
+    columns = std::min(columns, max_columns);
+    rows = std::min((tiles + columns - 1) / columns, max_rows);
 }
 
-std::vector<MeshGL> setupMeshes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes) {
-    std::vector<MeshGL> meshes;
-    for (const auto& shape : shapes) {
-        std::vector<float> vertexData;
-        std::vector<unsigned int> indices;
-
-        std::map<tinyobj::index_t, unsigned int, IndexLess> indexMap;
-        unsigned int nextIndex = 0;
-
-        for (const auto& idx : shape.mesh.indices) {
-            if (indexMap.count(idx) == 0) {
-                if (idx.vertex_index < 0 || 3 * idx.vertex_index + 2 >= attrib.vertices.size()) {
-                    std::cerr << "Error: Invalid vertex index\n";
-                    continue;
-                }
-
-                float vx = attrib.vertices[3 * idx.vertex_index + 0];
-                float vy = attrib.vertices[3 * idx.vertex_index + 1];
-                float vz = attrib.vertices[3 * idx.vertex_index + 2];
-
-                float nx = 0, ny = 0, nz = 0;
-                if (idx.normal_index >= 0 && 3 * idx.normal_index + 2 < attrib.normals.size()) {
-                    nx = attrib.normals[3 * idx.normal_index + 0];
-                    ny = attrib.normals[3 * idx.normal_index + 1];
-                    nz = attrib.normals[3 * idx.normal_index + 2];
-                }
-
-                float tx = 0, ty = 0;
-                if (idx.texcoord_index >= 0 && 2 * idx.texcoord_index + 1 < attrib.texcoords.size()) {
-                    tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-                    ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-                }
-
-                vertexData.push_back(vx);
-                vertexData.push_back(vy);
-                vertexData.push_back(vz);
-                vertexData.push_back(nx);
-                vertexData.push_back(ny);
-                vertexData.push_back(nz);
-                vertexData.push_back(tx);
-                vertexData.push_back(ty);
-
-                indexMap[idx] = nextIndex++;
+// Reads the GL_TIME_ELAPSED query of every traced frame onto the GPU track.
+// The readback fences have been waited on, so every result should be final.
+// Queries without a result, and results longer than the frame has existed
+// (Mesa's software driver reports hours for the first one), are left out and counted.
+static void collectGpuTimes(std::vector<GLuint>& queries, const std::vector<double>& submits) {
+    double now = traceMicroseconds();
+    size_t unavailable = 0;
+    size_t implausible = 0;
+    for (size_t frame = 0; frame < queries.size(); frame++) {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(queries[frame], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            unavailable++;
+            continue;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[frame], GL_QUERY_RESULT, &elapsed);
+        if (elapsed / 1000.0 > now - submits[frame]) {
+            implausible++;
+            continue;
+        }
+        traceGpuEvent("frame", submits[frame], elapsed / 1000.0);
+        traceCount(TraceCounter::GpuNanoseconds, (int64_t)elapsed);
+    }
+    if (unavailable + implausible > 0) {
+        std::cout << "Left " << unavailable + implausible << " of " << queries.size() << " GPU frame times out of the trace, " << unavailable
+                  << " without a result and " << implausible << " longer than the frame existed\n";
+    }
+    glDeleteQueries((GLsizei)queries.size(), queries.data());
+    queries.clear();
+}
+
+int render(const Shader& shader, std::vector<MeshGL>& meshes, const Camera& camera, const std::vector<tinyobj::material_t>& materials,
+           const std::vector<GLuint>& textures, const RenderFormat& format, const FrameSink& sink) {
+    TRACE_SCOPE("render");
+    MaterialBuffer material_buffer = beginRender(shader, camera, materials, textures);
+
+    int columns = 1;
+    int rows = 1;
+    int tiles = std::max(1, std::min({format.tiles, format.frames, MAX_ATLAS_TILES}));
+    if (tiles > 1) {
+        atlasGrid(tiles, format.width, format.height, columns, rows);
+        tiles = std::min(tiles, columns * rows);
+    }
+    AtlasTarget atlas;
+    if (tiles > 1 && atlas.create(columns * format.width, rows * format.height) != 0) {
+        std::cerr << "Error: Atlas framebuffer of " << columns << "x" << rows << " frames is incomplete, rendering frame by frame\n";
+        columns = rows = tiles = 1;
+    }
+    int atlas_width = columns * format.width;
+    int atlas_height = rows * format.height;
+    int passes = (format.frames + tiles - 1) / tiles;
+    shader.setInt("columns", columns);
+    shader.setInt("rows", rows);
+
+    // every pass holds tiles frames in reading order, they are cut out of the
+    // atlas into frame sized images before reaching the sink
+    std::vector<unsigned char> tile_pixels;
+    FrameSink split = [&](int pass, const unsigned char* pixels) {
+        TRACE_SCOPE("atlas_split");
+        tile_pixels.resize((size_t)format.width * format.height * 3);
+        size_t row_bytes = (size_t)format.width * 3;
+        int first = pass * tiles;
+        for (int tile = 0; tile < tiles && first + tile < format.frames; tile++) {
+            int x = tile % columns;
+            int y = rows - 1 - tile / columns;
+            for (int row = 0; row < format.height; row++) {
+                const unsigned char* src = pixels + ((size_t)(y * format.height + row) * atlas_width + (size_t)x * format.width) * 3;
+                std::memcpy(&tile_pixels[row * row_bytes], src, row_bytes);
+            }
+            if (sink(first + tile, tile_pixels.data()) != 0) {
+                return 1;
             }
-            indices.push_back(indexMap[idx]);
         }
+        return 0;
+    };
+
+    // results are only read after the last pass so the queries never stall the loop
+    std::vector<GLuint> gpu_queries;
+    std::vector<double> gpu_submits;
+    if (traceEnabled()) {
+        gpu_queries.resize(passes);
+        gpu_submits.resize(passes);
+        glGenQueries(passes, gpu_queries.data());
+    }
+
+    // atlases are large and there are few passes, two buffers keep one pass in flight
+    ReadbackRing readback(atlas_width, atlas_height, tiles > 1 ? 2 : READBACK_BUFFERS);
+    std::vector<glm::mat4> models(tiles);
+    auto render_start = std::chrono::steady_clock::now();
+    int ret = 0;
+    for (int pass = 0; pass < passes && ret == 0; ++pass) {
+        TRACE_SCOPE("frame");
+        if (!gpu_queries.empty()) {
+            gpu_submits[pass] = traceMicroseconds();
+            glBeginQuery(GL_TIME_ELAPSED, gpu_queries[pass]);
+        }
+        if (tiles == 1) {
+            drawFrame(shader, meshes, material_buffer, camera, frameAngle(pass, format.frames));
+        } else {
+            glClearColor(0.f, 0.f, 0.f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            int count = std::min(tiles, format.frames - pass * tiles);
+            for (int tile = 0; tile < count; tile++) {
+                models[tile] = modelMatrix(frameAngle(pass * tiles + tile, format.frames), camera.center);
+            }
+            shader.setMat4Array("models", models.data(), count);
+            drawModel(meshes, material_buffer, count);
+        }
+        if (!gpu_queries.empty()) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+
+        ret = readback.submit(pass, tiles > 1 ? split : sink);
+    }
+    if (ret == 0) {
+        ret = readback.flush(tiles > 1 ? split : sink);
+    }
+    if (!gpu_queries.empty()) {
+        collectGpuTimes(gpu_queries, gpu_submits);
+    }
+    glDeleteBuffers(1, &material_buffer.ubo);
+    if (ret != 0) {
+        return 1;
+    }
 
-        GLuint vao, vbo, ebo;
-        glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &vbo);
-        glGenBuffers(1, &ebo);
+    double render_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+    std::cout << "Rendered " << format.frames << " frames";
+    if (tiles > 1) {
+        std::cout << " in " << passes << " passes of a " << columns << "x" << rows << " atlas";
+    }
+    std::cout << " in " << render_time * 1000.0 << " ms, " << readback.waitSeconds() * 1000.0 << " ms waiting on readback fences\n";
 
-        glBindVertexArray(vao);
+    return 0;
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
+static int shapeMaterial(const tinyobj::shape_t& shape) {
+    return shape.mesh.material_ids.empty() ? -1 : shape.mesh.material_ids[0];
+}
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+// Deduplicates the shape's (vertex, normal, texcoord) triples: writes its valid
+// indices as shape local vertex ids and the triple of every new id to unique,
+// both need room for shape.mesh.indices.size() entries. Returns the vertex count.
+static size_t dedupShape(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape, IndexTable& table, unsigned int* indices,
+                         tinyobj::index_t* unique, size_t& index_count) {
+    table.reset(shape.mesh.indices.size());
+    unsigned int next_index = 0;
+    size_t invalid = 0;
+    size_t vertex_count = attrib.vertices.size() / 3;
+    index_count = 0;
+
+    for (const auto& idx : shape.mesh.indices) {
+        if (idx.vertex_index < 0 || (size_t)idx.vertex_index >= vertex_count) {
+            invalid++;
+            continue;
+        }
+        bool inserted;
+        unsigned int index = table.insert(idx, next_index, inserted);
+        if (inserted) unique[next_index++] = idx;
+        indices[index_count++] = index;
+    }
+    if (invalid > 0) {
+        std::cerr << "Error: Invalid vertex index (" << invalid << " in shape " << shape.name << ")\n";
+    }
+    return next_index;
+}
 
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
+// Interleaved position, normal and texcoord of one triple, zeros for missing attributes
+static void fillVertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& idx, float* v) {
+    v[0] = attrib.vertices[3 * idx.vertex_index + 0];
+    v[1] = attrib.vertices[3 * idx.vertex_index + 1];
+    v[2] = attrib.vertices[3 * idx.vertex_index + 2];
+
+    v[3] = v[4] = v[5] = 0;
+    if (idx.normal_index >= 0 && 3 * idx.normal_index + 2 < attrib.normals.size()) {
+        v[3] = attrib.normals[3 * idx.normal_index + 0];
+        v[4] = attrib.normals[3 * idx.normal_index + 1];
+        v[5] = attrib.normals[3 * idx.normal_index + 2];
+    }
 
-        glBindVertexArray(0);
+    v[6] = v[7] = 0;
+    if (idx.texcoord_index >= 0 && 2 * idx.texcoord_index + 1 < attrib.texcoords.size()) {
+        v[6] = attrib.texcoords[2 * idx.texcoord_index + 0];
+        v[7] = attrib.texcoords[2 * idx.texcoord_index + 1];
+    }
+}
 
-        meshes.push_back({vao, vbo, ebo, (int)indices.size(), shape.mesh.material_ids.empty() ? -1 : shape.mesh.material_ids[0]});
+MeshData buildMesh(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape) {
+    MeshData mesh;
+    mesh.materialId = shapeMaterial(shape);
+    IndexTable table;
+    std::vector<tinyobj::index_t> unique(shape.mesh.indices.size());
+    mesh.indices.resize(shape.mesh.indices.size());
+    size_t index_count;
+    size_t vertex_count = dedupShape(attrib, shape, table, mesh.indices.data(), unique.data(), index_count);
+    mesh.indices.resize(index_count);
+    mesh.vertices.resize(vertex_count * 8);
+    for (size_t v = 0; v < vertex_count; v++) {
+        fillVertex(attrib, unique[v], &mesh.vertices[v * 8]);
     }
+    return mesh;
+}
+
+MeshArena PackedMeshes::arena() const {
+    return {vertices.data(), vertices.size() / 8, indices.data(), indices.size(), batches.data(), batches.size()};
+}
+
+PackedMeshes packShapes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, int threads) {
+    TRACE_SCOPE("dedup");
+    std::vector<size_t> order(shapes.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return shapeMaterial(shapes[a]) < shapeMaterial(shapes[b]);
+    });
+
+    // every shape owns a span of the packed indices sized for all of its
+    // triples, the same span of unique holds the triples of its vertices
+    std::vector<size_t> index_offsets(shapes.size() + 1, 0);
+    for (size_t k = 0; k < order.size(); k++) {
+        index_offsets[k + 1] = index_offsets[k] + shapes[order[k]].mesh.indices.size();
+    }
+    PackedMeshes packed;
+    packed.indices.resize(index_offsets.back());
+    std::vector<tinyobj::index_t> unique(index_offsets.back());
+    std::vector<size_t> index_counts(shapes.size());
+    std::vector<size_t> vertex_counts(shapes.size());
+
+    // runs of consecutive shapes share a table instead of allocating one each
+    size_t runs = std::min(shapes.size(), (size_t)std::max(threads, 1) * 8);
+    parallelFor(runs, threads, [&](size_t r) {
+        IndexTable table;
+        for (size_t k = r * shapes.size() / runs; k < (r + 1) * shapes.size() / runs; k++) {
+            size_t offset = index_offsets[k];
+            vertex_counts[k] = dedupShape(attrib, shapes[order[k]], table, packed.indices.data() + offset, unique.data() + offset, index_counts[k]);
+        }
+    });
+
+    std::vector<size_t> vertex_offsets(shapes.size() + 1, 0);
+    for (size_t k = 0; k < order.size(); k++) {
+        vertex_offsets[k + 1] = vertex_offsets[k] + vertex_counts[k];
+    }
+    packed.vertices.resize(vertex_offsets.back() * 8);
+    parallelFor(shapes.size(), threads, [&](size_t k) {
+        const tinyobj::index_t* triples = unique.data() + index_offsets[k];
+        float* vertices = packed.vertices.data() + vertex_offsets[k] * 8;
+        for (size_t v = 0; v < vertex_counts[k]; v++) {
+            fillVertex(attrib, triples[v], vertices + v * 8);
+        }
+        unsigned int base_vertex = (unsigned int)vertex_offsets[k];
+        unsigned int* indices = packed.indices.data() + index_offsets[k];
+        for (size_t i = 0; i < index_counts[k]; i++) {
+            indices[i] += base_vertex;
+        }
+    });
+
+    // spans shrink by the invalid indices they skipped
+    size_t index_total = 0;
+    for (size_t k = 0; k < order.size(); k++) {
+        int material = shapeMaterial(shapes[order[k]]);
+        if (index_total != index_offsets[k]) {
+            std::memmove(packed.indices.data() + index_total, packed.indices.data() + index_offsets[k], index_counts[k] * sizeof(unsigned int));
+        }
+        if (!packed.batches.empty() && packed.batches.back().materialId == material) {
+            packed.batches.back().indexCount += index_counts[k];
+        } else if (index_counts[k] > 0) {
+            packed.batches.push_back({material, 0, index_total, index_counts[k]});
+        }
+        index_total += index_counts[k];
+    }
+    packed.indices.resize(index_total);
+
+    if (traceEnabled()) {
+        traceCount(TraceCounter::VerticesDeduped, (int64_t)index_total - (int64_t)vertex_offsets.back());
+    }
+    return packed;
+}
+
+std::vector<MeshGL> uploadArena(const MeshArena& arena, bool texcoords, int threads) {
+    return uploadGpuArena(optimizeMeshes(arena, texcoords, threads).arena(), texcoords);
+}
+
+std::vector<MeshGL> uploadGpuArena(const GpuArena& gpu, bool texcoords) {
+    TRACE_SCOPE("upload");
+    GLuint vao, vbo, ebo;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    glBindVertexArray(vao);
+
+    // texcoords follow the vertices in the same buffer
+    // without texcoords the disabled attribute reads (0, 0), what a model without them stores
+    bool upload_texcoords = texcoords && gpu.texcoords;
+    size_t vertex_bytes = gpu.vertexCount * sizeof(GpuVertex);
+    size_t texcoord_bytes = upload_texcoords ? gpu.vertexCount * 2 * sizeof(float) : 0;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertex_bytes + texcoord_bytes, nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_bytes, gpu.vertices);
+    if (upload_texcoords) {
+        glBufferSubData(GL_ARRAY_BUFFER, vertex_bytes, texcoord_bytes, gpu.texcoords);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, gpu.indexBytes, gpu.indices, GL_STATIC_DRAW);
+
+    std::vector<MeshGL> meshes;
+    for (size_t i = 0; i < gpu.batchCount; i++) {
+        const GpuBatch& batch = gpu.batches[i];
+        meshes.push_back({vao, vbo, ebo, (int)batch.indexCount, batch.materialId, (size_t)batch.indexOffset, batch.indexType, batch.baseVertex});
+    }
+
+    setVertexLayout();
+    if (upload_texcoords) {
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)vertex_bytes);
+        glEnableVertexAttribArray(2);
+    }
+
+    glBindVertexArray(0);
+
     return meshes;
 }
+
+void setVertexLayout() {
+    // texcoords are only read by textured materials, uploadArena adds them when there are any
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GpuVertex), (void*)offsetof(GpuVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(GpuVertex), (void*)offsetof(GpuVertex, normal));
+    glEnableVertexAttribArray(1);
+}
+
+std::vector<MeshGL> setupMeshes(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes, int threads) {
+    PackedMeshes packed = packShapes(attrib, shapes, threads);
+    generateNormals(packed, DEFAULT_CREASE_ANGLE, threads);
+    return uploadArena(packed.arena(), false, threads);
+}
+
+std::vector<GLuint> uploadTextures(const MaterialImages& images) {
+    TRACE_SCOPE("texture_upload");
+    std::vector<GLuint> textures(images.size(), 0);
+    // materials sharing an image share its texture
+    std::unordered_map<const TextureImage*, GLuint> uploaded;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t i = 0; i < images.size(); i++) {
+        if (!images[i]) continue;
+        auto found = uploaded.find(images[i].get());
+        if (found != uploaded.end()) {
+            textures[i] = found->second;
+            continue;
+        }
+        const TextureImage& image = *images[i];
+        glGenTextures(1, &textures[i]);
+        uploaded[&image] = textures[i];
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        for (size_t level = 0; level < image.levels.size(); level++) {
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGB8, std::max(1, image.width >> level), std::max(1, image.height >> level), 0, GL_RGB,
+                         GL_UNSIGNED_BYTE, image.levels[level].data());
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return textures;
+}
+
+void deleteTextures(std::vector<GLuint>& textures) {
+    std::sort(textures.begin(), textures.end());
+    textures.erase(std::unique(textures.begin(), textures.end()), textures.end());
+    textures.erase(std::remove(textures.begin(), textures.end(), 0u), textures.end());
+    glDeleteTextures((GLsizei)textures.size(), textures.data());
+    textures.clear();
+}
+
+void deleteMeshes(std::vector<MeshGL>& meshes) {
+    // batches of one arena are adjacent and share its buffers
+    GLuint vao = 0;
+    for (auto& mesh : meshes) {
+        if (mesh.vao == vao) continue;
+        vao = mesh.vao;
+        glDeleteVertexArrays(1, &mesh.vao);
+        glDeleteBuffers(1, &mesh.vbo);
+        glDeleteBuffers(1, &mesh.ebo);
+    }
+    meshes.clear();
+}
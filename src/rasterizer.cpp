@@ -0,0 +1,381 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "cpp_obj-preview/rasterizer.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const int TILE_SIZE = 64;
+static const int ROW_ALIGN = 8;
+static const float NEAR_W = 1e-5f;
+
+#if defined(__AVX2__)
+static const int LANES = 8;
+typedef __m256 vfloat;
+static inline vfloat vset(float v) { return _mm256_set1_ps(v); }
+static inline vfloat vramp() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vstore(float* p, vfloat v) { _mm256_storeu_ps(p, v); }
+static inline vfloat vge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline vfloat vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vfloat vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+static inline int vmask(vfloat v) { return _mm256_movemask_ps(v); }
+static inline vfloat vbits(int32_t v) { return _mm256_castsi256_ps(_mm256_set1_epi32(v)); }
+#elif defined(__SSE2__)
+static const int LANES = 4;
+typedef __m128 vfloat;
+static inline vfloat vset(float v) { return _mm_set1_ps(v); }
+static inline vfloat vramp() { return _mm_setr_ps(0, 1, 2, 3); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+static inline void vstore(float* p, vfloat v) { _mm_storeu_ps(p, v); }
+static inline vfloat vge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+static inline vfloat vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vfloat vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline int vmask(vfloat v) { return _mm_movemask_ps(v); }
+static inline vfloat vbits(int32_t v) { return _mm_castsi128_ps(_mm_set1_epi32(v)); }
+#else
+static const int LANES = 1;
+typedef float vfloat;
+static inline vfloat vset(float v) { return v; }
+static inline vfloat vramp() { return 0.0f; }
+static inline vfloat vadd(vfloat a, vfloat b) { return a + b; }
+static inline vfloat vmul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat vload(const float* p) { return *p; }
+static inline void vstore(float* p, vfloat v) { *p = v; }
+static inline vfloat vge(vfloat a, vfloat b) { return a >= b ? 1.0f : 0.0f; }
+static inline vfloat vlt(vfloat a, vfloat b) { return a < b ? 1.0f : 0.0f; }
+static inline vfloat vle(vfloat a, vfloat b) { return a <= b ? 1.0f : 0.0f; }
+static inline vfloat vand(vfloat a, vfloat b) { return a != 0.0f && b != 0.0f ? 1.0f : 0.0f; }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return mask != 0.0f ? a : b; }
+static inline int vmask(vfloat v) { return v != 0.0f ? 1 : 0; }
+static inline vfloat vbits(int32_t v) { float f; std::memcpy(&f, &v, sizeof(f)); return f; }
+#endif
+
+CpuRasterizer::CpuRasterizer(const MeshArena& arena, const std::vector<tinyobj::material_t>& materials, const MaterialImages& images, int width,
+                             int height, int threads)
+    : width(width), height(height), threads(threads), pool(threads) {
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    for (size_t i = 0; i < materials.size(); i++) {
+        const auto& mat = materials[i];
+        this->materials.push_back({
+            glm::vec3(mat.ambient[0], mat.ambient[1], mat.ambient[2]),
+            glm::vec3(mat.diffuse[0], mat.diffuse[1], mat.diffuse[2]),
+            glm::vec3(mat.specular[0], mat.specular[1], mat.specular[2]),
+            mat.shininess,
+            i < images.size() ? images[i].get() : nullptr
+        });
+    }
+    this->materials.push_back({DEFAULT_MATERIAL_COLOR, DEFAULT_MATERIAL_COLOR, DEFAULT_MATERIAL_COLOR, DEFAULT_MATERIAL_SHININESS, nullptr});
+    int default_material = (int)this->materials.size() - 1;
+
+    vertices.assign(arena.vertices, arena.vertices + arena.vertexCount * 8);
+    indices.reserve(arena.indexCount);
+    for (size_t i = 0; i < arena.batchCount; i++) {
+        const MeshBatch& batch = arena.batches[i];
+        const unsigned int* batch_indices = arena.indices + batch.indexOffset;
+        indices.insert(indices.end(), batch_indices, batch_indices + batch.indexCount);
+        int material = batch.materialId >= 0 && batch.materialId < default_material ? batch.materialId : default_material;
+        triangleMaterials.insert(triangleMaterials.end(), batch.indexCount / 3, material);
+    }
+
+    size_t vertex_count = vertices.size() / 8;
+    clip.resize(vertex_count);
+    worldPositions.resize(vertex_count);
+    worldNormals.resize(vertex_count);
+    triangles.resize(indices.size() / 3);
+
+    chunkCount = std::max<size_t>(1, std::min<size_t>((size_t)threads * 4, triangles.size() / 1024));
+    binEntries.resize(chunkCount);
+    binTriangles.resize(chunkCount);
+    binOffsets.resize(chunkCount * ((size_t)tilesX * tilesY + 1));
+
+    size_t buffer_size = (size_t)((width + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN) * height;
+    depthBuffer.resize(buffer_size);
+    lambda1.resize(buffer_size);
+    lambda2.resize(buffer_size);
+    triangleIds.resize(buffer_size);
+    color.resize((size_t)width * height * 3);
+}
+
+const unsigned char* CpuRasterizer::pixels() const {
+    return color.data();
+}
+
+void CpuRasterizer::transformVertices(const glm::mat4& model, const Camera& camera) {
+    glm::mat4 view_projection = camera.projection * camera.view;
+    glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    size_t count = clip.size();
+    size_t block = 4096;
+    pool.run((count + block - 1) / block, [&](size_t b) {
+        size_t end = std::min(count, (b + 1) * block);
+        for (size_t i = b * block; i < end; i++) {
+            const float* v = &vertices[i * 8];
+            glm::vec4 world = model * glm::vec4(v[0], v[1], v[2], 1.0f);
+            worldPositions[i] = glm::vec3(world.x, world.y, world.z);
+            worldNormals[i] = normal_matrix * glm::vec3(v[3], v[4], v[5]);
+            clip[i] = view_projection * world;
+        }
+    });
+}
+
+void CpuRasterizer::setupTriangles() {
+    size_t tile_count = (size_t)tilesX * tilesY;
+    size_t per_chunk = (triangles.size() + chunkCount - 1) / chunkCount;
+    pool.run(chunkCount, [&](size_t c) {
+        // (tile << 32 | triangle) in setup order, counting sorted into the chunk's bins below
+        std::vector<uint64_t>& entries = binEntries[c];
+        entries.clear();
+        uint32_t* offsets = &binOffsets[c * (tile_count + 1)];
+        std::fill(offsets, offsets + tile_count + 1, 0);
+
+        size_t end = std::min(triangles.size(), (c + 1) * per_chunk);
+        for (size_t t = c * per_chunk; t < end; t++) {
+            Triangle& tri = triangles[t];
+            float sx[3], sy[3];
+            bool visible = true;
+            for (int k = 0; k < 3; k++) {
+                uint32_t index = indices[3 * t + k];
+                const glm::vec4& p = clip[index];
+                if (p.w < NEAR_W) {
+                    visible = false;
+                    break;
+                }
+                float inv_w = 1.0f / p.w;
+                sx[k] = (p.x * inv_w + 1.0f) * 0.5f * width;
+                sy[k] = (p.y * inv_w + 1.0f) * 0.5f * height;
+                tri.depth[k] = p.z * inv_w * 0.5f + 0.5f;
+                tri.invW[k] = inv_w;
+                tri.vertex[k] = index;
+            }
+            if (!visible) continue;
+
+            float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+            if (std::fabs(area) < 1e-12f) continue;
+
+            tri.minX = std::max(0, (int)std::floor(std::min({sx[0], sx[1], sx[2]})));
+            tri.maxX = std::min(width - 1, (int)std::ceil(std::max({sx[0], sx[1], sx[2]})));
+            tri.minY = std::max(0, (int)std::floor(std::min({sy[0], sy[1], sy[2]})));
+            tri.maxY = std::min(height - 1, (int)std::ceil(std::max({sy[0], sy[1], sy[2]})));
+            if (tri.minX > tri.maxX || tri.minY > tri.maxY) continue;
+
+            // lambda_k(x, y) = A x + B y + C, edge k lies opposite vertex k
+            for (int k = 0; k < 3; k++) {
+                int b = (k + 1) % 3, e = (k + 2) % 3;
+                tri.edge[k][0] = -(sy[e] - sy[b]) / area;
+                tri.edge[k][1] = (sx[e] - sx[b]) / area;
+                tri.edge[k][2] = ((sy[e] - sy[b]) * sx[b] - (sx[e] - sx[b]) * sy[b]) / area;
+            }
+            tri.material = triangleMaterials[t];
+
+            for (int ty = tri.minY / TILE_SIZE; ty <= tri.maxY / TILE_SIZE; ty++) {
+                for (int tx = tri.minX / TILE_SIZE; tx <= tri.maxX / TILE_SIZE; tx++) {
+                    size_t tile = (size_t)ty * tilesX + tx;
+                    entries.push_back((uint64_t)tile << 32 | t);
+                    offsets[tile]++;
+                }
+            }
+        }
+
+        // running sums put every offset at the end of its tile, filling back to
+        // front moves it to the start and keeps the triangles of a tile in order
+        for (size_t t = 1; t <= tile_count; t++) {
+            offsets[t] += offsets[t - 1];
+        }
+        // a chunk's entry count barely changes over a turn, the bins follow the entries' capacity
+        std::vector<uint32_t>& chunk_triangles = binTriangles[c];
+        if (chunk_triangles.size() < entries.size()) {
+            chunk_triangles.resize(entries.capacity());
+        }
+        for (size_t i = entries.size(); i-- > 0;) {
+            chunk_triangles[--offsets[entries[i] >> 32]] = (uint32_t)entries[i];
+        }
+    });
+}
+
+void CpuRasterizer::rasterizeTile(int tile) {
+    int stride = (width + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+    int tile_x0 = (tile % tilesX) * TILE_SIZE;
+    int tile_y0 = (tile / tilesX) * TILE_SIZE;
+    int tile_x1 = std::min(tile_x0 + TILE_SIZE, width);
+    int tile_y1 = std::min(tile_y0 + TILE_SIZE, height);
+    int tile_x1_padded = std::min(tile_x0 + TILE_SIZE, stride);
+
+    for (int y = tile_y0; y < tile_y1; y++) {
+        size_t row = (size_t)y * stride;
+        std::fill(depthBuffer.begin() + row + tile_x0, depthBuffer.begin() + row + tile_x1_padded, 1.0f);
+        std::fill(triangleIds.begin() + row + tile_x0, triangleIds.begin() + row + tile_x1_padded, -1);
+    }
+
+    size_t tile_count = (size_t)tilesX * tilesY;
+    const vfloat ramp = vramp();
+    const vfloat zero = vset(0.0f);
+    const vfloat one = vset(1.0f);
+    for (size_t c = 0; c < chunkCount; c++) {
+        const uint32_t* offsets = &binOffsets[c * (tile_count + 1)];
+        for (uint32_t i = offsets[tile]; i < offsets[tile + 1]; i++) {
+            uint32_t t = binTriangles[c][i];
+            const Triangle& tri = triangles[t];
+            int x0 = std::max(tile_x0, tri.minX) / LANES * LANES;
+            int x1 = std::min(tile_x1, tri.maxX + 1);
+            int y0 = std::max(tile_y0, tri.minY);
+            int y1 = std::min(tile_y1, tri.maxY + 1);
+
+            vfloat a0 = vset(tri.edge[0][0]), a1 = vset(tri.edge[1][0]), a2 = vset(tri.edge[2][0]);
+            vfloat z0 = vset(tri.depth[0]), z1 = vset(tri.depth[1]), z2 = vset(tri.depth[2]);
+            vfloat id = vbits((int32_t)t);
+
+            for (int y = y0; y < y1; y++) {
+                float py = y + 0.5f;
+                vfloat r0 = vset(tri.edge[0][1] * py + tri.edge[0][2]);
+                vfloat r1 = vset(tri.edge[1][1] * py + tri.edge[1][2]);
+                vfloat r2 = vset(tri.edge[2][1] * py + tri.edge[2][2]);
+                size_t row = (size_t)y * stride;
+                for (int x = x0; x < x1; x += LANES) {
+                    vfloat px = vadd(vset(x + 0.5f), ramp);
+                    vfloat l0 = vadd(vmul(a0, px), r0);
+                    vfloat l1 = vadd(vmul(a1, px), r1);
+                    vfloat l2 = vadd(vmul(a2, px), r2);
+                    vfloat inside = vand(vand(vge(l0, zero), vge(l1, zero)), vge(l2, zero));
+                    if (!vmask(inside)) continue;
+
+                    vfloat z = vadd(vadd(vmul(l0, z0), vmul(l1, z1)), vmul(l2, z2));
+                    float* depth = &depthBuffer[row + x];
+                    vfloat old_depth = vload(depth);
+                    vfloat pass = vand(inside, vand(vlt(z, old_depth), vand(vge(z, zero), vle(z, one))));
+                    if (!vmask(pass)) continue;
+
+                    vstore(depth, vselect(pass, z, old_depth));
+                    vstore(&lambda1[row + x], vselect(pass, l1, vload(&lambda1[row + x])));
+                    vstore(&lambda2[row + x], vselect(pass, l2, vload(&lambda2[row + x])));
+                    float* ids = (float*)&triangleIds[row + x];
+                    vstore(ids, vselect(pass, id, vload(ids)));
+                }
+            }
+        }
+    }
+}
+
+// Bilinear GL_REPEAT lookup at texcoord (u, v), texel centres at half integers like GL
+static glm::vec3 sampleTexture(const TextureImage& texture, float u, float v) {
+    float x = (u - std::floor(u)) * texture.width - 0.5f;
+    float y = (v - std::floor(v)) * texture.height - 0.5f;
+    float x_floor = std::floor(x), y_floor = std::floor(y);
+    float fx = x - x_floor, fy = y - y_floor;
+    int x0 = ((int)x_floor % texture.width + texture.width) % texture.width;
+    int y0 = ((int)y_floor % texture.height + texture.height) % texture.height;
+    int x1 = (x0 + 1) % texture.width;
+    int y1 = (y0 + 1) % texture.height;
+    auto texel = [&](int tx, int ty) {
+        const unsigned char* p = &texture.levels[0][((size_t)ty * texture.width + tx) * 3];
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+    glm::vec3 bottom = texel(x0, y0) * (1.0f - fx) + texel(x1, y0) * fx;
+    glm::vec3 top = texel(x0, y1) * (1.0f - fx) + texel(x1, y1) * fx;
+    return (bottom * (1.0f - fy) + top * fy) / 255.0f;
+}
+
+void CpuRasterizer::shadeTile(int tile, const Camera& camera) {
+    int stride = (width + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+    int tile_x0 = (tile % tilesX) * TILE_SIZE;
+    int tile_y0 = (tile / tilesX) * TILE_SIZE;
+    int tile_x1 = std::min(tile_x0 + TILE_SIZE, width);
+    int tile_y1 = std::min(tile_y0 + TILE_SIZE, height);
+
+    for (int y = tile_y0; y < tile_y1; y++) {
+        size_t row = (size_t)y * stride;
+        unsigned char* out = &color[((size_t)y * width + tile_x0) * 3];
+        for (int x = tile_x0; x < tile_x1; x++, out += 3) {
+            int32_t id = triangleIds[row + x];
+            if (id < 0) {
+                out[0] = out[1] = out[2] = 0;
+                continue;
+            }
+            const Triangle& tri = triangles[id];
+            float l1 = lambda1[row + x], l2 = lambda2[row + x];
+            float l0 = 1.0f - l1 - l2;
+            float p0 = l0 * tri.invW[0], p1 = l1 * tri.invW[1], p2 = l2 * tri.invW[2];
+            float inv_sum = 1.0f / (p0 + p1 + p2);
+            p0 *= inv_sum;
+            p1 *= inv_sum;
+            p2 *= inv_sum;
+
+            glm::vec3 frag_pos = worldPositions[tri.vertex[0]] * p0 + worldPositions[tri.vertex[1]] * p1 + worldPositions[tri.vertex[2]] * p2;
+            glm::vec3 normal = worldNormals[tri.vertex[0]] * p0 + worldNormals[tri.vertex[1]] * p1 + worldNormals[tri.vertex[2]] * p2;
+            const ShadingMaterial& mat = materials[tri.material];
+
+            glm::vec3 texel(1.0f);
+            if (mat.texture) {
+                const float* t0 = &vertices[(size_t)tri.vertex[0] * 8 + 6];
+                const float* t1 = &vertices[(size_t)tri.vertex[1] * 8 + 6];
+                const float* t2 = &vertices[(size_t)tri.vertex[2] * 8 + 6];
+                texel = sampleTexture(*mat.texture, t0[0] * p0 + t1[0] * p1 + t2[0] * p2, t0[1] * p0 + t1[1] * p1 + t2[1] * p2);
+            }
+            glm::vec3 result = LIGHT_AMBIENT * mat.ambient * texel;
+            float normal_length = glm::length(normal);
+            if (normal_length > 0.0f) {
+                glm::vec3 norm = normal / normal_length;
+                glm::vec3 light_dir = glm::normalize(LIGHT_POSITION - frag_pos);
+                float diff = std::max(glm::dot(norm, light_dir), 0.0f);
+                glm::vec3 view_dir = glm::normalize(camera.viewPos - frag_pos);
+                glm::vec3 halfway_dir = glm::normalize(light_dir + view_dir);
+                float spec = std::pow(std::max(glm::dot(norm, halfway_dir), 0.0f), mat.shininess);
+                result += LIGHT_DIFFUSE * (diff * mat.diffuse * texel) + LIGHT_SPECULAR * (spec * mat.specular);
+            }
+            for (int c = 0; c < 3; c++) {
+                out[c] = (unsigned char)std::lround(std::min(std::max(result[c], 0.0f), 1.0f) * 255.0f);
+            }
+        }
+    }
+}
+
+void CpuRasterizer::draw(const glm::mat4& model, const Camera& camera) {
+    transformVertices(model, camera);
+    setupTriangles();
+    pool.run((size_t)tilesX * tilesY, [&](size_t tile) {
+        rasterizeTile((int)tile);
+        shadeTile((int)tile, camera);
+    });
+}
+
+int renderCpu(const MeshArena& arena, const Camera& camera, const std::vector<tinyobj::material_t>& materials, const MaterialImages& images,
+              int threads, const RenderFormat& format, const FrameSink& sink) {
+    TRACE_SCOPE("render");
+    CpuRasterizer rasterizer(arena, materials, images, format.width, format.height, threads);
+
+    auto render_start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < format.frames; ++frame) {
+        {
+            TRACE_SCOPE("rasterize");
+            rasterizer.draw(modelMatrix(frameAngle(frame, format.frames), camera.center), camera);
+        }
+        traceCount(TraceCounter::FramesReadBack, 1);
+        if (sink(frame, rasterizer.pixels()) != 0) {
+            std::cerr << "Error: Failed to store frame " << frame << std::endl;
+            return 1;
+        }
+    }
+
+    double render_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+    std::cout << "Rendered " << format.frames << " frames on the CPU in " << render_time * 1000.0 << " ms\n";
+    return 0;
+}
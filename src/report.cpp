@@ -0,0 +1,186 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include "cpp_obj-preview/report.h"
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/budget.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t REPORT_BUFFER_BYTES = 64 * 1024;
+
+// Formats straight into one buffer that reaches the file in large writes, so
+// models with tens of thousands of shapes or materials do not build a string
+// per line. Numbers come out as std::ostream's defaults print them.
+class ReportWriter {
+public:
+    explicit ReportWriter(FILE* file) : file(file), failed(false) {
+        buffer.reserve(REPORT_BUFFER_BYTES);
+    }
+
+    ReportWriter& operator<<(const char* text) {
+        return append(text, std::strlen(text));
+    }
+    ReportWriter& operator<<(const std::string& text) {
+        return append(text.data(), text.size());
+    }
+    template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    ReportWriter& operator<<(T value) {
+        char digits[24];
+        int length = std::is_signed<T>::value ? std::snprintf(digits, sizeof(digits), "%lld", (long long)value)
+                                              : std::snprintf(digits, sizeof(digits), "%llu", (unsigned long long)value);
+        return append(digits, (size_t)length);
+    }
+    template <typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    ReportWriter& operator<<(T value) {
+        char digits[32];
+        int length = std::snprintf(digits, sizeof(digits), "%g", (double)value);
+        return append(digits, (size_t)length);
+    }
+    ReportWriter& operator<<(const glm::vec3& v) {
+        return *this << "(" << v.x << ", " << v.y << ", " << v.z << ")";
+    }
+
+    // Writes what is left and closes the file, false when any write failed
+    bool close() {
+        flush();
+        failed = std::fclose(file) != 0 || failed;
+        return !failed;
+    }
+
+private:
+    ReportWriter& append(const char* data, size_t size) {
+        buffer.append(data, size);
+        if (buffer.size() >= REPORT_BUFFER_BYTES) {
+            flush();
+        }
+        return *this;
+    }
+
+    void flush() {
+        if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+            failed = true;
+        }
+        buffer.clear();
+    }
+
+    FILE* file;
+    bool failed;
+    std::string buffer;
+};
+
+int generateReport(const ObjModel& model, const GeometryStats& stats, std::string save_dir, const OverviewSummary& overview) {
+    TRACE_SCOPE("report");
+    const std::vector<tinyobj::material_t>& materials = model.materials;
+    const std::vector<std::string>& comments = model.comments;
+    std::string report_path = save_dir + "obj-preview.md";
+    FILE* file = std::fopen((report_path + ".part").c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Failed to create report file obj-preview.md\n";
+        return 1;
+    }
+    ReportWriter report(file);
+    report << "# OBJ file preview\n\n";
+    report << "File: `" << model.filename << "`\n\n";
+
+    report << "## File Comments\n\n";
+    if (comments.empty()) {
+        report << "_No comments found in the OBJ file._\n";
+    } else {
+        for (const auto& c : comments) {
+            report << "- " << c << "\n";
+        }
+    }
+    report << "\n";
+
+    report << "## Summary\n";
+    report << "- Number of vertices: " << model.vertexCount << "\n";
+    report << "- Number of normals: " << model.normalCount << "\n";
+    report << "- Number of texture coordinates: " << model.texcoordCount << "\n";
+    size_t triangle_count = 0;
+    for (const auto& shape : model.shapeFaces) {
+        triangle_count += shape.second;
+    }
+    report << "- Number of triangles: " << triangle_count << "\n";
+    report << "- Number of rendered triangles: " << model.renderedTriangles << "\n";
+    report << "- Number of shapes: " << model.shapeFaces.size() << "\n";
+    report << "- Number of materials: " << materials.size() << "\n\n";
+
+    bool closed = stats.boundaryEdges == 0 && stats.nonManifoldEdges == 0;
+    report << "## Geometry\n";
+    report << "- Bounding box: " << stats.bboxMin << " to " << stats.bboxMax << "\n";
+    report << "- Size: " << stats.bboxMax - stats.bboxMin << "\n";
+    report << "- Centroid: " << stats.centroid << "\n";
+    report << "- Surface area: " << stats.surfaceArea << "\n";
+    if (!stats.topology) {
+        report << "- Volume: " << stats.signedVolume << " (approximate)\n";
+        report << "- Degenerate faces: " << stats.degenerateFaces << "\n";
+        report << "- Topology: not analyzed for streamed models\n\n";
+    } else {
+        report << "- Volume: " << stats.signedVolume << (closed ? " (closed)" : " (open, approximate)") << "\n";
+        report << "- Welded vertices: " << stats.weldedVertices << "\n";
+        report << "- Degenerate edges: " << stats.degenerateEdges << "\n";
+        report << "- Degenerate faces: " << stats.degenerateFaces << "\n";
+        report << "- Duplicate faces: " << stats.duplicateFaces << "\n";
+        report << "- Boundary edges: " << stats.boundaryEdges << "\n";
+        report << "- Non-manifold edges: " << stats.nonManifoldEdges << "\n";
+        report << "- Non-manifold faces: " << stats.nonManifoldFaces << "\n\n";
+    }
+
+    if (!materials.empty()) {
+        report << "## Materials\n\n";
+        // the hex strings fit std::string's inline buffer, a material allocates nothing
+        auto colorLine = [&report](const char* label, const float* rgb) {
+            std::string hex = rgbToHex(rgb[0], rgb[1], rgb[2]);
+            report << "- " << label << " color: ![" << hex << "](https://placehold.co/15x15/" << hex << "/" << hex << ".png)\n";
+        };
+        for (size_t i = 0; i < materials.size(); i++) {
+            report << "Material `" << materials[i].name << "`\n\n";
+            colorLine("Ambient", materials[i].ambient);
+            colorLine("Diffuse", materials[i].diffuse);
+            if (!materials[i].diffuse_texname.empty()) {
+                report << "- Diffuse texture: `" << materials[i].diffuse_texname << "`\n";
+            }
+            colorLine("Specular", materials[i].specular);
+            report << "- Specular exponent: " << materials[i].shininess << "\n\n";
+        }
+        report << "\n";
+    }
+
+    report << "## Shapes\n";
+    for (const auto& shape : model.shapeFaces) {
+        report << "- Shape `" << shape.first << "` has " << shape.second << " face(s)\n";
+    }
+    report << "\n";
+
+    report << "## Overview\n";
+    if (!overview.status.empty()) {
+        report << "- Status: " << overview.status << "\n";
+    }
+    if (overview.gif) {
+        report << "- Rendered at " << describeFormat(overview.format) << "\n";
+    }
+    if (!overview.budget.empty()) {
+        report << "- Time budget: " << overview.budget << "\n";
+    }
+    report << "\n";
+    if (overview.thumbnail && !overview.gif) {
+        report << "![Front view](obj-thumbnail.png)\n";
+    }
+    if (overview.gif) {
+        report << "![Overview gif](obj-overview.gif)\n";
+    }
+    if (overview.sheet) {
+        report << "![Contact sheet](obj-contact-sheet.png)\n";
+    }
+
+    if (!report.close() || std::rename((report_path + ".part").c_str(), report_path.c_str()) != 0) {
+        std::cerr << "Error: Failed to write report file obj-preview.md\n";
+        std::remove((report_path + ".part").c_str());
+        return 1;
+    }
+
+    return 0;
+}
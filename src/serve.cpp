@@ -0,0 +1,587 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "cpp_obj-preview/serve.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t MAX_REQUEST_SIZE = 64 << 10;
+static const int MAX_FRAMES = 3600;
+static const int MAX_SIZE = 8192;
+// clients connected at once, further ones are answered with an error and closed
+static const size_t MAX_CONNECTIONS = 256;
+// wait after accept failed for lack of descriptors or memory
+static const int ACCEPT_BACKOFF_MS = 100;
+
+using Clock = std::chrono::steady_clock;
+
+static double millisecondsBetween(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Reader for the flat request objects, values of unknown keys are skipped
+class JsonReader {
+public:
+    explicit JsonReader(const std::string& text) : p(text.data()), end(text.data() + text.size()) {}
+
+    bool consume(char c) {
+        skipSpaces();
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool atEnd() {
+        skipSpaces();
+        return p == end;
+    }
+
+    bool string(std::string& out) {
+        if (!consume('"')) return false;
+        out.clear();
+        while (p < end && *p != '"') {
+            char c = *p++;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (p >= end) return false;
+            c = *p++;
+            switch (c) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    if (end - p < 4) return false;
+                    unsigned value = 0;
+                    for (int i = 0; i < 4; i++) {
+                        char h = *p++;
+                        value <<= 4;
+                        if (h >= '0' && h <= '9') value |= h - '0';
+                        else if (h >= 'a' && h <= 'f') value |= h - 'a' + 10;
+                        else if (h >= 'A' && h <= 'F') value |= h - 'A' + 10;
+                        else return false;
+                    }
+                    // UTF-8, surrogate pairs are not needed for paths in practice
+                    if (value < 0x80) {
+                        out += (char)value;
+                    } else if (value < 0x800) {
+                        out += (char)(0xC0 | value >> 6);
+                        out += (char)(0x80 | (value & 0x3F));
+                    } else {
+                        out += (char)(0xE0 | value >> 12);
+                        out += (char)(0x80 | (value >> 6 & 0x3F));
+                        out += (char)(0x80 | (value & 0x3F));
+                    }
+                    break;
+                }
+                default: out += c; break;
+            }
+        }
+        return consume('"');
+    }
+
+    bool number(double& out) {
+        skipSpaces();
+        char* number_end = nullptr;
+        std::string text(p, std::min<size_t>(end - p, 64));
+        out = std::strtod(text.c_str(), &number_end);
+        if (number_end == text.c_str()) return false;
+        p += number_end - text.c_str();
+        return true;
+    }
+
+    bool skipValue(int depth = 0) {
+        skipSpaces();
+        if (p >= end || depth > 16) return false;
+        if (*p == '"') {
+            std::string ignored;
+            return string(ignored);
+        }
+        if (*p == '[' || *p == '{') {
+            char close = *p == '[' ? ']' : '}';
+            p++;
+            if (consume(close)) return true;
+            do {
+                if (close == '}') {
+                    std::string key;
+                    if (!string(key) || !consume(':')) return false;
+                }
+                if (!skipValue(depth + 1)) return false;
+            } while (consume(','));
+            return consume(close);
+        }
+        for (const char* literal : {"true", "false", "null"}) {
+            size_t length = std::strlen(literal);
+            if ((size_t)(end - p) >= length && std::strncmp(p, literal, length) == 0) {
+                p += length;
+                return true;
+            }
+        }
+        double ignored;
+        return number(ignored);
+    }
+
+private:
+    void skipSpaces() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    }
+
+    const char* p;
+    const char* end;
+};
+
+static bool integerValue(JsonReader& reader, int low, int high, int& out) {
+    double value;
+    if (!reader.number(value) || value != std::floor(value) || value < low || value > high) return false;
+    out = (int)value;
+    return true;
+}
+
+static bool parseRequest(const std::string& line, ServeRequest& request, std::string& error) {
+    request = ServeRequest{"", 0, 0, 0, ""};
+    JsonReader reader(line);
+    if (!reader.consume('{')) {
+        error = "request is not a JSON object";
+        return false;
+    }
+    if (!reader.consume('}')) {
+        do {
+            std::string key;
+            if (!reader.string(key) || !reader.consume(':')) {
+                error = "malformed JSON";
+                return false;
+            }
+            bool ok;
+            if (key == "obj") {
+                ok = reader.string(request.obj);
+            } else if (key == "output") {
+                ok = reader.string(request.output);
+            } else if (key == "frames") {
+                ok = integerValue(reader, 1, MAX_FRAMES, request.frames);
+            } else if (key == "size") {
+                ok = reader.consume('[') && integerValue(reader, 1, MAX_SIZE, request.width) && reader.consume(',') &&
+                     integerValue(reader, 1, MAX_SIZE, request.height) && reader.consume(']');
+            } else {
+                ok = reader.skipValue();
+            }
+            if (!ok) {
+                error = "invalid value for " + key;
+                return false;
+            }
+        } while (reader.consume(','));
+        if (!reader.consume('}')) {
+            error = "malformed JSON";
+            return false;
+        }
+    }
+    if (!reader.atEnd()) {
+        error = "trailing data after the request object";
+        return false;
+    }
+    if (request.obj.empty()) {
+        error = "missing obj";
+        return false;
+    }
+    return true;
+}
+
+static std::string resultJson(const ServeRequest& request, const ServeResult& result) {
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\"ok\":" << (result.status == 0 ? "true" : "false") << ",\"obj\":\"" << jsonEscape(request.obj) << "\"";
+    if (result.status != 0) {
+        out << ",\"error\":\"" << jsonEscape(result.error) << "\"";
+    } else {
+        if (!result.gif.empty()) {
+            out << ",\"gif\":\"" << jsonEscape(result.gif) << "\"";
+        }
+        if (!result.sheet.empty()) {
+            out << ",\"sheet\":\"" << jsonEscape(result.sheet) << "\"";
+        }
+        out << ",\"report\":\"" << jsonEscape(result.report) << "\""
+            << ",\"cached\":" << (result.cached ? "true" : "false") << ",\"triangles\":" << result.triangles;
+    }
+    out << ",\"timings_ms\":{\"queue\":" << result.queueMs << ",\"load\":" << result.loadMs << ",\"render_wait\":" << result.renderWaitMs
+        << ",\"render\":" << result.renderMs << ",\"total\":" << result.totalMs << "}}\n";
+    return out.str();
+}
+
+// One request from arrival to answer. done is set once the result is final,
+// the connection waits on it and so does the worker holding the job.
+struct ServeJob {
+    ServeRequest request;
+    ServeResult result;
+    std::function<void()> render;
+    Clock::time_point queued;
+    Clock::time_point prepared;
+    std::promise<void> done;
+    std::shared_future<void> finished;
+};
+
+static int wakePipe[2] = {-1, -1};
+
+static void onStopSignal(int) {
+    char byte = 1;
+    ssize_t ignored = write(wakePipe[1], &byte, 1);
+    (void)ignored;
+}
+
+enum class Admission { Accepted, Full, Stopping };
+
+// Queues and threads shared by the acceptor, connections, workers and the render loop
+class ServerState {
+public:
+    ServerState(const ServeOptions& options, const ServeHandler& handler) : options(options), handler(handler), stopping(false) {}
+
+    bool enqueue(const std::shared_ptr<ServeJob>& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || (int)pending.size() >= options.queueLimit) return false;
+        pending.push_back(job);
+        pendingReady.notify_one();
+        return true;
+    }
+
+    void work() {
+        for (;;) {
+            std::shared_ptr<ServeJob> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                pendingReady.wait(lock, [&] { return stopping || !pending.empty(); });
+                if (pending.empty()) return;
+                job = pending.front();
+                pending.pop_front();
+            }
+            Clock::time_point start = Clock::now();
+            job->result.queueMs = millisecondsBetween(job->queued, start);
+            {
+                TRACE_SCOPE("serve_load", job->request.obj);
+                job->render = handler(job->request, job->result);
+            }
+            job->prepared = Clock::now();
+            job->result.loadMs = millisecondsBetween(start, job->prepared);
+            if (!job->render) {
+                finish(*job);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) {
+                    fail(*job, "server is shutting down");
+                    continue;
+                }
+                renders.push_back(job);
+                renderReady.notify_one();
+            }
+            // the slot stays taken until the render is done, so at most
+            // `concurrency` parsed models are held at once
+            job->finished.wait();
+        }
+    }
+
+    // Runs the render steps on the calling thread until stop()
+    void renderLoop() {
+        for (;;) {
+            std::shared_ptr<ServeJob> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                renderReady.wait(lock, [&] { return stopping || !renders.empty(); });
+                if (renders.empty()) return;
+                job = renders.front();
+                renders.pop_front();
+                if (stopping) {
+                    lock.unlock();
+                    fail(*job, "server is shutting down");
+                    continue;
+                }
+            }
+            Clock::time_point start = Clock::now();
+            job->result.renderWaitMs = millisecondsBetween(job->prepared, start);
+            {
+                TRACE_SCOPE("serve_render", job->request.obj);
+                job->render();
+            }
+            job->result.renderMs = millisecondsBetween(start, Clock::now());
+            finish(*job);
+        }
+    }
+
+    void stop() {
+        std::deque<std::shared_ptr<ServeJob>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            dropped.swap(pending);
+            pendingReady.notify_all();
+            renderReady.notify_all();
+            for (int fd : connections) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        for (auto& job : dropped) {
+            fail(*job, "server is shutting down");
+        }
+    }
+
+    // Connection threads are detached, the set counts the live ones
+    Admission addConnection(int fd) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return Admission::Stopping;
+        if (connections.size() >= MAX_CONNECTIONS) return Admission::Full;
+        connections.insert(fd);
+        return Admission::Accepted;
+    }
+
+    void removeConnection(int fd) {
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.erase(fd);
+        connectionsChanged.notify_all();
+    }
+
+    // Blocks until every connection thread is done with the state, after stop()
+    void waitForConnections() {
+        std::unique_lock<std::mutex> lock(mutex);
+        connectionsChanged.wait(lock, [&] { return connections.empty(); });
+    }
+
+    // Answers a client over MAX_CONNECTIONS without blocking the acceptor
+    static void reject(int fd) {
+        static const char REJECTED[] = "{\"ok\":false,\"error\":\"too many connections\"}\n";
+        ssize_t ignored = send(fd, REJECTED, sizeof(REJECTED) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        (void)ignored;
+        close(fd);
+    }
+
+    // Answers every line of one client in order
+    void serveConnection(int fd) {
+        std::string buffer;
+        char chunk[4096];
+        for (;;) {
+            size_t newline = buffer.find('\n');
+            if (newline == std::string::npos) {
+                if (buffer.size() > MAX_REQUEST_SIZE) {
+                    sendAll(fd, "{\"ok\":false,\"error\":\"request too long\"}\n");
+                    break;
+                }
+                ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) break;
+                buffer.append(chunk, (size_t)count);
+                continue;
+            }
+            std::string line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            if (!sendAll(fd, answer(line))) break;
+        }
+        // last touch of the state, runServer may return once the set is empty
+        removeConnection(fd);
+        close(fd);
+    }
+
+private:
+    std::string answer(const std::string& line) {
+        auto job = std::make_shared<ServeJob>();
+        job->result = ServeResult{0, "", "", "", "", false, 0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        job->queued = Clock::now();
+        job->finished = job->done.get_future().share();
+        std::string error;
+        if (!parseRequest(line, job->request, error)) {
+            job->result.status = 1;
+            job->result.error = error;
+            return resultJson(job->request, job->result);
+        }
+        if (!enqueue(job)) {
+            job->result.status = 1;
+            job->result.error = "queue is full";
+            return resultJson(job->request, job->result);
+        }
+        job->finished.wait();
+        return resultJson(job->request, job->result);
+    }
+
+    void finish(ServeJob& job) {
+        job.result.totalMs = millisecondsBetween(job.queued, Clock::now());
+        job.done.set_value();
+    }
+
+    void fail(ServeJob& job, const std::string& error) {
+        job.result.status = 1;
+        job.result.error = error;
+        finish(job);
+    }
+
+    static bool sendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+            sent += (size_t)count;
+        }
+        return true;
+    }
+
+    ServeOptions options;
+    const ServeHandler& handler;
+    std::mutex mutex;
+    std::condition_variable pendingReady;
+    std::condition_variable renderReady;
+    std::condition_variable connectionsChanged;
+    std::deque<std::shared_ptr<ServeJob>> pending;
+    std::deque<std::shared_ptr<ServeJob>> renders;
+    std::set<int> connections;
+    bool stopping;
+};
+
+static int openSocket(const std::string& socket_path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path is too long: " << socket_path << std::endl;
+        return -1;
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "Error: Failed to create a Unix socket: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    // a socket file nobody listens on is left over from a daemon that died
+    struct stat info;
+    if (lstat(socket_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        if (connect(fd, (sockaddr*)&address, sizeof(address)) == 0) {
+            std::cerr << "Error: Another daemon is already listening on " << socket_path << std::endl;
+            close(fd);
+            return -1;
+        }
+        unlink(socket_path.c_str());
+    }
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+        std::cerr << "Error: Failed to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    chmod(socket_path.c_str(), 0600);
+    return fd;
+}
+
+int runServer(const std::string& socket_path, const ServeOptions& options, const ServeHandler& handler) {
+    if (pipe2(wakePipe, O_CLOEXEC) != 0) {
+        std::cerr << "Error: Failed to create the shutdown pipe\n";
+        return 1;
+    }
+    int listen_fd = openSocket(socket_path);
+    if (listen_fd < 0) {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        return 1;
+    }
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    ServerState state(options, handler);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.concurrency; i++) {
+        workers.emplace_back([&state] { state.work(); });
+    }
+
+    // held back so a client can still be accepted and closed once the process runs out of descriptors
+    int reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    std::thread acceptor([&] {
+        pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        int timeout = -1;
+        for (;;) {
+            int ready = poll(fds, 2, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Error: poll failed on " << socket_path << ": " << std::strerror(errno) << std::endl;
+                break;
+            }
+            if (fds[1].revents) break;
+            // a backoff only watches the wake pipe, the pending client keeps the socket readable
+            fds[0].events = POLLIN;
+            timeout = -1;
+            if (ready == 0) continue;
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                int error = errno;
+                if (error == EINTR || error == EAGAIN || error == ECONNABORTED || error == EPROTO) continue;
+                if (error == EMFILE && reserve_fd >= 0) {
+                    close(reserve_fd);
+                    fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    error = errno;
+                    if (fd >= 0) {
+                        ServerState::reject(fd);
+                    }
+                    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    if (fd >= 0) continue;
+                }
+                // out of descriptors or memory, shedding did not help
+                std::cerr << "Error: Failed to accept on " << socket_path << ": " << std::strerror(error) << std::endl;
+                fds[0].events = 0;
+                timeout = ACCEPT_BACKOFF_MS;
+                continue;
+            }
+            Admission admission = state.addConnection(fd);
+            if (admission == Admission::Stopping) {
+                close(fd);
+                break;
+            }
+            if (admission == Admission::Full) {
+                ServerState::reject(fd);
+                continue;
+            }
+            std::thread([&state, fd] { state.serveConnection(fd); }).detach();
+        }
+        state.stop();
+    });
+
+    std::cout << "Serving previews on " << socket_path << " (" << options.concurrency << " concurrent, " << options.queueLimit
+              << " queued)" << std::endl;
+    state.renderLoop();
+
+    acceptor.join();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    state.waitForConnections();
+    if (reserve_fd >= 0) {
+        close(reserve_fd);
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    std::cout << "Stopped serving on " << socket_path << std::endl;
+    return 0;
+}
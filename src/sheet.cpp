@@ -0,0 +1,176 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#ifdef CPP_OBJ_PREVIEW_ZLIB
+#include <zlib.h>
+#endif
+#include "cpp_obj-preview/sheet.h"
+#include "cpp_obj-preview/trace.h"
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+        }
+    }
+};
+
+static uint32_t crc32Update(uint32_t crc, const unsigned char* data, size_t size) {
+    static const Crc32Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void putBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+static void writeChunk(std::ofstream& out, const char* type, const unsigned char* data, size_t size) {
+    std::vector<unsigned char> header;
+    putBigEndian(header, (uint32_t)size);
+    header.insert(header.end(), type, type + 4);
+    out.write((const char*)header.data(), (std::streamsize)header.size());
+    out.write((const char*)data, (std::streamsize)size);
+
+    uint32_t crc = crc32Update(0, (const unsigned char*)type, 4);
+    crc = crc32Update(crc, data, size);
+    std::vector<unsigned char> footer;
+    putBigEndian(footer, crc);
+    out.write((const char*)footer.data(), (std::streamsize)footer.size());
+}
+
+#ifndef CPP_OBJ_PREVIEW_ZLIB
+// zlib stream of stored (uncompressed) deflate blocks
+static void storeDeflate(const std::vector<unsigned char>& raw, std::vector<unsigned char>& out) {
+    out.clear();
+    out.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    out.push_back(0x78);
+    out.push_back(0x01);
+    size_t offset = 0;
+    do {
+        size_t size = std::min(raw.size() - offset, (size_t)65535);
+        bool last = offset + size == raw.size();
+        out.push_back(last ? 1 : 0);
+        out.push_back((unsigned char)size);
+        out.push_back((unsigned char)(size >> 8));
+        out.push_back((unsigned char)~size);
+        out.push_back((unsigned char)(~size >> 8));
+        out.insert(out.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while (offset < raw.size());
+
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < raw.size();) {
+        // 5552 bytes is the longest run before the sums can overflow
+        size_t end = std::min(raw.size(), i + 5552);
+        for (; i < end; i++) {
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    putBigEndian(out, (b << 16) | a);
+}
+#endif
+
+bool writePng(const std::string& path, const unsigned char* pixels, int width, int height) {
+    TRACE_SCOPE("png", path);
+    // top-down rows, each with the Sub filter: neighbouring pixels of a render are alike
+    size_t row_bytes = (size_t)width * 3;
+    std::vector<unsigned char> raw((row_bytes + 1) * height);
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src = pixels + (size_t)(height - 1 - y) * row_bytes;
+        unsigned char* dst = &raw[(row_bytes + 1) * y];
+        dst[0] = 1;
+        for (size_t i = 0; i < row_bytes; i++) {
+            dst[1 + i] = (unsigned char)(src[i] - (i >= 3 ? src[i - 3] : 0));
+        }
+    }
+
+    std::vector<unsigned char> deflated;
+#ifdef CPP_OBJ_PREVIEW_ZLIB
+    uLongf size = compressBound((uLong)raw.size());
+    deflated.resize(size);
+    if (compress2(deflated.data(), &size, raw.data(), (uLong)raw.size(), 6) != Z_OK) {
+        std::cerr << "Error: Failed to deflate " << path << std::endl;
+        return false;
+    }
+    deflated.resize(size);
+#else
+    storeDeflate(raw, deflated);
+#endif
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error: Failed to create " << path << std::endl;
+        return false;
+    }
+    static const unsigned char SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.write((const char*)SIGNATURE, sizeof(SIGNATURE));
+    std::vector<unsigned char> header;
+    putBigEndian(header, (uint32_t)width);
+    putBigEndian(header, (uint32_t)height);
+    // 8 bit truecolor, deflate, adaptive filtering, no interlace
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    writeChunk(out, "IHDR", header.data(), header.size());
+    writeChunk(out, "IDAT", deflated.data(), deflated.size());
+    writeChunk(out, "IEND", nullptr, 0);
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parseSheetGrid(const std::string& text, int& columns, int& rows) {
+    char separator = 0;
+    char rest = 0;
+    if (std::sscanf(text.c_str(), "%d%c%d%c", &columns, &separator, &rows, &rest) != 3 || (separator != 'x' && separator != 'X')) {
+        return false;
+    }
+    return columns > 0 && rows > 0 && columns <= MAX_SHEET_FRAMES && rows <= MAX_SHEET_FRAMES && columns * rows <= MAX_SHEET_FRAMES;
+}
+
+ContactSheet::ContactSheet(int columns, int rows, int tile_width, int tile_height)
+    : columns(columns), rows(rows), tileWidth(tile_width), tileHeight(tile_height),
+      pixels((size_t)columns * tile_width * rows * tile_height * 3, 0) {}
+
+int ContactSheet::frames() const {
+    return columns * rows;
+}
+
+int ContactSheet::add(int frame, const unsigned char* tile) {
+    if (frame < 0 || frame >= frames()) {
+        return 1;
+    }
+    // the sheet is bottom-up like the tiles, so the first row of tiles is the last in memory
+    int x = frame % columns;
+    int y = rows - 1 - frame / columns;
+    size_t row_bytes = (size_t)tileWidth * 3;
+    size_t sheet_row_bytes = row_bytes * columns;
+    for (int row = 0; row < tileHeight; row++) {
+        std::memcpy(&pixels[(size_t)(y * tileHeight + row) * sheet_row_bytes + x * row_bytes], tile + row * row_bytes, row_bytes);
+    }
+    return 0;
+}
+
+bool ContactSheet::save(const std::string& path) const {
+    return writePng(path, pixels.data(), columns * tileWidth, rows * tileHeight);
+}
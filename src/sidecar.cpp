@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cpp_obj-preview/sidecar.h"
+#include "cpp_obj-preview/hash.h"
+#include "cpp_obj-preview/trace.h"
+
+static const char SIDECAR_MAGIC[8] = {'O', 'B', 'J', 'M', 'E', 'S', 'H', '\0'};
+static const uint32_t SIDECAR_ENDIAN = 0x01020304;
+static const uint32_t SIDECAR_VERSION = 3;
+static const size_t SIDECAR_ALIGN = 64;
+
+enum SidecarSection {
+    SECTION_VERTICES,
+    SECTION_INDICES,
+    SECTION_BATCHES,
+    SECTION_GPU_VERTICES,
+    SECTION_GPU_TEXCOORDS,
+    SECTION_GPU_INDICES,
+    SECTION_GPU_BATCHES,
+    SECTION_METADATA,
+    SECTION_COUNT
+};
+
+struct SidecarHeader {
+    char magic[8];
+    uint32_t endian;
+    uint32_t version;
+    uint64_t sourceHash;
+    // normals missing from the OBJ file were generated with this crease angle
+    float creaseAngle;
+    uint32_t reserved;
+    // lets tools size the model from the header alone
+    float bboxMin[3];
+    float bboxMax[3];
+    uint64_t offsets[SECTION_COUNT];
+    uint64_t sizes[SECTION_COUNT];
+};
+
+static size_t alignUp(size_t value) {
+    return (value + SIDECAR_ALIGN - 1) / SIDECAR_ALIGN * SIDECAR_ALIGN;
+}
+
+static void putU64(std::string& out, uint64_t value) {
+    out.append((const char*)&value, sizeof(value));
+}
+
+static void putFloats(std::string& out, const float* values, size_t count) {
+    out.append((const char*)values, count * sizeof(float));
+}
+
+static void putString(std::string& out, const std::string& value) {
+    putU64(out, value.size());
+    out.append(value);
+}
+
+// Bounds-checked reader over the metadata section
+struct MetadataReader {
+    const char* p;
+    const char* end;
+    bool ok;
+
+    bool take(void* out, size_t size) {
+        if (!ok || (size_t)(end - p) < size) {
+            ok = false;
+            return false;
+        }
+        std::memcpy(out, p, size);
+        p += size;
+        return true;
+    }
+    uint64_t u64() {
+        uint64_t value = 0;
+        take(&value, sizeof(value));
+        return value;
+    }
+    std::string string() {
+        uint64_t size = u64();
+        if (!ok || (uint64_t)(end - p) < size) {
+            ok = false;
+            return "";
+        }
+        std::string value(p, (size_t)size);
+        p += size;
+        return value;
+    }
+};
+
+static std::string serializeMetadata(const ObjModel& model) {
+    std::string out;
+    putU64(out, model.vertexCount);
+    putU64(out, model.normalCount);
+    putU64(out, model.texcoordCount);
+
+    putU64(out, model.comments.size());
+    for (const auto& comment : model.comments) {
+        putString(out, comment);
+    }
+
+    putU64(out, model.shapeFaces.size());
+    for (const auto& shape : model.shapeFaces) {
+        putString(out, shape.first);
+        putU64(out, shape.second);
+    }
+
+    putU64(out, model.materials.size());
+    for (const auto& mat : model.materials) {
+        putString(out, mat.name);
+        putFloats(out, mat.ambient, 3);
+        putFloats(out, mat.diffuse, 3);
+        putFloats(out, mat.specular, 3);
+        putFloats(out, mat.transmittance, 3);
+        putFloats(out, mat.emission, 3);
+        float scalars[3] = {mat.shininess, mat.ior, mat.dissolve};
+        putFloats(out, scalars, 3);
+        putU64(out, (uint64_t)(int64_t)mat.illum);
+        putString(out, mat.diffuse_texname);
+    }
+    return out;
+}
+
+static bool parseMetadata(const char* data, size_t size, ObjModel& model) {
+    MetadataReader in{data, data + size, true};
+    model.vertexCount = in.u64();
+    model.normalCount = in.u64();
+    model.texcoordCount = in.u64();
+
+    uint64_t count = in.u64();
+    for (uint64_t i = 0; in.ok && i < count; i++) {
+        model.comments.push_back(in.string());
+    }
+
+    count = in.u64();
+    for (uint64_t i = 0; in.ok && i < count; i++) {
+        std::string name = in.string();
+        model.shapeFaces.push_back({name, (size_t)in.u64()});
+    }
+
+    count = in.u64();
+    for (uint64_t i = 0; in.ok && i < count; i++) {
+        tinyobj::material_t mat;
+        mat.name = in.string();
+        in.take(mat.ambient, sizeof(mat.ambient));
+        in.take(mat.diffuse, sizeof(mat.diffuse));
+        in.take(mat.specular, sizeof(mat.specular));
+        in.take(mat.transmittance, sizeof(mat.transmittance));
+        in.take(mat.emission, sizeof(mat.emission));
+        float scalars[3] = {};
+        in.take(scalars, sizeof(scalars));
+        mat.shininess = scalars[0];
+        mat.ior = scalars[1];
+        mat.dissolve = scalars[2];
+        mat.illum = (int)(int64_t)in.u64();
+        mat.diffuse_texname = in.string();
+        model.materials.push_back(mat);
+    }
+    return in.ok;
+}
+
+// Checks every draw of the optimized stream against its index and vertex data,
+// together they must cover the arena's triangles
+static bool validGpuStream(const GpuArena& gpu, size_t arena_indices) {
+    uint64_t indices = 0;
+    for (size_t i = 0; i < gpu.batchCount; i++) {
+        const GpuBatch& batch = gpu.batches[i];
+        if (batch.indexType != GL_UNSIGNED_SHORT && batch.indexType != GL_UNSIGNED_INT) {
+            return false;
+        }
+        size_t width = batch.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+        if (batch.indexOffset % width != 0 || batch.indexOffset > gpu.indexBytes || batch.indexCount > (gpu.indexBytes - batch.indexOffset) / width ||
+            batch.baseVertex < 0 || (size_t)batch.baseVertex > gpu.vertexCount) {
+            return false;
+        }
+        uint32_t max_index = 0;
+        for (uint64_t j = 0; j < batch.indexCount; j++) {
+            const uint8_t* p = gpu.indices + batch.indexOffset + j * width;
+            if (width == sizeof(uint16_t)) {
+                uint16_t index;
+                std::memcpy(&index, p, sizeof(index));
+                max_index = std::max(max_index, (uint32_t)index);
+            } else {
+                uint32_t index;
+                std::memcpy(&index, p, sizeof(index));
+                max_index = std::max(max_index, index);
+            }
+        }
+        if (batch.indexCount > 0 && max_index >= gpu.vertexCount - batch.baseVertex) {
+            return false;
+        }
+        indices += batch.indexCount;
+    }
+    return indices == arena_indices;
+}
+
+MeshSidecar::MeshSidecar()
+    : data(nullptr), size(0), view{nullptr, 0, nullptr, 0, nullptr, 0}, gpuView{nullptr, 0, nullptr, nullptr, 0, nullptr, 0} {}
+
+MeshSidecar::~MeshSidecar() {
+    if (data) {
+        munmap(data, size);
+    }
+}
+
+int MeshSidecar::open(const std::string& path, uint64_t source_hash, float crease_angle, ObjModel& model) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SidecarHeader)) {
+        ::close(fd);
+        return 1;
+    }
+    size = (size_t)info.st_size;
+    traceCount(TraceCounter::BytesRead, (int64_t)size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return 1;
+    }
+    data = mapped;
+    madvise(data, size, MADV_WILLNEED);
+
+    const char* base = (const char*)data;
+    SidecarHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0 || header.endian != SIDECAR_ENDIAN ||
+        header.version != SIDECAR_VERSION || header.sourceHash != source_hash || header.creaseAngle != crease_angle) {
+        return 1;
+    }
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        if (header.offsets[i] % SIDECAR_ALIGN != 0 || header.offsets[i] > size || header.sizes[i] > size - header.offsets[i]) {
+            return 1;
+        }
+    }
+    if (header.sizes[SECTION_VERTICES] % (8 * sizeof(float)) != 0 || header.sizes[SECTION_INDICES] % sizeof(unsigned int) != 0 ||
+        header.sizes[SECTION_BATCHES] % sizeof(MeshBatch) != 0 || header.sizes[SECTION_GPU_VERTICES] % sizeof(GpuVertex) != 0 ||
+        header.sizes[SECTION_GPU_BATCHES] % sizeof(GpuBatch) != 0) {
+        return 1;
+    }
+
+    view.vertices = (const float*)(base + header.offsets[SECTION_VERTICES]);
+    view.vertexCount = header.sizes[SECTION_VERTICES] / (8 * sizeof(float));
+    view.indices = (const unsigned int*)(base + header.offsets[SECTION_INDICES]);
+    view.indexCount = header.sizes[SECTION_INDICES] / sizeof(unsigned int);
+    view.batches = (const MeshBatch*)(base + header.offsets[SECTION_BATCHES]);
+    view.batchCount = header.sizes[SECTION_BATCHES] / sizeof(MeshBatch);
+    for (size_t i = 0; i < view.batchCount; i++) {
+        const MeshBatch& batch = view.batches[i];
+        if (batch.indexOffset > view.indexCount || batch.indexCount > view.indexCount - batch.indexOffset) {
+            return 1;
+        }
+    }
+    // a damaged file with a matching header must not send analysis or upload past the vertices
+    unsigned int max_index = 0;
+    for (size_t i = 0; i < view.indexCount; i++) {
+        max_index = std::max(max_index, view.indices[i]);
+    }
+    if (view.indexCount > 0 && max_index >= view.vertexCount) {
+        return 1;
+    }
+
+    gpuView.vertices = (const GpuVertex*)(base + header.offsets[SECTION_GPU_VERTICES]);
+    gpuView.vertexCount = header.sizes[SECTION_GPU_VERTICES] / sizeof(GpuVertex);
+    if (header.sizes[SECTION_GPU_TEXCOORDS] != 0) {
+        if (header.sizes[SECTION_GPU_TEXCOORDS] != gpuView.vertexCount * 2 * sizeof(float)) {
+            return 1;
+        }
+        gpuView.texcoords = (const float*)(base + header.offsets[SECTION_GPU_TEXCOORDS]);
+    }
+    gpuView.indices = (const uint8_t*)(base + header.offsets[SECTION_GPU_INDICES]);
+    gpuView.indexBytes = header.sizes[SECTION_GPU_INDICES];
+    gpuView.batches = (const GpuBatch*)(base + header.offsets[SECTION_GPU_BATCHES]);
+    gpuView.batchCount = header.sizes[SECTION_GPU_BATCHES] / sizeof(GpuBatch);
+    if (!validGpuStream(gpuView, view.indexCount)) {
+        return 1;
+    }
+
+    if (!parseMetadata(base + header.offsets[SECTION_METADATA], header.sizes[SECTION_METADATA], model)) {
+        return 1;
+    }
+    return 0;
+}
+
+MeshArena MeshSidecar::arena() const {
+    return view;
+}
+
+GpuArena MeshSidecar::gpuArena() const {
+    return gpuView;
+}
+
+std::string sidecarPath(const std::string& cache_dir, uint64_t source_hash) {
+    return (std::filesystem::path(cache_dir) / (hashToHex(source_hash) + ".mesh")).string();
+}
+
+uint64_t sidecarBytes(const PackedMeshes& packed, bool texcoords) {
+    // the optimized stream has about as many vertices, and at most 32-bit indices
+    size_t vertex_count = packed.vertices.size() / 8;
+    return alignUp(sizeof(SidecarHeader)) + alignUp(packed.vertices.size() * sizeof(float)) + alignUp(packed.indices.size() * sizeof(unsigned int)) +
+           alignUp(packed.batches.size() * sizeof(MeshBatch)) + alignUp(vertex_count * sizeof(GpuVertex)) +
+           alignUp(texcoords ? vertex_count * 2 * sizeof(float) : 0) + alignUp(packed.indices.size() * sizeof(uint32_t));
+}
+
+int loadSidecar(const std::string& path, uint64_t source_hash, float crease_angle, ObjModel& model) {
+    TRACE_SCOPE("sidecar_load", path);
+    std::shared_ptr<MeshSidecar> sidecar = std::make_shared<MeshSidecar>();
+    ObjModel loaded;
+    loaded.filename = model.filename;
+    loaded.sourceHash = source_hash;
+    if (sidecar->open(path, source_hash, crease_angle, loaded) != 0) {
+        return 1;
+    }
+    loaded.sidecar = sidecar;
+    model = std::move(loaded);
+    // used sidecars are evicted last, like cache entries
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    return 0;
+}
+
+int writeSidecar(const std::string& path, uint64_t source_hash, float crease_angle, const ObjModel& model, const PackedMeshes& packed,
+                 const GpuMeshes& gpu, const glm::vec3& bbox_min, const glm::vec3& bbox_max) {
+    TRACE_SCOPE("sidecar_write", path);
+    std::string metadata = serializeMetadata(model);
+    const void* sections[SECTION_COUNT] = {packed.vertices.data(), packed.indices.data(), packed.batches.data(), gpu.vertices.data(),
+                                           gpu.texcoords.data(), gpu.indices.data(), gpu.batches.data(), metadata.data()};
+
+    SidecarHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    header.endian = SIDECAR_ENDIAN;
+    header.version = SIDECAR_VERSION;
+    header.sourceHash = source_hash;
+    header.creaseAngle = crease_angle;
+    for (int c = 0; c < 3; c++) {
+        header.bboxMin[c] = bbox_min[c];
+        header.bboxMax[c] = bbox_max[c];
+    }
+    header.sizes[SECTION_VERTICES] = packed.vertices.size() * sizeof(float);
+    header.sizes[SECTION_INDICES] = packed.indices.size() * sizeof(unsigned int);
+    header.sizes[SECTION_BATCHES] = packed.batches.size() * sizeof(MeshBatch);
+    header.sizes[SECTION_GPU_VERTICES] = gpu.vertices.size() * sizeof(GpuVertex);
+    header.sizes[SECTION_GPU_TEXCOORDS] = gpu.texcoords.size() * sizeof(float);
+    header.sizes[SECTION_GPU_INDICES] = gpu.indices.size();
+    header.sizes[SECTION_GPU_BATCHES] = gpu.batches.size() * sizeof(GpuBatch);
+    header.sizes[SECTION_METADATA] = metadata.size();
+    size_t offset = alignUp(sizeof(header));
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        header.offsets[i] = offset;
+        offset = alignUp(offset + header.sizes[i]);
+    }
+
+    // written under a temporary name and renamed so readers never map a partial file,
+    // serve workers of one process may write the same sidecar at once
+    std::string temp_path = path + ".tmp" + std::to_string(getpid()) + "-" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Error: Could not write mesh sidecar " << path << std::endl;
+        return 1;
+    }
+    static const char padding[SIDECAR_ALIGN] = {};
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    size_t written = sizeof(header);
+    for (int i = 0; ok && i < SECTION_COUNT; i++) {
+        ok = std::fwrite(padding, 1, header.offsets[i] - written, file) == header.offsets[i] - written;
+        if (ok && header.sizes[i] > 0) {
+            ok = std::fwrite(sections[i], 1, header.sizes[i], file) == header.sizes[i];
+        }
+        written = header.offsets[i] + header.sizes[i];
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        std::cerr << "Error: Could not write mesh sidecar " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "cpp_obj-preview/stream.h"
+#include "cpp_obj-preview/optimize.h"
+#include "cpp_obj-preview/trace.h"
+
+static const size_t CHUNK_TRIANGLES = 1 << 16;
+// CPU memory of one chunk between the parser and the GPU: arena vertices and indices, then the optimized copy
+static const size_t CHUNK_BYTES = CHUNK_TRIANGLES * 3 * (8 * sizeof(float) + sizeof(unsigned int) + sizeof(GpuVertex) + sizeof(uint32_t));
+// GPU blocks start at 1 MiB of vertices and double up to 64 MiB
+static const size_t MIN_BLOCK_VERTICES = (1 << 20) / sizeof(GpuVertex);
+static const size_t MAX_BLOCK_VERTICES = (64 << 20) / sizeof(GpuVertex);
+// two 16-bit triangles per vertex, what closed meshes average
+static const size_t BLOCK_INDEX_BYTES_PER_VERTEX = 12;
+
+// Bounding box and surface sums of the chunks streamed so far
+struct StreamSums {
+    glm::vec3 bboxMin = glm::vec3(FLT_MAX);
+    glm::vec3 bboxMax = glm::vec3(-FLT_MAX);
+    double area = 0.0;
+    double volume = 0.0;
+    glm::dvec3 centroid = glm::dvec3(0.0);
+    size_t triangles = 0;
+    size_t degenerateFaces = 0;
+};
+
+struct OptimizedChunk {
+    GpuMeshes gpu;
+    StreamSums sums;
+};
+
+static OptimizedChunk optimizeChunk(const MeshData& data) {
+    OptimizedChunk chunk;
+    StreamSums& sums = chunk.sums;
+    for (size_t v = 0; v < data.vertices.size(); v += 8) {
+        glm::vec3 p(data.vertices[v], data.vertices[v + 1], data.vertices[v + 2]);
+        sums.bboxMin = glm::min(sums.bboxMin, p);
+        sums.bboxMax = glm::max(sums.bboxMax, p);
+    }
+    // the same sums as analyzeGeometry, degenerate faces only by repeated corners
+    // since the needle threshold depends on the final bounding box
+    sums.triangles = data.indices.size() / 3;
+    for (size_t t = 0; t + 2 < data.indices.size(); t += 3) {
+        unsigned int id[3] = {data.indices[t], data.indices[t + 1], data.indices[t + 2]};
+        glm::dvec3 p[3];
+        for (int k = 0; k < 3; k++) {
+            const float* v = &data.vertices[(size_t)id[k] * 8];
+            p[k] = glm::dvec3(v[0], v[1], v[2]);
+        }
+        if (id[0] == id[1] || id[1] == id[2] || id[0] == id[2]) {
+            sums.degenerateFaces++;
+            continue;
+        }
+        double area = glm::length(glm::cross(p[1] - p[0], p[2] - p[0])) * 0.5;
+        sums.area += area;
+        sums.volume += glm::dot(p[0], glm::cross(p[1], p[2])) / 6.0;
+        sums.centroid += (p[0] + p[1] + p[2]) * (area / 3.0);
+    }
+
+    MeshBatch batch = {data.materialId, 0, 0, data.indices.size()};
+    MeshArena arena = {data.vertices.data(), data.vertices.size() / 8, data.indices.data(), data.indices.size(), &batch, 1};
+    chunk.gpu = optimizeMeshes(arena, false, 1);
+    return chunk;
+}
+
+// Appends optimized chunks to the current GPU block, opening a larger one
+// when it is full. Ranges are written once, so they are mapped unsynchronized.
+class StreamUploader {
+public:
+    ~StreamUploader() {
+        glBindVertexArray(0);
+    }
+
+    int append(const GpuMeshes& gpu, std::vector<MeshGL>& meshes) {
+        if (gpu.batches.empty()) return 0;
+        size_t vertex_count = gpu.vertices.size();
+        size_t index_offset = (indexBytes + 3) & ~(size_t)3;
+        if (vao == 0 || vertexCount + vertex_count > vertexCapacity || index_offset + gpu.indices.size() > indexCapacity) {
+            openBlock(vertex_count, gpu.indices.size());
+            index_offset = 0;
+        }
+
+        // the element buffer is VAO state, the vertex buffer is not
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        if (!writeRange(GL_ARRAY_BUFFER, vertexCount * sizeof(GpuVertex), gpu.vertices.data(), vertex_count * sizeof(GpuVertex)) ||
+            !writeRange(GL_ELEMENT_ARRAY_BUFFER, index_offset, gpu.indices.data(), gpu.indices.size())) {
+            std::cerr << "Error: Failed to write streamed geometry into a mapped GPU buffer\n";
+            return 1;
+        }
+        for (const auto& batch : gpu.batches) {
+            meshes.push_back({vao, vbo, ebo, (int)batch.indexCount, batch.materialId, index_offset + batch.indexOffset, batch.indexType,
+                              (GLint)vertexCount + batch.baseVertex});
+        }
+        vertexCount += vertex_count;
+        indexBytes = index_offset + gpu.indices.size();
+        uploadedBytes += vertex_count * sizeof(GpuVertex) + gpu.indices.size();
+        return 0;
+    }
+
+    size_t uploaded() const {
+        return uploadedBytes;
+    }
+
+private:
+    void openBlock(size_t vertex_count, size_t index_bytes) {
+        blockVertices = std::min(MAX_BLOCK_VERTICES, blockVertices == 0 ? MIN_BLOCK_VERTICES : blockVertices * 2);
+        vertexCapacity = std::max(blockVertices, vertex_count);
+        indexCapacity = std::max(blockVertices * BLOCK_INDEX_BYTES_PER_VERTEX, index_bytes);
+        vertexCount = 0;
+        indexBytes = 0;
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(vertexCapacity * sizeof(GpuVertex)), nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexCapacity, nullptr, GL_STATIC_DRAW);
+        setVertexLayout();
+    }
+
+    bool writeRange(GLenum target, size_t offset, const void* data, size_t size) {
+        if (size == 0) return true;
+        void* mapped = glMapBufferRange(target, (GLintptr)offset, (GLsizeiptr)size,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!mapped) return false;
+        std::memcpy(mapped, data, size);
+        return glUnmapBuffer(target) == GL_TRUE;
+    }
+
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    size_t blockVertices = 0;
+    size_t vertexCapacity = 0;
+    size_t vertexCount = 0;
+    size_t indexCapacity = 0;
+    size_t indexBytes = 0;
+    size_t uploadedBytes = 0;
+};
+
+int streamModel(const std::string& filename, size_t memory_limit, ObjModel& model, GeometryStats& stats, std::vector<MeshGL>& meshes) {
+    TRACE_SCOPE("stream", filename);
+    auto stream_start = std::chrono::steady_clock::now();
+    // the chunk being optimized and the one being built live next to the parser tables
+    size_t table_limit = 0;
+    if (memory_limit > 0) {
+        if (memory_limit <= 2 * CHUNK_BYTES) {
+            std::cerr << "Error: memory-limit is too small to stream " << filename << std::endl;
+            return 1;
+        }
+        table_limit = memory_limit - 2 * CHUNK_BYTES;
+    }
+
+    StreamUploader uploader;
+    StreamSums sums;
+    size_t chunks = 0;
+    std::future<OptimizedChunk> pending;
+    auto finishPending = [&]() {
+        if (!pending.valid()) return 0;
+        OptimizedChunk chunk = pending.get();
+        sums.bboxMin = glm::min(sums.bboxMin, chunk.sums.bboxMin);
+        sums.bboxMax = glm::max(sums.bboxMax, chunk.sums.bboxMax);
+        sums.area += chunk.sums.area;
+        sums.volume += chunk.sums.volume;
+        sums.centroid += chunk.sums.centroid;
+        sums.triangles += chunk.sums.triangles;
+        sums.degenerateFaces += chunk.sums.degenerateFaces;
+        TRACE_SCOPE("upload");
+        return uploader.append(chunk.gpu, meshes);
+    };
+    ObjChunkSink sink = [&](const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape) {
+        // deduplicated here, the worker must not read attrib while the parser grows it
+        std::shared_ptr<MeshData> data = std::make_shared<MeshData>(buildMesh(attrib, shape));
+        traceCount(TraceCounter::VerticesDeduped, (int64_t)data->indices.size() - (int64_t)(data->vertices.size() / 8));
+        if (finishPending() != 0) return 1;
+        pending = std::async(std::launch::async, [data]() {
+            TRACE_SCOPE("optimize_chunk");
+            return optimizeChunk(*data);
+        });
+        chunks++;
+        return 0;
+    };
+
+    int ret = streamObjNative(filename, CHUNK_TRIANGLES, table_limit, model, sink);
+    if (finishPending() != 0) {
+        ret = 1;
+    }
+    // the tables were only needed to resolve face references
+    std::vector<float>().swap(model.attrib.vertices);
+    std::vector<float>().swap(model.attrib.normals);
+    if (ret != 0) {
+        deleteMeshes(meshes);
+        std::cerr << "Error: Failed to stream OBJ file: " << filename << std::endl;
+        return 1;
+    }
+
+    stats = GeometryStats();
+    stats.topology = false;
+    stats.triangles = sums.triangles;
+    stats.degenerateFaces = sums.degenerateFaces;
+    stats.surfaceArea = sums.area;
+    stats.signedVolume = sums.volume;
+    if (sums.triangles > 0) {
+        stats.bboxMin = sums.bboxMin;
+        stats.bboxMax = sums.bboxMax;
+    } else {
+        stats.bboxMin = stats.bboxMax = glm::vec3(0.0f);
+    }
+    stats.centroid = sums.area > 0.0 ? glm::vec3(sums.centroid / sums.area) : (stats.bboxMin + stats.bboxMax) * 0.5f;
+
+    std::cout << "Streamed " << filename << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stream_start).count() << " ms: "
+              << sums.triangles << " triangles in " << chunks << " chunks, " << (uploader.uploaded() >> 20) << " MiB on the GPU, peak RSS "
+              << (peakResidentBytes() >> 20) << " MiB\n";
+    return 0;
+}
+
+bool exceedsMemoryLimit(const std::string& filename, size_t memory_limit) {
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 && (size_t)info.st_size > memory_limit;
+}
+
+size_t peakResidentBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // kilobytes on Linux
+    return (size_t)usage.ru_maxrss * 1024;
+}
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_STDIO
+#include <stb_image.h>
+#include "cpp_obj-preview/texture.h"
+#include "cpp_obj-preview/hash.h"
+#include "cpp_obj-preview/parallel.h"
+#include "cpp_obj-preview/trace.h"
+
+namespace fs = std::filesystem;
+
+int textureSizeLimit(int width, int height) {
+    return std::max(1, std::max(width, height));
+}
+
+// One mip level down: every texel averages the 2x2 block it covers, an odd last row or column repeats
+static void halveImage(const unsigned char* source, int width, int height, std::vector<unsigned char>& target, int& target_width, int& target_height) {
+    target_width = std::max(1, width / 2);
+    target_height = std::max(1, height / 2);
+    target.resize((size_t)target_width * target_height * 3);
+    for (int y = 0; y < target_height; y++) {
+        const unsigned char* row0 = source + (size_t)std::min(2 * y, height - 1) * width * 3;
+        const unsigned char* row1 = source + (size_t)std::min(2 * y + 1, height - 1) * width * 3;
+        unsigned char* out = &target[(size_t)y * target_width * 3];
+        for (int x = 0; x < target_width; x++) {
+            size_t x0 = (size_t)std::min(2 * x, width - 1) * 3;
+            size_t x1 = (size_t)std::min(2 * x + 1, width - 1) * 3;
+            for (int c = 0; c < 3; c++) {
+                out[x * 3 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+bool decodeTexture(const unsigned char* data, size_t size, int size_limit, TextureImage& image) {
+    if (size > INT_MAX) {
+        return false;
+    }
+    int width, height, channels;
+    stbi_uc* decoded = stbi_load_from_memory(data, (int)size, &width, &height, &channels, 3);
+    if (!decoded) {
+        return false;
+    }
+    // the first level reads stb's buffer, later ones ping-pong between two
+    std::vector<unsigned char> levels[2];
+    const unsigned char* level = decoded;
+    int current = 0;
+    while (std::max(width, height) / 2 >= size_limit) {
+        halveImage(level, width, height, levels[current], width, height);
+        level = levels[current].data();
+        current ^= 1;
+    }
+    // stb decodes top row first, texcoord v = 0 is the bottom row
+    image.width = width;
+    image.height = height;
+    image.levels.assign(1, std::vector<unsigned char>((size_t)width * height * 3));
+    size_t row_bytes = (size_t)width * 3;
+    for (int y = 0; y < height; y++) {
+        std::copy(level + (size_t)(height - 1 - y) * row_bytes, level + (size_t)(height - y) * row_bytes, &image.levels[0][(size_t)y * row_bytes]);
+    }
+    stbi_image_free(decoded);
+    while (width > 1 || height > 1) {
+        std::vector<unsigned char> next;
+        halveImage(image.levels.back().data(), width, height, next, width, height);
+        image.levels.push_back(std::move(next));
+    }
+    return true;
+}
+
+TextureCache::TextureCache(size_t max_bytes) : maxBytes(max_bytes), bytes(0) {}
+
+void TextureCache::evict() {
+    for (auto it = order.end(); bytes > maxBytes && it != order.begin();) {
+        --it;
+        Entry& entry = entries.at(*it);
+        if (entry.bytes == 0) {
+            continue;
+        }
+        bytes -= entry.bytes;
+        entries.erase(*it);
+        it = order.erase(it);
+    }
+}
+
+std::shared_ptr<const TextureImage> TextureCache::image(const std::string& path, int size_limit) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Error: Failed to open texture " << path << std::endl;
+        return nullptr;
+    }
+    std::vector<unsigned char> data((size_t)file.tellg());
+    file.seekg(0);
+    if (!file.read((char*)data.data(), (std::streamsize)data.size())) {
+        std::cerr << "Error: Failed to read texture " << path << std::endl;
+        return nullptr;
+    }
+    traceCount(TraceCounter::BytesRead, (int64_t)data.size());
+    Xxh64 hasher;
+    hasher.update(data.data(), data.size());
+    uint64_t hash = hasher.digest();
+    std::string key = hashToHex(hash) + "@" + std::to_string(size_limit);
+
+    std::promise<std::shared_ptr<const TextureImage>> decoded;
+    std::shared_future<std::shared_ptr<const TextureImage>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            order.splice(order.begin(), order, found->second.position);
+            pending = found->second.image;
+        } else {
+            order.push_front(key);
+            entries[key] = {decoded.get_future().share(), 0, order.begin()};
+        }
+    }
+    // another material or model is decoding the same bytes
+    if (pending.valid()) {
+        return pending.get();
+    }
+
+    std::shared_ptr<TextureImage> result = std::make_shared<TextureImage>();
+    result->hash = hash;
+    {
+        TRACE_SCOPE("texture_decode", path);
+        if (!decodeTexture(data.data(), data.size(), size_limit, *result)) {
+            std::cerr << "Error: Failed to decode texture " << path << ": " << stbi_failure_reason() << std::endl;
+            result.reset();
+        }
+    }
+    decoded.set_value(result);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(key);
+    if (found != entries.end()) {
+        // failures stay cached too, the same bytes fail the same way
+        found->second.bytes = 1;
+        if (result) {
+            for (const auto& level : result->levels) {
+                found->second.bytes += level.size();
+            }
+        }
+        bytes += found->second.bytes;
+        evict();
+    }
+    return result;
+}
+
+std::future<MaterialImages> TextureCache::load(const std::vector<tinyobj::material_t>& materials, const std::string& base_dir, int size_limit, int threads) {
+    // materials sharing a file name read it once
+    std::vector<std::string> names;
+    std::unordered_map<std::string, size_t> name_ids;
+    std::vector<size_t> material_names(materials.size(), SIZE_MAX);
+    for (size_t i = 0; i < materials.size(); i++) {
+        std::string name = materials[i].diffuse_texname;
+        if (name.empty()) {
+            continue;
+        }
+        std::replace(name.begin(), name.end(), '\\', '/');
+        auto inserted = name_ids.insert({name, names.size()});
+        material_names[i] = inserted.first->second;
+        if (inserted.second) {
+            names.push_back(name);
+        }
+    }
+    if (names.empty()) {
+        std::promise<MaterialImages> none;
+        none.set_value(MaterialImages(materials.size()));
+        return none.get_future();
+    }
+    return std::async(std::launch::async, [this, names, material_names, base_dir, size_limit, threads]() {
+        TRACE_SCOPE("textures");
+        std::vector<std::shared_ptr<const TextureImage>> images(names.size());
+        parallelFor(names.size(), threads, [&](size_t i) {
+            // same lookup order as the MTL files: next to the OBJ file, then the working directory
+            std::string path = (fs::path(base_dir) / names[i]).string();
+            std::error_code ec;
+            if (!fs::exists(path, ec)) {
+                path = names[i];
+            }
+            if (!fs::exists(path, ec)) {
+                std::cerr << "Error: Texture " << names[i] << " not found\n";
+                return;
+            }
+            images[i] = image(path, size_limit);
+        });
+        MaterialImages result(material_names.size());
+        for (size_t i = 0; i < material_names.size(); i++) {
+            if (material_names[i] != SIZE_MAX) {
+                result[i] = images[material_names[i]];
+            }
+        }
+        return result;
+    });
+}
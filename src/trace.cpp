@@ -0,0 +1,180 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include "cpp_obj-preview/trace.h"
+
+std::atomic<bool> traceActive(false);
+std::atomic<int64_t> traceCounters[(int)TraceCounter::Count];
+
+static const char* COUNTER_NAMES[] = {"bytes_read", "vertices_deduped", "draw_calls", "frames_read_back", "gpu_ns"};
+static const uint32_t GPU_TRACK = 0;
+// events kept per trace, later ones are only counted so a long serve session stays bounded
+static const size_t MAX_TRACE_EVENTS = 1 << 18;
+
+struct TraceEvent {
+    const char* name;
+    std::string detail;
+    double start;
+    double duration;
+};
+
+// Each thread appends to its own buffer, the registry only grows so the
+// thread_local pointers stay valid after their threads exit
+struct TraceBuffer {
+    uint32_t tid;
+    std::vector<TraceEvent> events;
+};
+
+static std::chrono::steady_clock::time_point traceStart;
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<TraceBuffer>> registry;
+static TraceBuffer gpuBuffer = {GPU_TRACK, {}};
+static std::atomic<size_t> recordedEvents(0);
+static std::atomic<size_t> droppedEvents(0);
+
+// Claims one of the MAX_TRACE_EVENTS slots
+static bool keepEvent() {
+    if (recordedEvents.fetch_add(1, std::memory_order_relaxed) < MAX_TRACE_EVENTS) return true;
+    droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+static TraceBuffer& localBuffer() {
+    thread_local TraceBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.emplace_back(new TraceBuffer{(uint32_t)registry.size() + 1, {}});
+        buffer = registry.back().get();
+    }
+    return *buffer;
+}
+
+void startTrace() {
+    traceStart = std::chrono::steady_clock::now();
+    for (auto& counter : traceCounters) {
+        counter.store(0);
+    }
+    recordedEvents.store(0);
+    droppedEvents.store(0);
+    // the starting thread becomes track 1
+    localBuffer();
+    traceActive.store(true);
+}
+
+double traceMicroseconds() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+void TraceScope::finish() {
+    if (!keepEvent()) return;
+    localBuffer().events.push_back({name, std::move(detail), start, traceMicroseconds() - start});
+}
+
+void traceGpuEvent(const char* name, double start_us, double duration_us) {
+    if (!traceEnabled() || !keepEvent()) return;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    gpuBuffer.events.push_back({name, "", start_us, duration_us});
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char)c < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void writeEvents(std::ostream& out, const TraceBuffer& buffer) {
+    for (const auto& event : buffer.events) {
+        out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.tid
+            << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+        if (!event.detail.empty()) {
+            out << ",\"args\":{\"detail\":\"" << jsonEscape(event.detail) << "\"}";
+        }
+        out << "}";
+    }
+}
+
+int writeTrace(const std::string& path, std::string& summary) {
+    traceActive.store(false);
+    double end = traceMicroseconds();
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        std::cerr << "Error: Failed to create trace file " << path << std::endl;
+        return 1;
+    }
+    out << std::fixed;
+    out.precision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    out << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GPU_TRACK << ",\"args\":{\"name\":\"GPU\"}}";
+    for (const auto& buffer : registry) {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"" << (buffer->tid == 1 ? "main" : "thread " + std::to_string(buffer->tid)) << "\"}}";
+    }
+    writeEvents(out, gpuBuffer);
+    for (const auto& buffer : registry) {
+        writeEvents(out, *buffer);
+    }
+    for (int c = 0; c < (int)TraceCounter::Count; c++) {
+        out << ",\n{\"name\":\"" << COUNTER_NAMES[c] << "\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":" << end
+            << ",\"args\":{\"value\":" << traceCounters[c].load() << "}}";
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed to write trace file " << path << std::endl;
+        return 1;
+    }
+
+    // total time and count per event name, main thread events first
+    std::vector<std::pair<const char*, std::pair<size_t, double>>> totals;
+    for (const auto& buffer : registry) {
+        for (const auto& event : buffer->events) {
+            auto it = totals.begin();
+            while (it != totals.end() && std::strcmp(it->first, event.name) != 0) it++;
+            if (it == totals.end()) {
+                totals.push_back({event.name, {0, 0.0}});
+                it = totals.end() - 1;
+            }
+            it->second.first++;
+            it->second.second += event.duration;
+        }
+    }
+    std::ostringstream line;
+    line.setf(std::ios::fixed);
+    line.precision(1);
+    line << "Trace:";
+    for (const auto& total : totals) {
+        line << " " << total.first;
+        if (total.second.first > 1) line << " " << total.second.first << "x";
+        line << " " << total.second.second / 1000.0 << " ms,";
+    }
+    line << " " << traceCounters[(int)TraceCounter::BytesRead].load() / 1048576.0 << " MiB read, "
+         << traceCounters[(int)TraceCounter::VerticesDeduped].load() << " vertices deduped, "
+         << traceCounters[(int)TraceCounter::DrawCalls].load() << " draw calls, "
+         << traceCounters[(int)TraceCounter::FramesReadBack].load() << " frames read back, "
+         << traceCounters[(int)TraceCounter::GpuNanoseconds].load() / 1e6 << " ms GPU";
+    if (droppedEvents.load() > 0) {
+        line << ", " << droppedEvents.load() << " events past the first " << MAX_TRACE_EVENTS << " dropped";
+    }
+    line << " -> " << path;
+    summary = line.str();
+    return 0;
+}
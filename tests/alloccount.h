@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of operator new calls the process has made so far. alloccount.cpp
+// replaces the global operator new of the executable it is linked into.
+uint64_t allocationCount();
@@ -0,0 +1,180 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include "gifread.h"
+
+static const int MAX_CODES = 4096;
+
+static int readShort(const std::vector<uint8_t>& data, size_t pos) {
+    return data[pos] | (data[pos + 1] << 8);
+}
+
+// Concatenates the data sub-blocks starting at pos and moves pos past their terminator
+static bool readSubBlocks(const std::vector<uint8_t>& data, size_t& pos, std::vector<uint8_t>* out) {
+    while (pos < data.size()) {
+        size_t size = data[pos++];
+        if (size == 0) {
+            return true;
+        }
+        if (pos + size > data.size()) {
+            return false;
+        }
+        if (out) {
+            out->insert(out->end(), data.begin() + pos, data.begin() + pos + size);
+        }
+        pos += size;
+    }
+    return false;
+}
+
+static bool decodeLzw(const std::vector<uint8_t>& lzw, int min_code_size, size_t pixel_count, std::vector<uint8_t>& indices) {
+    int clear = 1 << min_code_size;
+    int end = clear + 1;
+    int next = clear + 2;
+    int code_size = min_code_size + 1;
+    int prev = -1;
+    uint8_t first = 0;
+    uint16_t prefix[MAX_CODES];
+    uint8_t suffix[MAX_CODES];
+    std::vector<uint8_t> stack;
+
+    uint32_t bit_buffer = 0;
+    int bit_count = 0;
+    size_t pos = 0;
+    indices.clear();
+    for (;;) {
+        while (bit_count < code_size && pos < lzw.size()) {
+            bit_buffer |= (uint32_t)lzw[pos++] << bit_count;
+            bit_count += 8;
+        }
+        if (bit_count < code_size) {
+            break;
+        }
+        int code = bit_buffer & ((1 << code_size) - 1);
+        bit_buffer >>= code_size;
+        bit_count -= code_size;
+
+        if (code == clear) {
+            code_size = min_code_size + 1;
+            next = clear + 2;
+            prev = -1;
+            continue;
+        }
+        if (code == end) {
+            break;
+        }
+        if (prev < 0) {
+            if (code >= clear) {
+                return false;
+            }
+            indices.push_back((uint8_t)code);
+            first = (uint8_t)code;
+            prev = code;
+            continue;
+        }
+        if (code > next) {
+            return false;
+        }
+        // the string of code is read back to front
+        stack.clear();
+        int current = code;
+        if (code == next) {
+            stack.push_back(first);
+            current = prev;
+        }
+        while (current >= clear) {
+            stack.push_back(suffix[current]);
+            current = prefix[current];
+        }
+        stack.push_back((uint8_t)current);
+        first = (uint8_t)current;
+        indices.insert(indices.end(), stack.rbegin(), stack.rend());
+        if (next < MAX_CODES) {
+            prefix[next] = (uint16_t)prev;
+            suffix[next] = first;
+            next++;
+            if (next == (1 << code_size) && code_size < 12) {
+                code_size++;
+            }
+        }
+        prev = code;
+    }
+    return indices.size() >= pixel_count;
+}
+
+bool readGif(const std::string& path, int& width, int& height, std::vector<std::vector<unsigned char>>& frames) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < 13 || (std::memcmp(data.data(), "GIF87a", 6) != 0 && std::memcmp(data.data(), "GIF89a", 6) != 0)) {
+        std::cerr << "Error: " << path << " is not a GIF\n";
+        return false;
+    }
+    width = readShort(data, 6);
+    height = readShort(data, 8);
+    size_t pos = 13;
+    std::vector<uint8_t> global_palette;
+    if (data[10] & 0x80) {
+        size_t size = (size_t)3 << ((data[10] & 7) + 1);
+        global_palette.assign(data.begin() + pos, data.begin() + pos + size);
+        pos += size;
+    }
+
+    // frames paint over the previous canvas, kept top-down like the file
+    std::vector<unsigned char> canvas((size_t)width * height * 3, 0);
+    frames.clear();
+    while (pos < data.size()) {
+        uint8_t block = data[pos++];
+        if (block == 0x3B) {
+            return true;
+        }
+        if (block == 0x21) {
+            pos++;
+            if (!readSubBlocks(data, pos, nullptr)) {
+                break;
+            }
+            continue;
+        }
+        if (block != 0x2C || pos + 9 > data.size()) {
+            break;
+        }
+        int left = readShort(data, pos);
+        int top = readShort(data, pos + 2);
+        int frame_width = readShort(data, pos + 4);
+        int frame_height = readShort(data, pos + 6);
+        uint8_t flags = data[pos + 8];
+        pos += 9;
+        if (flags & 0x40) {
+            std::cerr << "Error: interlaced frames are not supported\n";
+            return false;
+        }
+        std::vector<uint8_t> palette = global_palette;
+        if (flags & 0x80) {
+            size_t size = (size_t)3 << ((flags & 7) + 1);
+            palette.assign(data.begin() + pos, data.begin() + pos + size);
+            pos += size;
+        }
+        int min_code_size = data[pos++];
+        std::vector<uint8_t> lzw, indices;
+        size_t pixel_count = (size_t)frame_width * frame_height;
+        if (min_code_size < 2 || min_code_size > 8 || !readSubBlocks(data, pos, &lzw) || !decodeLzw(lzw, min_code_size, pixel_count, indices)) {
+            break;
+        }
+        for (int y = 0; y < frame_height && top + y < height; y++) {
+            for (int x = 0; x < frame_width && left + x < width; x++) {
+                size_t index = (size_t)indices[(size_t)y * frame_width + x] * 3;
+                if (index + 3 > palette.size()) continue;
+                std::memcpy(&canvas[((size_t)(top + y) * width + left + x) * 3], &palette[index], 3);
+            }
+        }
+        std::vector<unsigned char> frame(canvas.size());
+        size_t row_bytes = (size_t)width * 3;
+        for (int y = 0; y < height; y++) {
+            std::memcpy(&frame[(size_t)y * row_bytes], &canvas[(size_t)(height - 1 - y) * row_bytes], row_bytes);
+        }
+        frames.push_back(std::move(frame));
+    }
+    std::cerr << "Error: " << path << " is truncated or corrupt\n";
+    return false;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Decodes every frame of a non-interlaced GIF onto its canvas and returns them
+// as bottom-up RGB rows, the layout GifEncoder is fed with
+bool readGif(const std::string& path, int& width, int& height, std::vector<std::vector<unsigned char>>& frames);
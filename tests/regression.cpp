@@ -0,0 +1,497 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <stb_image.h>
+#include "cpp_obj-preview/processing.h"
+#include "cpp_obj-preview/objparser.h"
+#include "cpp_obj-preview/context.h"
+#include "cpp_obj-preview/rasterizer.h"
+#include "cpp_obj-preview/analytics.h"
+#include "cpp_obj-preview/normals.h"
+#include "cpp_obj-preview/texture.h"
+#include "cpp_obj-preview/report.h"
+#include "cpp_obj-preview/budget.h"
+#include "cpp_obj-preview/sheet.h"
+#include "cpp_obj-preview/gif.h"
+#include "cpp_obj-preview/pipeline.h"
+#include "cpp_obj-preview/overview.h"
+#include "cpp_obj-preview/stream.h"
+#include "alloccount.h"
+#include "gifread.h"
+
+namespace fs = std::filesystem;
+
+// CTest treats this exit code as a skipped test, used when there is no GL context
+static const int SKIP = 77;
+// small frames keep the golden images small, four of them cover the turn
+static const RenderFormat REGRESSION_FORMAT = {256, 192, 4, FPS, 1};
+static const int SHEET_COLUMNS = 2;
+static const int SHEET_ROWS = 2;
+// fixed so the analysis sums in the report do not depend on the machine
+static const int REGRESSION_THREADS = 4;
+// the allocation check runs a turn of these through the gif output and thumbnail
+// sink the preview uses, halved like gif-scale=2 so the downscale is covered
+static const RenderFormat STEADY_FORMAT = {256, 192, 24, FPS, 1};
+static const GifOutputOptions STEADY_GIF = {2, false, GifDither::Sierra2_4a, 2, 2};
+
+// Perceptual tolerance: both images are blurred over 3x3 pixels (the eye
+// averages dither patterns and single edge pixels away), then compared by
+// CIE76 delta E. A mean of 1 is at the threshold of visibility, 10 is an
+// obvious change.
+struct Tolerance {
+    double meanDeltaE;
+    double visibleDeltaE;
+    // share of the pixels allowed beyond visibleDeltaE
+    double visibleShare;
+};
+// GL and the CPU rasterizer differ on edge pixels, both have to match the same golden
+static const Tolerance RENDER_TOLERANCE = {1.0, 10.0, 0.01};
+// a 256 color palette without dithering against the frames it was fed
+static const Tolerance ENCODE_TOLERANCE = {3.0, 10.0, 0.02};
+// relative difference a number in the report may have, the geometry sums depend on the compiler's float contraction
+static const double REPORT_TOLERANCE = 1e-4;
+
+struct RegressionOptions {
+    std::string name;
+    std::string dir;
+    std::string context = "cpu";
+    bool update = false;
+};
+
+// Measured stage: milliseconds, per frame for render and encode, MiB for peak
+using Measurements = std::vector<std::pair<std::string, double>>;
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static glm::vec3 toLab(const float* rgb) {
+    float linear[3];
+    for (int c = 0; c < 3; c++) {
+        float v = rgb[c] / 255.0f;
+        linear[c] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+    }
+    // D65 white
+    float xyz[3] = {
+        (0.4124f * linear[0] + 0.3576f * linear[1] + 0.1805f * linear[2]) / 0.95047f,
+        0.2126f * linear[0] + 0.7152f * linear[1] + 0.0722f * linear[2],
+        (0.0193f * linear[0] + 0.1192f * linear[1] + 0.9505f * linear[2]) / 1.08883f
+    };
+    for (float& t : xyz) {
+        t = t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.0f / 116.0f;
+    }
+    return glm::vec3(116.0f * xyz[1] - 16.0f, 500.0f * (xyz[0] - xyz[1]), 200.0f * (xyz[1] - xyz[2]));
+}
+
+static std::vector<float> blur(const unsigned char* pixels, int width, int height) {
+    std::vector<float> out((size_t)width * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            int count = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int sx = x + dx, sy = y + dy;
+                    if (sx < 0 || sy < 0 || sx >= width || sy >= height) continue;
+                    const unsigned char* p = &pixels[((size_t)sy * width + sx) * 3];
+                    for (int c = 0; c < 3; c++) sum[c] += p[c];
+                    count++;
+                }
+            }
+            for (int c = 0; c < 3; c++) out[((size_t)y * width + x) * 3 + c] = sum[c] / count;
+        }
+    }
+    return out;
+}
+
+// Returns whether actual is within tolerance of expected, describing the difference in message
+static bool compareImages(const unsigned char* expected, const unsigned char* actual, int width, int height, const Tolerance& tolerance,
+                          std::string& message) {
+    std::vector<float> a = blur(expected, width, height);
+    std::vector<float> b = blur(actual, width, height);
+    double sum = 0.0;
+    size_t visible = 0;
+    size_t pixel_count = (size_t)width * height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        double delta = glm::length(toLab(&a[i * 3]) - toLab(&b[i * 3]));
+        sum += delta;
+        visible += delta > tolerance.visibleDeltaE;
+    }
+    double mean = sum / pixel_count;
+    double share = (double)visible / pixel_count;
+    std::ostringstream text;
+    text << "mean delta E " << mean << " (at most " << tolerance.meanDeltaE << "), " << share * 100.0 << "% of the pixels beyond "
+         << tolerance.visibleDeltaE << " (at most " << tolerance.visibleShare * 100.0 << "%)";
+    message = text.str();
+    return mean <= tolerance.meanDeltaE && share <= tolerance.visibleShare;
+}
+
+static bool readFile(const std::string& path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Compares two lines character by character, numbers by value within REPORT_TOLERANCE
+static bool sameLine(const std::string& expected, const std::string& actual) {
+    const char* a = expected.c_str();
+    const char* b = actual.c_str();
+    while (*a && *b) {
+        bool number_a = std::isdigit((unsigned char)*a) || (*a == '-' && std::isdigit((unsigned char)a[1]));
+        bool number_b = std::isdigit((unsigned char)*b) || (*b == '-' && std::isdigit((unsigned char)b[1]));
+        if (number_a && number_b) {
+            char* end_a;
+            char* end_b;
+            double x = std::strtod(a, &end_a);
+            double y = std::strtod(b, &end_b);
+            if (std::fabs(x - y) > REPORT_TOLERANCE * std::max(std::fabs(x), std::fabs(y)) + 1e-6) {
+                return false;
+            }
+            a = end_a;
+            b = end_b;
+            continue;
+        }
+        if (*a++ != *b++) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+static bool compareReports(const std::string& expected, const std::string& actual, std::string& message) {
+    std::istringstream a(expected), b(actual);
+    std::string line_a, line_b;
+    for (int line = 1;; line++) {
+        bool more_a = (bool)std::getline(a, line_a);
+        bool more_b = (bool)std::getline(b, line_b);
+        if (!more_a && !more_b) {
+            return true;
+        }
+        if (more_a != more_b || !sameLine(line_a, line_b)) {
+            message = "line " + std::to_string(line) + ": expected \"" + (more_a ? line_a : "<end>") + "\", got \"" + (more_b ? line_b : "<end>") + "\"";
+            return false;
+        }
+    }
+}
+
+// Budget lines are "<case> <context> <stage> <limit>"
+static bool readBudgets(const std::string& path, const std::string& name, const std::string& context, Measurements& budgets) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string budget_name, budget_context, stage;
+        double limit;
+        if (line.empty() || line[0] == '#' || !(fields >> budget_name >> budget_context >> stage >> limit)) {
+            continue;
+        }
+        if (budget_name == name && budget_context == context) {
+            budgets.push_back({stage, limit});
+        }
+    }
+    return true;
+}
+
+// Counts the allocations of the frames rendered and encoded after every
+// pipeline job has been used once. A job is taken per frame in turn, so the
+// push of frame 2 * jobs waits for frame jobs to be written: by then the
+// first use of each job is done.
+static int steadyAllocations(const FormatRenderer& render_format, const fs::path& work_dir, double& allocations) {
+    GifOutput output;
+    FrameSink gif_sink;
+    if (openGifOutput(output, (work_dir / "steady.gif").string(), STEADY_FORMAT, STEADY_GIF, gif_sink) != 0) {
+        return 1;
+    }
+    std::vector<unsigned char> thumbnail;
+    std::string thumbnail_path = (work_dir / "steady-thumbnail.png").string();
+    FrameSink preview_sink = firstFrameSink(gif_sink, STEADY_FORMAT.width, STEADY_FORMAT.height, true, thumbnail,
+        [&](const unsigned char* pixels, int width, int height) {
+            return writePng(thumbnail_path, pixels, width, height) ? 0 : 1;
+        });
+    int warm_frame = 2 * (STEADY_GIF.workers + STEADY_GIF.queueDepth);
+    uint64_t warm_count = 0;
+    FrameSink sink = [&](int frame, const unsigned char* pixels) {
+        int ret = preview_sink(frame, pixels);
+        if (frame == warm_frame) {
+            warm_count = allocationCount();
+        }
+        return ret;
+    };
+    int ret = render_format(STEADY_FORMAT, sink);
+    uint64_t count = allocationCount();
+    if (closeGifOutput(output) != 0 || ret != 0) {
+        std::cerr << "Error: Failed to render the allocation check's frames\n";
+        return 1;
+    }
+    allocations = (double)(count - warm_count);
+    return 0;
+}
+
+static int parseOptions(int argc, char** argv, RegressionOptions& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--update") {
+            options.update = true;
+        } else if (arg == "--context" && i + 1 < argc) {
+            options.context = argv[++i];
+        } else if (arg.rfind("--", 0) == 0) {
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2) {
+        return 1;
+    }
+    options.name = positional[0];
+    options.dir = positional[1];
+    return 0;
+}
+
+// Renders REGRESSION_FORMAT's frames of models/<name>.obj and checks them
+// against golden/<name>.png, the builtin gif of them against the frames, the
+// report against expected/<name>.md and the stage times and peak memory
+// against budgets.txt. --update rewrites the golden image and the report and
+// prints the measured stages in the budget format.
+int main(int argc, char** argv) {
+    RegressionOptions options;
+    if (parseOptions(argc, argv, options) != 0) {
+        std::cerr << "Usage: cpp_obj-preview-regression <case> <tests dir> [--context cpu|egl|glfw] [--update]\n";
+        return 1;
+    }
+    const std::string& context = options.context;
+    ContextBackend backend = parseContextBackend(context);
+    std::string model_path = options.dir + "/models/" + options.name + ".obj";
+    std::string golden_path = options.dir + "/golden/" + options.name + ".png";
+    std::string report_path = options.dir + "/expected/" + options.name + ".md";
+    fs::path work_dir = fs::temp_directory_path() / ("cpp_obj-preview-regression-" + options.name + "-" + context);
+    std::error_code ec;
+    fs::create_directories(work_dir, ec);
+    if (ec) {
+        std::cerr << "Error: Failed to create " << work_dir << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    RenderContext render_context;
+    if (backend != ContextBackend::Cpu && render_context.create(backend, REGRESSION_FORMAT.width, REGRESSION_FORMAT.height) != 0) {
+        std::cerr << "No GL context, skipping\n";
+        return SKIP;
+    }
+
+    Measurements measured;
+    auto start = std::chrono::steady_clock::now();
+    ObjModel model;
+    if (loadModel(model_path, ObjParser::Native, REGRESSION_THREADS, model) != 0) {
+        return 1;
+    }
+    measured.push_back({"load", millisecondsSince(start)});
+
+    TextureCache texture_cache;
+    start = std::chrono::steady_clock::now();
+    MaterialImages images = texture_cache.load(model.materials, fs::path(model_path).parent_path().string(),
+                                               textureSizeLimit(REGRESSION_FORMAT.width, REGRESSION_FORMAT.height), REGRESSION_THREADS).get();
+    measured.push_back({"textures", millisecondsSince(start)});
+    bool textured = std::any_of(images.begin(), images.end(), [](const std::shared_ptr<const TextureImage>& image) { return image != nullptr; });
+
+    start = std::chrono::steady_clock::now();
+    PackedMeshes packed = packShapes(model.attrib, model.shapes, REGRESSION_THREADS);
+    generateNormals(packed, DEFAULT_CREASE_ANGLE, REGRESSION_THREADS);
+    measured.push_back({"geometry", millisecondsSince(start)});
+    MeshArena arena = packed.arena();
+
+    start = std::chrono::steady_clock::now();
+    GeometryStats stats = analyzeGeometry(arena, REGRESSION_THREADS);
+    measured.push_back({"analyze", millisecondsSince(start)});
+    model.renderedTriangles = arena.indexCount / 3;
+    Camera camera = frameCamera(stats.bboxMin, stats.bboxMax, REGRESSION_FORMAT.width / (float)REGRESSION_FORMAT.height);
+
+    size_t frame_bytes = (size_t)REGRESSION_FORMAT.width * REGRESSION_FORMAT.height * 3;
+    std::vector<std::vector<unsigned char>> frames(REGRESSION_FORMAT.frames);
+    FrameSink capture = [&](int frame, const unsigned char* pixels) {
+        frames[frame].assign(pixels, pixels + frame_bytes);
+        return 0;
+    };
+    start = std::chrono::steady_clock::now();
+    std::unique_ptr<Shader> shader;
+    std::vector<MeshGL> meshes;
+    std::vector<GLuint> textures;
+    if (backend != ContextBackend::Cpu) {
+        shader.reset(new Shader());
+        meshes = uploadArena(arena, textured, REGRESSION_THREADS);
+        textures = uploadTextures(images);
+    }
+    FormatRenderer render_format = [&](const RenderFormat& format, const FrameSink& sink) {
+        if (backend == ContextBackend::Cpu) {
+            return renderCpu(arena, camera, model.materials, images, REGRESSION_THREADS, format, sink);
+        }
+        return render(*shader, meshes, camera, model.materials, textures, format, sink);
+    };
+    if (render_format(REGRESSION_FORMAT, capture) != 0) {
+        std::cerr << "Error: Failed to render " << model_path << std::endl;
+        return 1;
+    }
+    measured.push_back({"render", millisecondsSince(start) / REGRESSION_FORMAT.frames});
+
+    double allocations;
+    if (steadyAllocations(render_format, work_dir, allocations) != 0) {
+        return 1;
+    }
+    measured.push_back({"allocations", allocations});
+    if (shader) {
+        deleteTextures(textures);
+        deleteMeshes(meshes);
+        shader.reset();
+    }
+
+    // the builtin encoder with the default dithering, as the preview runs it
+    std::string gif_path = (work_dir / "obj-overview.gif").string();
+    start = std::chrono::steady_clock::now();
+    GifEncoder gif;
+    bool encoded = gif.open(gif_path, REGRESSION_FORMAT.width, REGRESSION_FORMAT.height, REGRESSION_FORMAT.fps, GifDither::Sierra2_4a, true);
+    for (const auto& frame : frames) {
+        encoded = encoded && gif.addFrame(frame.data());
+    }
+    encoded = encoded && gif.close();
+    if (!encoded) {
+        std::cerr << "Error: Failed to encode " << gif_path << std::endl;
+        return 1;
+    }
+    measured.push_back({"encode", millisecondsSince(start) / REGRESSION_FORMAT.frames});
+
+    // the report names the case instead of the checkout's path
+    model.filename = options.name + ".obj";
+    std::string save_dir = work_dir.string() + "/";
+    if (generateReport(model, stats, save_dir, {true, false, REGRESSION_FORMAT, "", false, ""}) != 0) {
+        return 1;
+    }
+    measured.push_back({"peak", peakResidentBytes() / 1048576.0});
+
+    ContactSheet sheet(SHEET_COLUMNS, SHEET_ROWS, REGRESSION_FORMAT.width, REGRESSION_FORMAT.height);
+    for (int frame = 0; frame < REGRESSION_FORMAT.frames; frame++) {
+        sheet.add(frame, frames[frame].data());
+    }
+    std::string report;
+    if (!readFile(save_dir + "obj-preview.md", report)) {
+        std::cerr << "Error: Failed to read the generated report\n";
+        return 1;
+    }
+    if (options.update) {
+        std::ofstream expected(report_path, std::ios::binary);
+        expected << report;
+        if (!sheet.save(golden_path) || !expected) {
+            std::cerr << "Error: Failed to update " << golden_path << " and " << report_path << std::endl;
+            return 1;
+        }
+        std::cout << "Updated " << golden_path << " and " << report_path << ", measured:\n";
+        for (const auto& stage : measured) {
+            std::cout << options.name << " " << context << " " << stage.first << " " << stage.second << "\n";
+        }
+        fs::remove_all(work_dir, ec);
+        return 0;
+    }
+
+    int failures = 0;
+    std::string golden_data;
+    int golden_width = 0, golden_height = 0, channels = 0;
+    stbi_uc* golden = nullptr;
+    if (readFile(golden_path, golden_data)) {
+        golden = stbi_load_from_memory((const stbi_uc*)golden_data.data(), (int)golden_data.size(), &golden_width, &golden_height, &channels, 3);
+    }
+    if (!golden || golden_width != SHEET_COLUMNS * REGRESSION_FORMAT.width || golden_height != SHEET_ROWS * REGRESSION_FORMAT.height) {
+        std::cerr << "FAIL golden: cannot read a " << SHEET_COLUMNS * REGRESSION_FORMAT.width << "x" << SHEET_ROWS * REGRESSION_FORMAT.height
+                  << " image from " << golden_path << std::endl;
+        failures++;
+    } else {
+        // tile i of the top-down sheet, flipped into a bottom-up frame
+        std::vector<unsigned char> tile(frame_bytes);
+        size_t row_bytes = (size_t)REGRESSION_FORMAT.width * 3;
+        for (int frame = 0; frame < REGRESSION_FORMAT.frames; frame++) {
+            int column = frame % SHEET_COLUMNS;
+            int row = frame / SHEET_COLUMNS;
+            for (int y = 0; y < REGRESSION_FORMAT.height; y++) {
+                const stbi_uc* source = golden + ((size_t)(row * REGRESSION_FORMAT.height + y) * golden_width + (size_t)column * REGRESSION_FORMAT.width) * 3;
+                std::memcpy(&tile[(size_t)(REGRESSION_FORMAT.height - 1 - y) * row_bytes], source, row_bytes);
+            }
+            std::string message;
+            bool same = compareImages(tile.data(), frames[frame].data(), REGRESSION_FORMAT.width, REGRESSION_FORMAT.height, RENDER_TOLERANCE, message);
+            std::cout << (same ? "ok" : "FAIL") << " frame " << frame << ": " << message << "\n";
+            failures += !same;
+        }
+    }
+    stbi_image_free(golden);
+
+    int gif_width, gif_height;
+    std::vector<std::vector<unsigned char>> gif_frames;
+    if (!readGif(gif_path, gif_width, gif_height, gif_frames) || gif_frames.size() != frames.size() || gif_width != REGRESSION_FORMAT.width ||
+        gif_height != REGRESSION_FORMAT.height) {
+        std::cerr << "FAIL gif: " << gif_path << " does not hold the " << frames.size() << " rendered frames\n";
+        failures++;
+    } else {
+        for (size_t frame = 0; frame < frames.size(); frame++) {
+            std::string message;
+            bool same = compareImages(frames[frame].data(), gif_frames[frame].data(), gif_width, gif_height, ENCODE_TOLERANCE, message);
+            std::cout << (same ? "ok" : "FAIL") << " gif frame " << frame << ": " << message << "\n";
+            failures += !same;
+        }
+    }
+
+    std::string expected_report, message;
+    if (!readFile(report_path, expected_report)) {
+        std::cerr << "FAIL report: cannot read " << report_path << std::endl;
+        failures++;
+    } else if (!compareReports(expected_report, report, message)) {
+        std::cout << "FAIL report: " << message << "\n";
+        failures++;
+    } else {
+        std::cout << "ok report\n";
+    }
+
+    Measurements budgets;
+    if (!readBudgets(options.dir + "/budgets.txt", options.name, context, budgets)) {
+        std::cerr << "FAIL budgets: cannot read " << options.dir << "/budgets.txt\n";
+        failures++;
+    }
+    for (const auto& budget : budgets) {
+        if (std::none_of(measured.begin(), measured.end(), [&](const std::pair<std::string, double>& m) { return m.first == budget.first; })) {
+            std::cout << "FAIL budget " << budget.first << ": no such stage\n";
+            failures++;
+        }
+    }
+    for (const auto& stage : measured) {
+        const char* unit = stage.first == "peak" ? " MiB" : stage.first == "allocations" ? "" : " ms";
+        auto budget = std::find_if(budgets.begin(), budgets.end(), [&](const std::pair<std::string, double>& b) { return b.first == stage.first; });
+        // an unbudgeted stage is reported in the budget file's format but not enforced
+        if (budget == budgets.end()) {
+            std::cout << "no budget: " << options.name << " " << context << " " << stage.first << " " << stage.second << "\n";
+            continue;
+        }
+        bool within = stage.second <= budget->second;
+        std::cout << (within ? "ok" : "FAIL") << " budget " << stage.first << ": " << stage.second << unit << " (at most " << budget->second << unit << ")\n";
+        failures += !within;
+    }
+
+    if (failures > 0) {
+        std::cerr << "Error: " << failures << " check(s) failed, outputs kept in " << work_dir.string() << std::endl;
+        return 1;
+    }
+    fs::remove_all(work_dir, ec);
+    return 0;
+}